@@ -21,11 +21,25 @@ using namespace std;
 struct GALAXY                   /* Galaxy data */
  *Gal, *HaloGal;
 
+#if defined(COMPUTE_SPECPHOT_PROPERTIES) && !defined(POST_PROCESS_MAGS)
+struct GALAXY_LUM               /* photometry, addressed by GALAXY.LumIndex */
+ *GalLum;
+int *GalLumFree, NGalLumFree, MaxGalLum;
+#endif
+
+#ifdef GALAXY_SOA
+struct galaxy_soa GalSoA;
+#endif
+
 struct halo_data *Halo, *Halo_Data;
 
 struct halo_aux_data            /* auxiliary halo data */
  *HaloAux;
 
+int NFofSchedule;
+int *FofSchedule;
+int FofScheduleSnapStart[MAXSNAPS + 1];
+
 struct halo_ids_data *HaloIDs, *HaloIDs_Data;
 
 int FirstFile;                  /* first and last file for processing */
@@ -41,6 +55,8 @@ int Ntrees;                     /* number of trees in current file */
 int MaxGal;
 int NHaloGal, MaxHaloGal;
 int NGalTree, MaxGalTree;
+int NGalTreeOutput, MaxGalTreeOutput, GalTreeOutputOnDisk;
+struct GALAXY_OUTPUT *GalTreeOutput;
 int *HaloGalHeap;
 int IndexStored;
 
@@ -69,6 +85,11 @@ char FileWithZList_OriginalCosm_MRII[512];
 
 double ScalePos, ScaleMass;
 
+#ifdef SCALED_TREE_CACHE
+char ScaledTreeCacheDir[512];
+int TreesScaledOnDisk;
+#endif
+
 #ifdef SPECIFYFILENR
 char FileNrDir[512];
 int ListInputFilrNr[111];
@@ -161,6 +182,7 @@ double Reionization_zr;
 double RamPressureStrip_CutOffMass;
 double SfrEfficiency;
 double SfrColdCrit;
+double QuiescentHotGas, QuiescentColdGas;   /* only used with ADAPTIVE_SUBSTEPS */
 double SfrBurstEfficiency;
 double SfrBurstSlope;
 double Yield;
@@ -201,6 +223,8 @@ double AA_OriginalCosm[MAXSNAPS];
 
 double Age[MAXSNAPS];
 
+struct snapshot_factors SnapFactors[MAXSNAPS];
+
 int Zlistlen;
 
 gsl_rng *random_generator;
@@ -261,7 +285,20 @@ double tau_dt[STEPS * MAXSNAPS];        //Width of every timestep in the code. (
 float SSP_logMetalTab[SSP_NMETALLICITES];
 float SSP_logAgeTab[SSP_NAGES];
 float RedshiftTab[MAXSNAPS];
+#ifdef LUMTABLES_BANDS_INNERMOST
+alignas(LUM_SIMD_WIDTH * sizeof(float)) float LumTables[SSP_NMETALLICITES][MAXSNAPS][SSP_NAGES][NMAG_PADDED];
+#else
 float LumTables[NMAG][SSP_NMETALLICITES][MAXSNAPS][SSP_NAGES];
+#endif
+#ifdef POST_PROCESS_MAGS
+double PostProcessLumKernel[NOUT][NMAG][SFH_NBIN][SSP_NMETALLICITES][PPLUM_NZ];
+double PostProcessAge[NOUT][SFH_NBIN];
+int PostProcessOutputNr[MAXSNAPS];
+#endif
+#ifndef POST_PROCESS_MAGS
+struct lum_age_weights LumAgeWeights[MAXSNAPS][STEPS][NOUT];
+double LumStepTime[MAXSNAPS][STEPS];
+#endif
 float FilterLambda[NMAG + 1];   //wavelength of each filter + 1 for V-band
 
 #ifdef SPEC_PHOTABLES_ON_THE_FLY
@@ -295,9 +332,24 @@ size_t offset_galaxydata, maxstorage_galaxydata, filled_galaxydata;
 size_t offset_galsnapdata[NOUT], maxstorage_galsnapdata[NOUT], filled_galsnapdata[NOUT];
 #endif
 
+#ifdef OPENMP
+struct GALAXY_OUTPUT *GalOutputBuf;
+int *GalOutputBufSnap;
+int NGalOutputBuf, MaxGalOutputBuf;
+#endif
+
 /* reionization Okamoto et al. 2008*/
 float Reion_z[46], Reion_Mc[46];
 
+#ifdef PREFETCH_TREES
+int NextTreeFileNr = -1;
+#endif
+
+#ifdef MMAP_TREES
+char *TreeFileMap, *TreeDbidsFileMap;
+size_t TreeFileMapSize, TreeDbidsFileMapSize;
+#endif
+
 FILE *tree_file;
 FILE *treeaux_file;
 FILE *treedbids_file;
@@ -27,6 +27,9 @@ constexpr auto MIN_ALLOC_NUMBER = 1000;
 constexpr auto ALLOC_INCREASE_FACTOR = 1.1;
 constexpr auto ALLOC_DECREASE_FACTOR = 0.7;
 
+constexpr auto GALTREE_BUFFER_FRACTION = 0.25;  /* of MaxMemSize, for the galaxies of one tree kept until save_galaxy_tree_finalize() */
+constexpr auto OUTPUT_BUFFER_FRACTION = 0.05;   /* of MaxMemSize, shared by the output file buffers of the ASYNC_OUTPUT thread */
+
 constexpr auto PRECISION_LIMIT = 1.e-7;
 
 template < typename T, typename U > static auto wrap(T x, U y)
@@ -575,44 +578,12 @@ extern struct GALAXY            /* Galaxy data */
   float MetalsICM;
 #endif
 
-  /* luminosities in various bands */
+  /* luminosities in various bands live in GalLum[LumIndex], see GALLUM() */
 #ifdef COMPUTE_SPECPHOT_PROPERTIES
 #ifndef POST_PROCESS_MAGS
-#ifdef OUTPUT_REST_MAGS
-  float Lum[NMAG][NOUT];
-  float YLum[NMAG][NOUT];
-  float LumBulge[NMAG][NOUT];
-  float YLumBulge[NMAG][NOUT];
-  float LumDust[NMAG][NOUT];
-#ifdef ICL
-  float ICLLum[NMAG][NOUT];
-#endif
-#endif                          //OUTPUT_REST_MAGS
-
-#ifdef COMPUTE_OBS_MAGS
-  float ObsLum[NMAG][NOUT];
-  float ObsYLum[NMAG][NOUT];
-  float ObsLumBulge[NMAG][NOUT];
-  float ObsYLumBulge[NMAG][NOUT];
-  float ObsLumDust[NMAG][NOUT];
-#ifdef ICL
-  float ObsICL[NMAG][NOUT];
-#endif
-
-#ifdef OUTPUT_MOMAF_INPUTS
-  float dObsLum[NMAG][NOUT];
-  float dObsYLum[NMAG][NOUT];
-  float dObsLumBulge[NMAG][NOUT];
-  float dObsYLumBulge[NMAG][NOUT];
-  float dObsLumDust[NMAG][NOUT];
-#ifdef ICL
-  float dObsICL[NMAG][NOUT];
+  int LumIndex;
 #endif
 #endif
-#endif                          //COMPUTE_OBS_MAGS
-
-#endif                          //ndef POST_PROCESS_MAGS
-#endif                          //COMPUTE_SPECPHOT_PROPERTIES
 
   float MassWeightAge[NOUT];
 #ifdef STAR_FORMATION_HISTORY
@@ -653,8 +624,95 @@ extern struct GALAXY            /* Galaxy data */
 #endif                          //INDIVIDUAL_ELEMENTS
 } *Gal, *HaloGal;
 
+/* Photometry of a galaxy, kept out of struct GALAXY so that the physics
+ * loops only touch the hot record and joining progenitors moves a handle
+ * (GALAXY.LumIndex) instead of copying NMAG*NOUT arrays. Records are
+ * allocated with new_galaxy_lum() and released with free_galaxy_lum(). */
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+extern struct GALAXY_LUM
+{
+#ifdef OUTPUT_REST_MAGS
+  float Lum[NMAG][NOUT];
+  float YLum[NMAG][NOUT];
+  float LumBulge[NMAG][NOUT];
+  float YLumBulge[NMAG][NOUT];
+  float LumDust[NMAG][NOUT];
+#ifdef ICL
+  float ICLLum[NMAG][NOUT];
+#endif
+#endif                          //OUTPUT_REST_MAGS
+
+#ifdef COMPUTE_OBS_MAGS
+  float ObsLum[NMAG][NOUT];
+  float ObsYLum[NMAG][NOUT];
+  float ObsLumBulge[NMAG][NOUT];
+  float ObsYLumBulge[NMAG][NOUT];
+  float ObsLumDust[NMAG][NOUT];
+#ifdef ICL
+  float ObsICL[NMAG][NOUT];
+#endif
+
+#ifdef OUTPUT_MOMAF_INPUTS
+  float dObsLum[NMAG][NOUT];
+  float dObsYLum[NMAG][NOUT];
+  float dObsLumBulge[NMAG][NOUT];
+  float dObsYLumBulge[NMAG][NOUT];
+  float dObsLumDust[NMAG][NOUT];
+#ifdef ICL
+  float dObsICL[NMAG][NOUT];
+#endif
+#endif
+#endif                          //COMPUTE_OBS_MAGS
+}
+ *GalLum;
+
+extern int *GalLumFree, NGalLumFree, MaxGalLum;
+
+#define GALLUM(g) (GalLum[(g).LumIndex])
+#endif                          //ndef POST_PROCESS_MAGS
+#endif                          //COMPUTE_SPECPHOT_PROPERTIES
+
+#ifdef GALAXY_SOA
+/* Scalar state of the galaxies of the FOF group in evolve_galaxies(), one
+ * contiguous array per field, so that the per-substep recipes run as
+ * vectorisable loops. Filled by gather_galaxy_soa_halo() once per substep
+ * and gather_galaxy_soa_gas() before each pass that reads the gas. */
+extern struct galaxy_soa
+{
+  int n;
+  int *Type;
+  float *Mvir, *Rvir, *Vvir, *HotRadius;
+  float *HotGas, *EjectedMass, *CoolingRadius, *CoolingGas;
+  double *Fraction;             /* per-galaxy result of a kernel */
+}
+GalSoA;
+#endif
+
+/* Reservoirs that transfer_gas<to, from>() and transfer_stars<to, from>()
+ * move mass and metals between */
+enum gas_component
+{
+  GAS_COLD,
+  GAS_HOT,
+  GAS_EJECTED
+};
+
+enum star_component
+{
+  STARS_DISK,
+  STARS_BULGE,
+  STARS_ICM,
+#ifdef TRACK_BURST
+  STARS_BURST,                  /* not a separate component: only ever moved Burst -> Burst */
+#endif
+};
+
 
 // Documentation can be found in the database
+#ifdef MMAP_TREES
+#pragma pack(push, 4)           //same layout, but may sit at any 4-byte offset in a mapped trees file
+#endif
 extern struct halo_data
 {
   /* merger tree pointers */
@@ -680,6 +738,9 @@ extern struct halo_data
   int SubhaloIndex;
   float SubHalfMass;
 } *Halo, *Halo_Data;
+#ifdef MMAP_TREES
+#pragma pack(pop)
+#endif
 
 
 // Documentation can be found in the database
@@ -722,8 +783,19 @@ extern struct halo_aux_data     /* auxiliary halo data */
   float Vel_Unscaled[3];
   float Vmax_Unscaled;
   float Spin_Unscaled[3];
+  double Mvir;                  /* virial mass, radius and velocity, */
+  double Rvir;                  /* set by set_halo_virial_properties() */
+  double Vvir;                  /* once the tree has been scaled */
+#ifdef GALAXYTREE
+  int MostMassiveSubhalo;       /* set by load_tree() for first halos of FOF groups */
+#endif
 } *HaloAux;
 
+/* FOF groups of the current tree (by first halo) in the order they are constructed */
+extern int NFofSchedule;
+extern int *FofSchedule;
+extern int FofScheduleSnapStart[MAXSNAPS + 1];
+
 
 extern int FirstFile;           /* first and last file for processing */
 extern int LastFile;
@@ -736,6 +808,8 @@ extern double AllocValue_MaxGalTree;
 extern int MaxGal;              /* Maximum number of galaxies allowed for Gal[] array */
 extern int NHaloGal, MaxHaloGal;
 extern int NGalTree, MaxGalTree;
+extern int NGalTreeOutput, MaxGalTreeOutput, GalTreeOutputOnDisk;
+extern struct GALAXY_OUTPUT *GalTreeOutput;
 extern int *HaloGalHeap;
 extern int IndexStored;
 
@@ -781,6 +855,11 @@ extern char FileWithZList_OriginalCosm_MRII[512];
 extern double ScalePos;
 extern double ScaleMass;
 
+#ifdef SCALED_TREE_CACHE
+extern char ScaledTreeCacheDir[512];
+extern int TreesScaledOnDisk;   /* the trees of the current file come already scaled from the cache */
+#endif
+
 #ifdef SPECIFYFILENR
 extern char FileNrDir[512];
 extern int ListInputFilrNr[111];
@@ -866,6 +945,7 @@ extern double MergerTimeMultiplier;
 extern double RamPressureStrip_CutOffMass;
 extern double SfrEfficiency;
 extern double SfrColdCrit;
+extern double QuiescentHotGas, QuiescentColdGas;   /* only used with ADAPTIVE_SUBSTEPS */
 extern double SfrBurstEfficiency;
 extern double SfrBurstSlope;
 extern double AgnEfficiency;
@@ -900,6 +980,16 @@ extern double AA_OriginalCosm[MAXSNAPS];
 
 extern double Age[MAXSNAPS];
 
+/* Quantities that depend only on the redshift of a snapshot, tabulated by
+ * init_snapshot_factors() so that the recipes read them instead of
+ * recomputing them for every halo */
+extern struct snapshot_factors
+{
+  double HubbleZ;               /* H(z) in internal units */
+  double VirialRadiusFac;       /* Rvir^3/Mvir for an overdensity of 200 rho_crit(z) */
+  double ReionMass;             /* characteristic mass of the reionization modifier */
+} SnapFactors[MAXSNAPS];
+
 extern int Zlistlen;
 
 extern gsl_rng *random_generator;
@@ -1099,7 +1189,57 @@ extern float SSP_logAgeTab[SSP_NAGES];
 
 //table containing redshift (different from the one in the code when scaling to future times)
 extern float RedshiftTab[MAXSNAPS];
+#ifdef LUMTABLES_BANDS_INNERMOST
+/* bands innermost, padded to whole SIMD vectors, so that all bands of one
+ * table entry are interpolated together in add_to_luminosities() */
+constexpr auto LUM_SIMD_WIDTH = 8;
+constexpr auto NMAG_PADDED = (NMAG + LUM_SIMD_WIDTH - 1) / LUM_SIMD_WIDTH * LUM_SIMD_WIDTH;
+extern float LumTables[SSP_NMETALLICITES][MAXSNAPS][SSP_NAGES][NMAG_PADDED];
+#define LUMTABLES(band, met, snap, age) LumTables[met][snap][age][band]
+#else
 extern float LumTables[NMAG][SSP_NMETALLICITES][MAXSNAPS][SSP_NAGES];
+#define LUMTABLES(band, met, snap, age) LumTables[band][met][snap][age]
+#endif
+
+#ifdef POST_PROCESS_MAGS
+/* LumTables redshift columns used when post-processing a galaxy at
+ * snapshot snap: rest frame, snap, snap-1 and snap+1 */
+enum
+{
+#ifdef OUTPUT_REST_MAGS
+  PPLUM_REST,
+#endif
+#ifdef COMPUTE_OBS_MAGS
+  PPLUM_OBS,
+#ifdef OUTPUT_MOMAF_INPUTS
+  PPLUM_DOBS,
+#ifdef KITZBICHLER
+  PPLUM_DOBS_FORWARD,
+#endif
+#endif
+#endif
+  PPLUM_NZ
+};
+
+/* luminosity per unit mass of the stars in SFH bin [ll] of a galaxy at
+ * output [n], interpolated in age only, and their age; output number of
+ * each snapshot or -1 (see init_post_process_lum_kernels) */
+extern double PostProcessLumKernel[NOUT][NMAG][SFH_NBIN][SSP_NMETALLICITES][PPLUM_NZ];
+extern double PostProcessAge[NOUT][SFH_NBIN];
+extern int PostProcessOutputNr[MAXSNAPS];
+#endif
+
+#ifndef POST_PROCESS_MAGS
+/* age interpolation into LumTables for stars formed in step [nstep] of
+ * snapshot [snap], at each output time (see init_lum_age_weights) */
+extern struct lum_age_weights
+{
+  int tabindex;
+  int young;                    /* younger than the birth cloud time */
+  double f1, f2;
+} LumAgeWeights[MAXSNAPS][STEPS][NOUT];
+extern double LumStepTime[MAXSNAPS][STEPS];
+#endif
 extern float FilterLambda[NMAG + 1];    //wavelength of each filter + 1 for V-band
 
 #ifdef SPEC_PHOTABLES_ON_THE_FLY
@@ -1144,10 +1284,44 @@ extern size_t offset_galaxydata, maxstorage_galaxydata, filled_galaxydata;
 extern size_t offset_galsnapdata[NOUT], maxstorage_galsnapdata[NOUT], filled_galsnapdata[NOUT];
 #endif
 
+#ifdef OPENMP
+/* buffer for the galaxies of the current tree, written out in tree order */
+extern struct GALAXY_OUTPUT *GalOutputBuf;
+extern int *GalOutputBufSnap;
+extern int NGalOutputBuf, MaxGalOutputBuf;
+
+/* everything that describes the tree being worked on is private to each thread */
+#pragma omp threadprivate(Gal, HaloGal, Halo, HaloAux, HaloIDs, HaloGalHeap, MaxGal, NHaloGal, MaxHaloGal, \
+                          IndexStored, AllocValue_MaxHaloGal, AllocValue_MaxGal, NFofSchedule, FofSchedule, \
+                          FofScheduleSnapStart, NumMergers, random_generator, HighMark, AllocatedBytes, \
+                          HighMarkBytes, FreeBytes, GalOutputBuf, GalOutputBufSnap, NGalOutputBuf, MaxGalOutputBuf)
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#pragma omp threadprivate(mu_seed)
+#ifndef POST_PROCESS_MAGS
+#pragma omp threadprivate(GalLum, GalLumFree, NGalLumFree, MaxGalLum)
+#endif
+#endif
+#ifdef UPDATETYPETWO
+#pragma omp threadprivate(Nids, OffsetIDs, IdList, PosList, VelList)
+#endif
+#ifdef GALAXY_SOA
+#pragma omp threadprivate(GalSoA)
+#endif
+#endif //OPENMP
+
 #endif
 
 extern float Reion_z[46], Reion_Mc[46];
 
+#ifdef PREFETCH_TREES
+extern int NextTreeFileNr;
+#endif
+
+#ifdef MMAP_TREES
+extern char *TreeFileMap, *TreeDbidsFileMap;
+extern size_t TreeFileMapSize, TreeDbidsFileMapSize;
+#endif
+
 extern FILE *tree_file;
 extern FILE *treeaux_file;
 extern FILE *treedbids_file;
@@ -55,6 +55,16 @@ static double metallicities[8] = {
 
 static double CoolRate[8][TABSIZE];
 
+/* CoolRateSlope[i][n] = d(CoolRate)/d(logT) between the temperature
+ * points n and n+1 of table i, and CoolZStart[k] the first table to look
+ * at for a metallicity in the k-th of NCOOLZJUMP uniform bins between
+ * metallicities[0] and metallicities[7], so that a lookup needs neither a
+ * search nor a division in temperature (see init_cooling_tables) */
+constexpr auto NCOOLZJUMP = 64;
+static double CoolRateSlope[8][TABSIZE];
+static int CoolZStart[NCOOLZJUMP + 1];
+static double CoolZJumpFac;
+
 /**@file cool_cunf.c reads the gas cooling functions*/
 void read_cooling_functions(void)
 {
@@ -92,6 +102,8 @@ void read_cooling_functions(void)
       fclose(fd);
     }
 
+  init_cooling_tables();
+
 #ifdef PARALLEL
   if(ThisTask == 0)
     printf("cooling functions read.\n\n");
@@ -106,12 +118,54 @@ void read_cooling_functions(void)
 
 /* pass: log10(temperatue/Kelvin), log10(metallicity) */
 
-double get_metaldependent_cooling_rate(double logTemp, double logZ)
+/**@brief Tabulates the temperature slopes of the cooling tables and the
+ *        starting table for each metallicity bin used by
+ *        get_metaldependent_cooling_rate(). */
+void init_cooling_tables(void)
 {
-  int i;
-  double get_rate(int tab, double logTemp);
-  double rate1, rate2, rate;
+  int i, k, n;
+  double logZ;
+
+  for(i = 0; i < 8; i++)
+    for(n = 0; n < TABSIZE - 1; n++)
+      CoolRateSlope[i][n] = (CoolRate[i][n + 1] - CoolRate[i][n]) / (0.05);
+
+  CoolZJumpFac = NCOOLZJUMP / (metallicities[7] - metallicities[0]);
+
+  for(k = 0; k <= NCOOLZJUMP; k++)
+    {
+      logZ = metallicities[0] + k / CoolZJumpFac;
+      i = 0;
+      while(i < 6 && logZ > metallicities[i + 1])
+        i++;
+      /* one table lower, so that rounding in the bin never starts the search too high */
+      CoolZStart[k] = (i > 0) ? i - 1 : 0;
+    }
+}
+
+
+static inline double get_rate(int tab, double logTemp)
+{
+  int index;
+  double logTindex;
+
+  if(logTemp < 4.0)
+    logTemp = 4.0;
+
+  index = (logTemp - 4.0) / 0.05;
+  if(index >= 90)
+    index = 89;
 
+  logTindex = 4.0 + 0.05 * index;
+
+  return CoolRate[tab][index] + CoolRateSlope[tab][index] * (logTemp - logTindex);
+}
+
+
+static inline double get_log_cooling_rate(double logTemp, double logZ)
+{
+  int i;
+  double rate1, rate2;
 
   if(logZ < metallicities[0])
     logZ = metallicities[0];
@@ -119,44 +173,38 @@ double get_metaldependent_cooling_rate(double logTemp, double logZ)
   if(logZ > metallicities[7])
     logZ = metallicities[7];
 
-  i = 0;
+  i = CoolZStart[static_cast < int >((logZ - metallicities[0]) * CoolZJumpFac)];
   while(logZ > metallicities[i + 1])
     {
       i++;
     }
   /* look up at i and i+1 */
 
-
   rate1 = get_rate(i, logTemp);
   rate2 = get_rate(i + 1, logTemp);
 
-  rate = rate1 + (rate2 - rate1) / (metallicities[i + 1] - metallicities[i]) * (logZ - metallicities[i]);
-
-  return pow(10, rate);
+  return rate1 + (rate2 - rate1) / (metallicities[i + 1] - metallicities[i]) * (logZ - metallicities[i]);
 }
 
 
-double get_rate(int tab, double logTemp)
+double get_metaldependent_cooling_rate(double logTemp, double logZ)
 {
-  int index;
-  double rate1, rate2, rate, logTindex;
-
-
-  if(logTemp < 4.0)
-    logTemp = 4.0;
-
-  index = (logTemp - 4.0) / 0.05;
-  if(index >= 90)
-    index = 89;
+  return pow(10, get_log_cooling_rate(logTemp, logZ));
+}
 
-  logTindex = 4.0 + 0.05 * index;
 
-  rate1 = CoolRate[tab][index];
-  rate2 = CoolRate[tab][index + 1];
+/**@brief Cooling rates of n gas phases at once: rate[k] is the same as
+ *        get_metaldependent_cooling_rate(logTemp[k], logZ[k]). The table
+ *        lookups are done for all of them before the exponentiation. */
+void get_metaldependent_cooling_rates(int n, const double *logTemp, const double *logZ, double *rate)
+{
+  int k;
 
-  rate = rate1 + (rate2 - rate1) / (0.05) * (logTemp - logTindex);
+  for(k = 0; k < n; k++)
+    rate[k] = get_log_cooling_rate(logTemp[k], logZ[k]);
 
-  return rate;
+  for(k = 0; k < n; k++)
+    rate[k] = pow(10, rate[k]);
 }
 
 void test(void)
@@ -77,6 +77,10 @@
  *        interpolates into the Reion_z[], Reion_Mc[] table, giving a value of Mc
  *        for a given redshift.
  *
+ *        <B>init_snapshot_factors()</B> - Called from SAM(), tabulates H(z), the
+ *        virial radius normalisation and the reionization mass for every
+ *        snapshot into SnapFactors[].
+ *
  *        SuperNovae and AGN feedback parameters are converted into internal units:
  *
  *        \f$ AgnEfficiency = \frac{UnitMass_{\rm{g}}}{1.58e^{-26}UnitTime_{\rm{s}}}\f$
@@ -177,6 +181,24 @@ void init(void)
 }
 
 
+#ifdef OPENMP
+/**@brief Gives a thread working on trees in SAM() the private objects
+ *        that init() and main() only set up for the main thread: its
+ *        memory arena and random number generator. The tables read
+ *        by init() are shared. */
+void init_thread(void)
+{
+  mymalloc_init_thread();
+
+  if(random_generator == NULL)
+    {
+      random_generator = gsl_rng_alloc(gsl_rng_ranlxd1);
+      gsl_rng_set(random_generator, 42);
+    }
+}
+#endif
+
+
 
 /*@brief Reads in 1/(z+1) from FileWithZList defined
  *       in ./input/input.par for the list of output snapshots.
@@ -571,3 +593,34 @@ void find_interpolate_reionization(double zcurr, int *tabindex, double *f1, doub
     }
 
 }
+
+
+/**@brief Fills SnapFactors[] with the quantities that only depend on the
+ *        redshift of each snapshot, so that hubble_of_z(), get_virial_radius()
+ *        and infall_recipe() do not redo the cosmology for every halo.
+ *        Covers every snapshot of the redshift list, not only those up to
+ *        LastSnapShotNr, since trees contain halos up to the last dark matter
+ *        snapshot. Must be called again whenever read_zlist() has been called,
+ *        after the cosmological parameters and the reionization tables are
+ *        set, outside of any parallel region. */
+void init_snapshot_factors(void)
+{
+  int snap;
+  double zplus1, rhocrit;
+
+  for(snap = 0; snap < Zlistlen; snap++)
+    {
+      zplus1 = 1 + ZZ[snap];
+
+      SnapFactors[snap].HubbleZ =
+        Hubble * sqrt(Omega * zplus1 * zplus1 * zplus1 + (1 - Omega - OmegaLambda) * zplus1 * zplus1 + OmegaLambda);
+
+      rhocrit = 3 * SnapFactors[snap].HubbleZ * SnapFactors[snap].HubbleZ / (8 * M_PI * G);
+      SnapFactors[snap].VirialRadiusFac = 1 / (200 * 4 * M_PI / 3.0 * rhocrit);
+
+      if(ReionizationModel == 2)
+        SnapFactors[snap].ReionMass = 0.;
+      else
+        SnapFactors[snap].ReionMass = reionization_mass(ZZ[snap]);
+    }
+}
@@ -21,6 +21,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#ifdef MMAP_TREES
+#include <sys/mman.h>
+#endif
+#ifdef PREFETCH_TREES
+#include <pthread.h>
+#endif
 
 #include "allvars.h"
 #include "proto.h"
@@ -42,6 +49,175 @@
  * UPDATETYPETWO ON).
  */
 
+#ifdef SCALED_TREE_CACHE
+/* Trees scaled to the new cosmology are kept in ScaledTreeCacheDir, one
+ * file per input trees_** file and cosmology. A cache file has exactly the
+ * layout of its input file, so every way of reading trees works on it
+ * unchanged, followed by a trailer with the key it was built for. */
+#define SCALED_TREE_CACHE_VERSION 1
+#define SCALED_TREE_CACHE_NAME_LEN 1100
+
+struct scaled_tree_cache_trailer
+{
+  char magic[8];                /* "LGSCALED" */
+  unsigned long long key;
+};
+
+/**@brief Key of the scaled trees of input file treesname: the name, size
+ *        and modification time of that file and everything that enters
+ *        scale_halos(), with the whole of both redshift lists. */
+static unsigned long long scaled_tree_cache_key(const char *treesname)
+{
+  struct stat st;
+  int dims[] = { SCALED_TREE_CACHE_VERSION, static_cast < int >(sizeof(struct halo_data)), LastSnapShotNr,
+    LastDarkMatterSnapShot, Zlistlen
+  };
+  double pars[] = { Omega, OmegaLambda, Hubble_h, ScalePos, ScaleMass,
+    Omega_OriginalCosm, OmegaLambda_OriginalCosm, Hubble_h_OriginalCosm
+  };
+  unsigned long long key = 14695981039346656037ULL;
+
+  key = hash_bytes(dims, sizeof(dims), key);
+  key = hash_bytes(pars, sizeof(pars), key);
+  key = hash_bytes(AA, sizeof(double) * Zlistlen, key);
+  key = hash_bytes(AA_OriginalCosm, sizeof(double) * Zlistlen, key);
+  key = hash_bytes(treesname, strlen(treesname), key);
+  if(stat(treesname, &st) == 0)
+    {
+      key = hash_bytes(&st.st_size, sizeof(st.st_size), key);
+      key = hash_bytes(&st.st_mtime, sizeof(st.st_mtime), key);
+    }
+
+  return key;
+}
+
+/**@brief Writes the name of the cache file of treesname for key into buf,
+ *        of SCALED_TREE_CACHE_NAME_LEN bytes. */
+static void get_scaled_tree_cache_name(char *buf, const char *treesname, unsigned long long key)
+{
+  const char *base = strrchr(treesname, '/');
+
+  if(snprintf(buf, SCALED_TREE_CACHE_NAME_LEN, "%s/%s.scaled_%016llx", ScaledTreeCacheDir,
+              base ? base + 1 : treesname, key) >= SCALED_TREE_CACHE_NAME_LEN)
+    terminate("name of the scaled tree cache file too long, use a shorter ScaledTreeCacheDir");
+}
+
+/**@brief Opens the cache file cachename if it is complete and was built
+ *        for key, positioned at its start; NULL otherwise. */
+static FILE *open_scaled_tree_cache_file(const char *cachename, unsigned long long key)
+{
+  FILE *fd;
+  struct stat st;
+  struct scaled_tree_cache_trailer trailer;
+  int header[2];
+
+  if(!(fd = fopen(cachename, "r")))
+    return NULL;
+
+  if(fstat(fileno(fd), &st) == 0 && fread(header, sizeof(int), 2, fd) == 2 && header[0] >= 0 && header[1] >= 0
+     && st.st_size == static_cast < off_t >(sizeof(int) * (2 + (size_t) header[0])
+                                            + sizeof(struct halo_data) * (size_t) header[1] + sizeof(trailer))
+     && fseek(fd, -static_cast < long >(sizeof(trailer)), SEEK_END) == 0
+     && fread(&trailer, sizeof(trailer), 1, fd) == 1
+     && memcmp(trailer.magic, "LGSCALED", 8) == 0 && trailer.key == key && fseek(fd, 0, SEEK_SET) == 0)
+    return fd;
+
+  fclose(fd);
+  return NULL;
+}
+
+/**@brief Reads every tree of treesname, scales it with scale_halos() and
+ *        writes it to cachename (through a temporary file, so that
+ *        readers only ever see complete caches); returns 0 on success. */
+static int build_scaled_tree_cache(const char *treesname, const char *cachename, unsigned long long key)
+{
+  FILE *fin, *fout;
+  char tmpname[SCALED_TREE_CACHE_NAME_LEN + 32];
+  int i, ntrees, totnhalos, maxnhalos = 0, failed = 0;
+  int *nhalos;
+  struct halo_data *halos;
+  struct scaled_tree_cache_trailer trailer;
+
+  if(!(fin = fopen(treesname, "r")))
+    {
+      char sbuf[2000];
+
+      sprintf(sbuf, "can't open file place `%s'\n", treesname);
+      terminate(sbuf);
+    }
+
+  if(snprintf(tmpname, sizeof(tmpname), "%s.%d.tmp", cachename, static_cast < int >(getpid())) >=
+     static_cast < int >(sizeof(tmpname)) || !(fout = fopen(tmpname, "w")))
+    {
+      fclose(fin);
+      return 1;
+    }
+
+  init_scale_cosmology();
+
+  myfread(&ntrees, 1, sizeof(int), fin);
+  myfread(&totnhalos, 1, sizeof(int), fin);
+  nhalos = static_cast < int *>(mymalloc("ScaledTreeNHalos", sizeof(int) * ntrees));
+  myfread(nhalos, ntrees, sizeof(int), fin);
+
+  for(i = 0; i < ntrees; i++)
+    if(nhalos[i] > maxnhalos)
+      maxnhalos = nhalos[i];
+  halos = static_cast < halo_data * >(mymalloc("ScaledTreeHalos", sizeof(struct halo_data) * maxnhalos));
+
+  failed |= fwrite(&ntrees, sizeof(int), 1, fout) != 1;
+  failed |= fwrite(&totnhalos, sizeof(int), 1, fout) != 1;
+  failed |= fwrite(nhalos, sizeof(int), ntrees, fout) != (size_t) ntrees;
+
+  for(i = 0; i < ntrees && !failed; i++)
+    {
+      myfread(halos, nhalos[i], sizeof(struct halo_data), fin);
+      scale_halos(halos, nhalos[i]);
+      failed |= fwrite(halos, sizeof(struct halo_data), nhalos[i], fout) != (size_t) nhalos[i];
+    }
+
+  memcpy(trailer.magic, "LGSCALED", 8);
+  trailer.key = key;
+  failed |= fwrite(&trailer, sizeof(trailer), 1, fout) != 1;
+
+  myfree(halos);
+  myfree(nhalos);
+  fclose(fin);
+  failed |= fclose(fout) != 0;
+
+  if(failed || rename(tmpname, cachename) != 0)
+    {
+      remove(tmpname);
+      return 1;
+    }
+
+  return 0;
+}
+
+/**@brief Opens the scaled trees of input file treesname, building them
+ *        first if they are not in the cache yet. Returns NULL if the cache
+ *        cannot be written, in which case the trees are scaled as read. */
+static FILE *open_scaled_tree_cache(const char *treesname)
+{
+  FILE *fd;
+  char cachename[SCALED_TREE_CACHE_NAME_LEN];
+  unsigned long long key = scaled_tree_cache_key(treesname);
+
+  get_scaled_tree_cache_name(cachename, treesname, key);
+
+  if((fd = open_scaled_tree_cache_file(cachename, key)))
+    return fd;
+
+  printf("building scaled tree cache %s\n", cachename);
+  if(build_scaled_tree_cache(treesname, cachename, key) == 0 && (fd = open_scaled_tree_cache_file(cachename, key)))
+    return fd;
+
+  printf("could not write scaled tree cache %s, scaling the trees as they are read\n", cachename);
+  return NULL;
+}
+#endif
+
+
 /**@brief Reads all the tree files if USE_MEMORY_TO_MINIMIZE_IO ON,
  *        otherwise reads in the headers for trees_** and trees_aux;
  *        Opens output files.
@@ -125,13 +301,18 @@ void load_tree_table(int filenr)
       sprintf(buf, "%s/treedata/trees_sf1_%03d.%d", SimulationDir, SnapShotInFileName, filenr);
 #endif
 
-      if(!(tree_file = fopen(buf, "r")))
-        {
-          char sbuf[2000];
+#ifdef SCALED_TREE_CACHE
+      tree_file = open_scaled_tree_cache(buf);
+      TreesScaledOnDisk = (tree_file != NULL);
+      if(!tree_file)
+#endif
+        if(!(tree_file = fopen(buf, "r")))
+          {
+            char sbuf[2000];
 
-          sprintf(sbuf, "can't open file place `%s'\n", buf);
-          terminate(sbuf);
-        }
+            sprintf(sbuf, "can't open file place `%s'\n", buf);
+            terminate(sbuf);
+          }
 
       //read header on trees_** file
       myfread(&Ntrees, 1, sizeof(int), tree_file);
@@ -155,6 +336,20 @@ void load_tree_table(int filenr)
       for(i = 1; i < Ntrees; i++)
         TreeFirstHalo[i] = TreeFirstHalo[i - 1] + TreeNHalos[i - 1];
 
+#ifdef MMAP_TREES
+      /* Halo_Data and HaloIDs_Data point straight into the input files */
+      TreeFileMap = map_input_file(tree_file, &TreeFileMapSize);
+      if(TreeFileMapSize < sizeof(int) * (2 + Ntrees) + sizeof(struct halo_data) * (size_t) totNHalos)
+        terminate("trees file shorter than its header says");
+      Halo_Data = reinterpret_cast < halo_data * >(TreeFileMap + sizeof(int) * (2 + Ntrees));
+#ifdef LOADIDS
+      TreeDbidsFileMap = map_input_file(treedbids_file, &TreeDbidsFileMapSize);
+      if(TreeDbidsFileMapSize < sizeof(struct halo_ids_data) * (size_t) totNHalos)
+        terminate("tree_dbids file shorter than the trees file says");
+      HaloIDs_Data = reinterpret_cast < halo_ids_data * >(TreeDbidsFileMap);
+#endif
+#endif
+
 #ifdef PRELOAD_TREES
       Halo_Data = mymalloc("Halo_Data", sizeof(struct halo_data) * totNHalos);
       myfseek(tree_file, sizeof(int) * (2 + Ntrees), SEEK_SET);
@@ -173,6 +368,10 @@ void load_tree_table(int filenr)
 #endif
 #endif
 
+#ifdef PREFETCH_TREES
+      init_tree_prefetch();
+#endif
+
       //if MCMC is turned only Task 0 reads the file and then broadcasts
 #ifdef PARALLEL
 #ifdef MCMC
@@ -182,6 +381,9 @@ void load_tree_table(int filenr)
 
   MPI_Bcast(&Ntrees, sizeof(int), MPI_BYTE, 0, MPI_COMM_WORLD);
   MPI_Bcast(&totNHalos, sizeof(int), MPI_BYTE, 0, MPI_COMM_WORLD);
+#ifdef SCALED_TREE_CACHE
+  MPI_Bcast(&TreesScaledOnDisk, sizeof(int), MPI_BYTE, 0, MPI_COMM_WORLD);
+#endif
 
   if(ThisTask > 0)
     TreeNHalos = mymalloc("TreeNHalos", sizeof(int) * Ntrees);
@@ -238,12 +440,51 @@ void load_tree_table(int filenr)
 
 
 
+#ifdef DYNAMIC_FILE_ASSIGNMENT
+/**@brief Reads only the header of trees_** for a given file and
+ *        returns its total number of halos, used as the cost of
+ *        processing that file when handing files out to tasks. */
+int get_tree_file_nhalos(int filenr)
+{
+  int ntrees, totnhalos, SnapShotInFileName;
+  char buf[1000];
+  FILE *fd;
+
+  SnapShotInFileName = LastDarkMatterSnapShot;
+
+#ifndef MRII
+  sprintf(buf, "%s/treedata/trees_%03d.%d", SimulationDir, SnapShotInFileName, filenr);
+#else
+  sprintf(buf, "%s/treedata/trees_sf1_%03d.%d", SimulationDir, SnapShotInFileName, filenr);
+#endif
+
+  if(!(fd = fopen(buf, "r")))
+    {
+      char sbuf[2000];
+
+      sprintf(sbuf, "can't open file place `%s'\n", buf);
+      terminate(sbuf);
+    }
+
+  myfread(&ntrees, 1, sizeof(int), fd);
+  myfread(&totnhalos, 1, sizeof(int), fd);
+  fclose(fd);
+
+  return totnhalos;
+}
+#endif
+
+
 /**@brief Deallocates the arrays used to read in the headers of
  *        trees_** and tree_aux (the ones with more than one
  *        element); if PRELOAD_TREES ON, deallocates
  *        the pointers containing all the input and output data.*/
 void free_tree_table(void)
 {
+#ifdef PREFETCH_TREES
+  free_tree_prefetch();
+#endif
+
 #ifdef PRELOAD_TREES
 #ifdef LOADIDS
   myfree(HaloIDs_Data);
@@ -261,6 +502,13 @@ void free_tree_table(void)
   myfree(TreeAuxData);
 #endif
 
+#ifdef MMAP_TREES
+#ifdef LOADIDS
+  munmap(TreeDbidsFileMap, TreeDbidsFileMapSize);
+#endif
+  munmap(TreeFileMap, TreeFileMapSize);
+#endif
+
 #ifdef LOADIDS
   fclose(treedbids_file);
 #endif
@@ -292,6 +540,10 @@ void free_tree_table(void)
  *  For all galaxies - FoF_MaxGals = 10000*15 and
  *  Gal = (sizeof(struct GALAXY) * FoF_MaxGals)
  *
+ *  Photometry lives in a separate pool addressed by GALAXY.LumIndex,
+ *  GalLum = (sizeof(struct GALAXY_LUM) * (MaxGals + FoF_MaxGals)),
+ *  grown on demand by new_galaxy_lum()
+ *
  *  If GALAXYTREE ON, HaloIDs structure is read from tree_dbids =
  *  sizeof(struct halo_ids_data) * TreeNHalos[] */
 
@@ -306,17 +558,36 @@ void load_tree(int nr)
 #ifdef LOADIDS
   HaloIDs = HaloIDs_Data + TreeFirstHalo[nr];
 #endif
+#else
+#ifdef MMAP_TREES
+  Halo = Halo_Data + TreeFirstHalo[nr];
+  advise_mapped_range(Halo, sizeof(struct halo_data) * TreeNHalos[nr], MADV_WILLNEED);
+#ifdef LOADIDS
+  HaloIDs = HaloIDs_Data + TreeFirstHalo[nr];
+  advise_mapped_range(HaloIDs, sizeof(struct halo_ids_data) * TreeNHalos[nr], MADV_WILLNEED);
+#endif
+#else
+#ifdef PREFETCH_TREES
+  load_tree_from_slot(nr);
 #else
 
   Halo = static_cast < halo_data * >(mymalloc("Halo", sizeof(struct halo_data) * TreeNHalos[nr]));
-  myfseek(tree_file, sizeof(int) * (2 + Ntrees) + sizeof(struct halo_data) * TreeFirstHalo[nr], SEEK_SET);
-  myfread(Halo, TreeNHalos[nr], sizeof(struct halo_data), tree_file);
 #ifdef LOADIDS
   HaloIDs = mymalloc("HaloIDs", sizeof(struct halo_ids_data) * TreeNHalos[nr]);
-  myfseek(treedbids_file, sizeof(struct halo_ids_data) * TreeFirstHalo[nr], SEEK_SET);
-  myfread(HaloIDs, TreeNHalos[nr], sizeof(struct halo_ids_data), treedbids_file);
 #endif
-
+#ifdef OPENMP
+#pragma omp critical (tree_file_io)
+#endif
+  {
+    myfseek(tree_file, sizeof(int) * (2 + Ntrees) + sizeof(struct halo_data) * TreeFirstHalo[nr], SEEK_SET);
+    myfread(Halo, TreeNHalos[nr], sizeof(struct halo_data), tree_file);
+#ifdef LOADIDS
+    myfseek(treedbids_file, sizeof(struct halo_ids_data) * TreeFirstHalo[nr], SEEK_SET);
+    myfread(HaloIDs, TreeNHalos[nr], sizeof(struct halo_ids_data), treedbids_file);
+#endif
+  }
+#endif //PREFETCH_TREES
+#endif //MMAP_TREES
 #endif
 
   //Allocate HaloAux and Galaxy structures.
@@ -330,6 +601,27 @@ void load_tree(int nr)
       HaloAux[i].NGalaxies = 0;
     }
 
+#ifdef GALAXYTREE
+  /* most massive subhalo of each FOF group, looked up by
+   * prepare_galaxy_for_output() for the MMSubID of every member galaxy */
+  for(i = 0; i < TreeNHalos[nr]; i++)
+    if(Halo[i].FirstHaloInFOFgroup == i)
+      {
+        int next, lenmax = 0;
+
+        HaloAux[i].MostMassiveSubhalo = i;
+        for(next = i; next != -1; next = Halo[next].NextHaloInFOFgroup)
+          if(Halo[next].Len > lenmax)
+            {
+              lenmax = Halo[next].Len;
+              HaloAux[i].MostMassiveSubhalo = next;
+            }
+      }
+#endif
+
+  FofSchedule = static_cast < int *>(mymalloc("FofSchedule", sizeof(int) * TreeNHalos[nr]));
+  build_fof_schedule(nr);
+
   if(AllocValue_MaxHaloGal == 0)
     AllocValue_MaxHaloGal = 1 + TreeNHalos[nr] / (0.25 * (LastDarkMatterSnapShot + 1));
 
@@ -348,37 +640,407 @@ void load_tree(int nr)
   MaxGal = AllocValue_MaxGal;
   Gal = static_cast < GALAXY * >(mymalloc_movable(&Gal, "Gal", sizeof(struct GALAXY) * MaxGal));
 
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+  MaxGalLum = MaxHaloGal + MaxGal;
+  GalLum =
+    static_cast < GALAXY_LUM * >(mymalloc_movable(&GalLum, "GalLum", sizeof(struct GALAXY_LUM) * MaxGalLum));
+  GalLumFree = static_cast < int *>(mymalloc_movable(&GalLumFree, "GalLumFree", sizeof(int) * MaxGalLum));
+
+  /* hand out low indices first */
+  for(i = 0, NGalLumFree = MaxGalLum; i < MaxGalLum; i++)
+    GalLumFree[i] = MaxGalLum - 1 - i;
+#endif
+#endif
+
+#ifdef OPENMP
+  MaxGalOutputBuf = MaxHaloGal;
+  NGalOutputBuf = 0;
+  GalOutputBuf =
+    static_cast < GALAXY_OUTPUT * >(mymalloc_movable(&GalOutputBuf, "GalOutputBuf",
+                                                     sizeof(struct GALAXY_OUTPUT) * MaxGalOutputBuf));
+  GalOutputBufSnap =
+    static_cast < int *>(mymalloc_movable(&GalOutputBufSnap, "GalOutputBufSnap", sizeof(int) * MaxGalOutputBuf));
+#endif
+
 #ifdef GALAXYTREE
   if(AllocValue_MaxGalTree == 0)
     AllocValue_MaxGalTree = 1.5 * TreeNHalos[nr];
 
   MaxGalTree = AllocValue_MaxGalTree;
   GalTree = mymalloc_movable(&GalTree, "GalTree", sizeof(struct galaxy_tree_data) * MaxGalTree);
+
+  MaxGalTreeOutput = MIN_ALLOC_NUMBER;
+  NGalTreeOutput = 0;
+  GalTreeOutputOnDisk = 0;
+  GalTreeOutput =
+    static_cast < GALAXY_OUTPUT * >(mymalloc_movable(&GalTreeOutput, "GalTreeOutput",
+                                                     sizeof(struct GALAXY_OUTPUT) * MaxGalTreeOutput));
 #endif
 }
 
 
 
+/**@brief Builds the order in which the FOF groups of the current tree
+ *        are constructed by SAM().
+ *
+ *  The FOF groups are stored by their first halo, grouped by snapshot
+ *  (FofScheduleSnapStart[snap] to FofScheduleSnapStart[snap+1]) and,
+ *  within a snapshot, in the order of the lowest halo index in the
+ *  group. This is the order in which the recursive walk over all
+ *  snapshots used to visit them, since every progenitor of a halo sits
+ *  at an earlier snapshot (checked here). HaloFlag of a scheduled FOF
+ *  head is set to 1; construct_galaxies() sets it to 2 once done. */
+void build_fof_schedule(int nr)
+{
+  int i, snap, fofhalo, prog;
+
+  for(snap = 0; snap <= MAXSNAPS; snap++)
+    FofScheduleSnapStart[snap] = 0;
+
+  /* count the FOF groups in each snapshot */
+  for(i = 0; i < TreeNHalos[nr]; i++)
+    {
+      for(prog = Halo[i].FirstProgenitor; prog >= 0; prog = Halo[prog].NextProgenitor)
+        if(Halo[prog].SnapNum >= Halo[i].SnapNum)
+          terminate("progenitor is not at an earlier snapshot than its descendant");
+
+      fofhalo = Halo[i].FirstHaloInFOFgroup;
+      if(Halo[i].SnapNum <= LastSnapShotNr && HaloAux[fofhalo].HaloFlag == 0)
+        {
+          HaloAux[fofhalo].HaloFlag = -1;
+          FofScheduleSnapStart[Halo[i].SnapNum + 1]++;
+        }
+    }
+
+  for(snap = 0; snap < MAXSNAPS; snap++)
+    FofScheduleSnapStart[snap + 1] += FofScheduleSnapStart[snap];
+
+  NFofSchedule = FofScheduleSnapStart[MAXSNAPS];
+
+  /* place them, keeping halo index order within each snapshot */
+  int fill[MAXSNAPS];
+
+  for(snap = 0; snap < MAXSNAPS; snap++)
+    fill[snap] = FofScheduleSnapStart[snap];
+
+  for(i = 0; i < TreeNHalos[nr]; i++)
+    {
+      fofhalo = Halo[i].FirstHaloInFOFgroup;
+      if(HaloAux[fofhalo].HaloFlag == -1)
+        {
+          HaloAux[fofhalo].HaloFlag = 1;
+          FofSchedule[fill[Halo[i].SnapNum]++] = fofhalo;
+        }
+    }
+}
+
+
 /**@brief Frees all the Halo and Galaxy structures in the code. */
 void free_galaxies_and_tree(void)
 {
 #ifdef GALAXYTREE
+  myfree(GalTreeOutput);
   myfree(GalTree);
+#endif
+#ifdef OPENMP
+  myfree(GalOutputBufSnap);
+  myfree(GalOutputBuf);
+#endif
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+  myfree(GalLumFree);
+  myfree(GalLum);
+#endif
 #endif
   myfree(Gal);
   myfree(HaloGalHeap);
   myfree(HaloGal);
+  myfree(FofSchedule);
   myfree(HaloAux);
 
 #ifndef PRELOAD_TREES
+#ifndef MMAP_TREES
+#ifndef PREFETCH_TREES
 #ifdef LOADIDS
   myfree(HaloIDs);
 #endif
   myfree(Halo);
 #endif
+#endif
+#endif
 }
 
 
+#ifdef MMAP_TREES
+/**@brief Maps a whole input file into memory. The mapping is private,
+ *        so pages touched by scale_cosmology() are copied on write,
+ *        while the others are shared through the page cache with
+ *        every other process reading the same file. */
+char *map_input_file(FILE * fd, size_t * size)
+{
+  struct stat filestatus;
+  void *map;
+
+  if(fstat(fileno(fd), &filestatus) != 0)
+    {
+      printf("I/O error (fstat) has occured: %s\n", strerror(errno));
+      fflush(stdout);
+      terminate("fstat error");
+    }
+
+  *size = filestatus.st_size;
+  map = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fd), 0);
+  if(map == MAP_FAILED)
+    {
+      printf("I/O error (mmap) has occured: %s\n", strerror(errno));
+      fflush(stdout);
+      terminate("mmap error");
+    }
+
+  /* trees are read in file order */
+  madvise(map, *size, MADV_SEQUENTIAL);
+
+  return static_cast < char *>(map);
+}
+
+/**@brief Passes an madvise() hint for part of a mapped file, widened
+ *        to whole pages. */
+void advise_mapped_range(void *start, size_t length, int advice)
+{
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+  size_t first = reinterpret_cast < size_t > (start) / pagesize * pagesize;
+  size_t last = reinterpret_cast < size_t > (start) + length;
+
+  if(length > 0)
+    madvise(reinterpret_cast < void *>(first), last - first, advice);
+}
+#endif
+
+
+#ifdef PREFETCH_TREES
+/* Double-buffered tree input. The trees of a file are read into two
+ * slots, each large enough for the largest tree of the file: while
+ * the tree in one slot is evolved, a background thread reads the next
+ * tree into the other. After the last tree of a file the thread reads
+ * the header and first tree of the next file (NextTreeFileNr), so that
+ * load_tree_table() finds them in the page cache. The background thread
+ * only uses pread() and malloc(), never the mymalloc() arena. */
+static struct tree_prefetch_data
+{
+  pthread_t thread;
+  int active;                   /* a thread has been started and not joined */
+  int tree;                     /* tree read into slot, or -1 */
+  int slot;
+  int filenr;                   /* file whose header is read, or -1 */
+  int failed;
+} Prefetch = { pthread_t(), 0, -1, 0, -1, 0 };
+
+static char *TreeSlot[2];
+static size_t TreeSlotIDsOffset;
+static int CurrentTreeSlot;
+
+/**@brief pread()s exactly nbytes at offset; returns 0 on success. */
+static int read_at(int fd, void *buf, size_t nbytes, off_t offset)
+{
+  ssize_t nread;
+
+  while(nbytes > 0)
+    {
+      if((nread = pread(fd, buf, nbytes, offset)) <= 0)
+        return 1;
+      buf = static_cast < char *>(buf) + nread;
+      nbytes -= nread;
+      offset += nread;
+    }
+
+  return 0;
+}
+
+/**@brief Reads tree nr of the current file into a slot (also with
+ *        HaloIDs if LOADIDS); returns 0 on success. */
+static int read_tree_into_slot(int nr, int slot)
+{
+  if(read_at(fileno(tree_file), TreeSlot[slot], sizeof(struct halo_data) * TreeNHalos[nr],
+             sizeof(int) * (2 + Ntrees) + sizeof(struct halo_data) * (off_t) TreeFirstHalo[nr]))
+    return 1;
+#ifdef LOADIDS
+  if(read_at(fileno(treedbids_file), TreeSlot[slot] + TreeSlotIDsOffset,
+             sizeof(struct halo_ids_data) * TreeNHalos[nr],
+             sizeof(struct halo_ids_data) * (off_t) TreeFirstHalo[nr]))
+    return 1;
+#endif
+  return 0;
+}
+
+/**@brief Reads the header and first tree of trees_** (and tree_dbids)
+ *        of file Prefetch.filenr into temporary buffers. */
+static int read_tree_file_start(int filenr)
+{
+  int fd, header[2], firstnhalos, failed;
+  char buf[1000];
+  void *tmp;
+
+#ifndef MRII
+  sprintf(buf, "%s/treedata/trees_%03d.%d", SimulationDir, LastDarkMatterSnapShot, filenr);
+#else
+  sprintf(buf, "%s/treedata/trees_sf1_%03d.%d", SimulationDir, LastDarkMatterSnapShot, filenr);
+#endif
+#ifdef SCALED_TREE_CACHE
+  char cachename[SCALED_TREE_CACHE_NAME_LEN];
+
+  get_scaled_tree_cache_name(cachename, buf, scaled_tree_cache_key(buf));
+  if((fd = open(cachename, O_RDONLY)) < 0)
+#endif
+    if((fd = open(buf, O_RDONLY)) < 0)
+      return 1;
+
+  failed = read_at(fd, header, sizeof(header), 0);
+  if(!failed && header[0] > 0)
+    failed = read_at(fd, &firstnhalos, sizeof(int), sizeof(header));
+  else
+    firstnhalos = 0;
+
+  if(!failed && firstnhalos > 0 && (tmp = malloc(sizeof(struct halo_data) * firstnhalos)))
+    {
+      failed = read_at(fd, tmp, sizeof(struct halo_data) * firstnhalos, sizeof(int) * (2 + header[0]));
+      free(tmp);
+    }
+  close(fd);
+
+#ifdef LOADIDS
+#ifndef MRII
+  sprintf(buf, "%s/treedata/tree_dbids_%03d.%d", SimulationDir, LastDarkMatterSnapShot, filenr);
+#else
+  sprintf(buf, "%s/treedata/tree_sf1_dbids_%03d.%d", SimulationDir, LastDarkMatterSnapShot, filenr);
+#endif
+  if(!failed && firstnhalos > 0 && (fd = open(buf, O_RDONLY)) >= 0)
+    {
+      if((tmp = malloc(sizeof(struct halo_ids_data) * firstnhalos)))
+        {
+          failed = read_at(fd, tmp, sizeof(struct halo_ids_data) * firstnhalos, 0);
+          free(tmp);
+        }
+      close(fd);
+    }
+#endif
+
+  return failed;
+}
+
+static void *prefetch_thread(void *arg)
+{
+  if(Prefetch.filenr >= 0)
+    Prefetch.failed = read_tree_file_start(Prefetch.filenr);
+  else
+    Prefetch.failed = read_tree_into_slot(Prefetch.tree, Prefetch.slot);
+
+  return NULL;
+}
+
+static void start_prefetch(int tree, int slot, int filenr)
+{
+  Prefetch.tree = tree;
+  Prefetch.slot = slot;
+  Prefetch.filenr = filenr;
+  Prefetch.failed = 0;
+
+  if(pthread_create(&Prefetch.thread, NULL, prefetch_thread, NULL) != 0)
+    {
+      /* no thread, the tree is then read when it is needed */
+      Prefetch.tree = -1;
+      return;
+    }
+  Prefetch.active = 1;
+}
+
+/**@brief Waits for the background read, if any. A failed tree read is
+ *        forgotten, so that load_tree() repeats it and reports the error;
+ *        a failed read of the next file only means a colder cache. */
+static void finish_prefetch(void)
+{
+  if(!Prefetch.active)
+    return;
+
+  pthread_join(Prefetch.thread, NULL);
+  Prefetch.active = 0;
+
+  if(Prefetch.failed)
+    Prefetch.tree = -1;
+}
+
+/**@brief Allocates the two tree slots of the current file and starts
+ *        reading its first tree. */
+void init_tree_prefetch(void)
+{
+  int i, maxnhalos = 0;
+
+  for(i = 0; i < Ntrees; i++)
+    if(TreeNHalos[i] > maxnhalos)
+      maxnhalos = TreeNHalos[i];
+
+  TreeSlotIDsOffset = sizeof(struct halo_data) * (size_t) maxnhalos;
+#ifdef LOADIDS
+  TreeSlot[0] = static_cast < char *>(mymalloc("TreeSlot[0]", TreeSlotIDsOffset + sizeof(struct halo_ids_data) * (size_t) maxnhalos));
+  TreeSlot[1] = static_cast < char *>(mymalloc("TreeSlot[1]", TreeSlotIDsOffset + sizeof(struct halo_ids_data) * (size_t) maxnhalos));
+#else
+  TreeSlot[0] = static_cast < char *>(mymalloc("TreeSlot[0]", TreeSlotIDsOffset));
+  TreeSlot[1] = static_cast < char *>(mymalloc("TreeSlot[1]", TreeSlotIDsOffset));
+#endif
+
+  CurrentTreeSlot = 1;
+  Prefetch.tree = -1;
+
+  if(Ntrees > 0)
+    start_prefetch(0, 0, -1);
+}
+
+void free_tree_prefetch(void)
+{
+  finish_prefetch();
+  Prefetch.tree = -1;
+
+  myfree(TreeSlot[1]);
+  myfree(TreeSlot[0]);
+}
+
+/**@brief Points Halo (and HaloIDs) to tree nr, reading it now unless it
+ *        was prefetched, and starts reading what comes next. */
+void load_tree_from_slot(int nr)
+{
+  int slot;
+
+  finish_prefetch();
+
+  if(Prefetch.tree == nr && Prefetch.filenr < 0)
+    slot = Prefetch.slot;
+  else
+    {
+      slot = 1 - CurrentTreeSlot;
+      if(read_tree_into_slot(nr, slot))
+        {
+          printf("I/O error (pread) has occured reading tree %d: %s\n", nr, strerror(errno));
+          fflush(stdout);
+          terminate("read error");
+        }
+    }
+
+  Prefetch.tree = -1;
+  CurrentTreeSlot = slot;
+
+  Halo = reinterpret_cast < halo_data * >(TreeSlot[slot]);
+#ifdef LOADIDS
+  HaloIDs = reinterpret_cast < halo_ids_data * >(TreeSlot[slot] + TreeSlotIDsOffset);
+#endif
+
+  if(nr + 1 < Ntrees)
+    start_prefetch(nr + 1, 1 - slot, -1);
+  else if(NextTreeFileNr >= 0)
+    start_prefetch(-1, 0, NextTreeFileNr);
+}
+#endif
+
+
 /**@brief Reading routine, either from a file into a structure or
  *        from a pointer to a structure.
  *   */
@@ -174,12 +174,27 @@ int main(int argc, char **argv)
 
   int file;
 
+#ifdef DYNAMIC_FILE_ASSIGNMENT
+  /* files are taken, most expensive first, by whichever task is free */
+  init_file_counter();
+  for(file = get_next_file_to_process(); file < nfiles; file = get_next_file_to_process())
+    {
+      filenr = FileToProcess[file];
+#else
   for(file = 0; file < nfiles; file++)
     {
       if(ThisTask == TaskToProcess[file])
         filenr = FileToProcess[file];
       else
         continue;
+#ifdef PREFETCH_TREES
+      /* the start of this task's next file is read while the last tree of this one is done */
+      int next;
+
+      for(next = file + 1; next < nfiles && TaskToProcess[next] != ThisTask; next++);
+      NextTreeFileNr = (next < nfiles) ? FileToProcess[next] : -1;
+#endif
+#endif
 #else //MCMC
   /* In MCMC mode only one file is loaded into memory
    * and the sampling for all the steps is done on it */
@@ -230,6 +245,9 @@ int main(int argc, char **argv)
     }
 
 #ifndef MCMC
+#ifdef DYNAMIC_FILE_ASSIGNMENT
+  free_file_counter();
+#endif
   myfree(TaskToProcess);
   myfree(FileToProcess);
 #endif
@@ -241,14 +259,14 @@ int main(int argc, char **argv)
 
 }
 
-/**@brief SAM() loops on trees and calls construct_galaxies.*/
+/**@brief SAM() loops on trees and calls construct_galaxies for each FOF group.*/
 #ifdef MCMC
 double SAM(int filenr)
 #else
 void SAM(int filenr)
 #endif
 {
-  int treenr, halonr;
+  int treenr;
 
 #ifdef MCMC
   int ii;
@@ -277,6 +295,8 @@ void SAM(int filenr)
 
   //to be used when we have tables for the scaling in any cosmology
   //read_scaling_parameters();
+  init_scale_cosmology();
+  init_snapshot_factors();
 
 #ifndef MCMC
 #ifdef GALAXYTREE
@@ -293,6 +313,15 @@ void SAM(int filenr)
 //***************************************************************************************
 //***************************************************************************************
 
+#ifdef OPENMP
+  /* each thread works on whole trees with its own copy of the tree and galaxy
+   * structures (see the threadprivate list in allvars.h); galaxies are written
+   * out in tree order, so the files are identical to a run with one thread */
+#pragma omp parallel
+  {
+    init_thread();
+#pragma omp for schedule(dynamic) ordered
+#endif
   //for(treenr = 0; treenr < NTrees_Switch_MR_MRII; treenr++)
   for(treenr = 0; treenr < Ntrees; treenr++)
     {
@@ -308,20 +337,32 @@ void SAM(int filenr)
       if(CurrentMCMCStep == 1)
 #endif
 #endif
-        scale_cosmology(TreeNHalos[treenr]);
+#ifdef SCALED_TREE_CACHE
+        if(!TreesScaledOnDisk)
+#endif
+          scale_cosmology(TreeNHalos[treenr]);
+
+      set_halo_virial_properties(TreeNHalos[treenr]);
 
       gsl_rng_set(random_generator, filenr * 100000 + treenr);
+#ifdef OPENMP
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+      /* dust inclinations must not depend on which thread did the previous trees */
+      seed_dust_inclinations(-(filenr * 100000 + treenr + 1));
+#endif
+#endif
       NumMergers = 0;
       NHaloGal = 0;
 #ifdef GALAXYTREE
       NGalTree = 0;
       IndexStored = 0;
 #endif
-      int snapnum;
+      int snapnum, fof;
 
       //LastSnapShotNr is the highest output snapshot
       /* we process the snapshots now in temporal order 
-       * (as a means to reduce peak memory usage) */
+       * (as a means to reduce peak memory usage), running the FOF
+       * groups of each snapshot in the order set up by load_tree() */
       for(snapnum = 0; snapnum <= LastSnapShotNr; snapnum++)
         {
 #ifdef MCMC
@@ -334,9 +375,8 @@ void SAM(int filenr)
           assign_FOF_masses(snapnum, treenr);
 #endif
 #endif
-          for(halonr = 0; halonr < TreeNHalos[treenr]; halonr++)
-            if(HaloAux[halonr].DoneFlag == 0 && Halo[halonr].SnapNum == snapnum)
-              construct_galaxies(filenr, treenr, halonr);
+          for(fof = FofScheduleSnapStart[snapnum]; fof < FofScheduleSnapStart[snapnum + 1]; fof++)
+            construct_galaxies(filenr, treenr, FofSchedule[fof]);
         }
 
       /* output remaining galaxies as needed */
@@ -355,9 +395,20 @@ void SAM(int filenr)
       fprintf(fdg, "%d\n", NGalTree);
 #endif
 #else //ifdef MCMC
+#endif
+#ifdef OPENMP
+#pragma omp ordered
+      write_galaxy_output_buffer(treenr);
 #endif
       free_galaxies_and_tree();
     }                           //loop on trees
+#ifdef OPENMP
+  }                             //end of parallel region
+#endif
+
+#ifdef ADAPTIVE_SUBSTEPS
+  report_adaptive_substeps(filenr);
+#endif
 
 #ifdef MCMC
   double lhood = get_likelihood();
@@ -385,81 +436,37 @@ void SAM(int filenr)
 }
 
 
-/**@brief  construct_galaxies() recursively runs the semi-analytic model.
-  *        For each halo it checks if its main progenitor has been done, then
-  *        if all the halos in the FOF of its main progenitor have been
-  *        done and then runs the SAM in the current halo. This means that
-  *        for the first time its called it will walk up the tree into the
-  *        haloes in the earliest snapshot.
+/**@brief  construct_galaxies() runs the semi-analytic model on one FOF
+  *        group, given by its first halo. SAM() calls it following the
+  *        FofSchedule built in load_tree(), in which the progenitors of
+  *        all the halos in the group have already been done.
   *
-  *        When it finds a halo that needs to be done it calls
-  *        join_galaxies_of_progenitors and evolve_galaxies. */
-void construct_galaxies(int filenr, int treenr, int halonr)
+  *        It calls join_galaxies_of_progenitors for every halo in the
+  *        group and then evolve_galaxies. */
+void construct_galaxies(int filenr, int treenr, int fofhalo)
 {
-  static int halosdone = 0;
-  int prog, fofhalo, ngal, cenngal, p;
+  int ngal, cenngal, p, halonr;
 
-  HaloAux[halonr].DoneFlag = 1;
-  halosdone++;
+  if(HaloAux[fofhalo].HaloFlag != 1)
+    terminate("FOF group not scheduled or already done");
 
-  prog = Halo[halonr].FirstProgenitor;
+  HaloAux[fofhalo].HaloFlag = 2;
+  for(halonr = fofhalo; halonr >= 0; halonr = Halo[halonr].NextHaloInFOFgroup)
+    HaloAux[halonr].DoneFlag = 1;
 
-  while(prog >= 0)              //If halo has a progenitor
-    {
-      if(HaloAux[prog].DoneFlag == 0)   //If progenitor hasn't been done yet
-        construct_galaxies(filenr, treenr, prog);
-      prog = Halo[prog].NextProgenitor; //Jump to next halo in progenitors FOF
-    }
+  ngal = 0;
+  cenngal = set_merger_center(fofhalo); //Find type 0 for type 1 to merge into
 
-  //Now check for the progenitors of all the halos in the current FOF group
-  fofhalo = Halo[halonr].FirstHaloInFOFgroup;   //Starting at the first halo in current FOF
-  if(HaloAux[fofhalo].HaloFlag == 0)    //If it hasn't been done
-    {
-      HaloAux[fofhalo].HaloFlag = 1;    //mark as to do
-      while(fofhalo >= 0)       //go through all the halos in current FOF
-        {
-          prog = Halo[fofhalo].FirstProgenitor;
-          while(prog >= 0)      //build its progenitors
-            {
-              if(HaloAux[prog].DoneFlag == 0)
-                construct_galaxies(filenr, treenr, prog);
-              prog = Halo[prog].NextProgenitor;
-            }
-
-          fofhalo = Halo[fofhalo].NextHaloInFOFgroup;   //Jump to next halo in FOF
-        }
-    }
-
-  /* At this point, the galaxies for all progenitors of this halo have been
-   * properly constructed. Also, the galaxies of the progenitors of all other 
-   * halos in the same FOF-group have been constructed as well. We can hence go
-   * ahead and construct all galaxies for the subhalos in this FOF halo, and
-   * evolve them in time. */
-
-
-  fofhalo = Halo[halonr].FirstHaloInFOFgroup;
-  if(HaloAux[fofhalo].HaloFlag == 1)    //If it is marked as an halo to do
-    {
-      ngal = 0;
-      HaloAux[fofhalo].HaloFlag = 2;
-
-      cenngal = set_merger_center(fofhalo);     //Find type 0 for type 1 to merge into
-
-      /*For all the halos in the current FOF join all the progenitor galaxies together
-       * ngals will be the total number of galaxies in the current FOF*/
-      while(fofhalo >= 0)
-        {
-          ngal = join_galaxies_of_progenitors(fofhalo, ngal, &cenngal);
-          fofhalo = Halo[fofhalo].NextHaloInFOFgroup;
-        }
+  /*For all the halos in the current FOF join all the progenitor galaxies together
+   * ngals will be the total number of galaxies in the current FOF*/
+  for(halonr = fofhalo; halonr >= 0; halonr = Halo[halonr].NextHaloInFOFgroup)
+    ngal = join_galaxies_of_progenitors(halonr, ngal, &cenngal);
 
+  /*Evolve the Galaxies -> SAM! */
+  evolve_galaxies(fofhalo, ngal, treenr, cenngal);
 
-      /*Evolve the Galaxies -> SAM! */
-      evolve_galaxies(Halo[halonr].FirstHaloInFOFgroup, ngal, treenr, cenngal);
-
-      for(p = 0; p < ngal; p++)
-        mass_checks("Construct_galaxies #1", p);
-    }
+  for(p = 0; p < ngal; p++)
+    mass_checks("Construct_galaxies #1", p);
 }
 
 
@@ -555,6 +562,14 @@ int join_galaxies_of_progenitors(int halonr, int ngalstart, int *cenngal)
           /* Copy galaxy properties from progenitor,
            * except for those that need initialising */
           Gal[ngal] = HaloGal[currentgal];
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+          /* the photometry record moves with the galaxy, the progenitor
+           * keeps only what it will still be written out with */
+          HaloGal[currentgal].LumIndex =
+            copy_galaxy_lum_for_output(Gal[ngal].LumIndex, HaloGal[currentgal].SnapNum);
+#endif
+#endif
 
           Gal[ngal].HaloNr = halonr;
           Gal[ngal].CoolingRadius = 0.0;
@@ -685,84 +700,186 @@ int join_galaxies_of_progenitors(int halonr, int ngalstart, int *cenngal)
 
 
 
-/**@brief evolve_galaxies() deals with most of the SA recipes. This is
-  *       where most of the physical recipes are called, including:
-  *       infall_recipe() (gets the fraction of primordial gas that infalled),
-  *       add_infall_to_hot() (adds the infalled gas to the hot phase),
-  *       reincorporate_gas() (reincorporates gas ejected by SN),
-  *       cooling_recipe() (gets the amount of gas that cooled - takes into
-  *       account AGN feedback), cool_gas_onto_galaxy() (adds the gas that
-  *       cooled into the cold phase, starformation_and_feedback() (normal
-  *       SF and SN feedback), deal_with_galaxy_merger() (adds components,
-  *       grows black hole and deals with SF burst), disruption() (total and
-  *       instantaneous disruption of type 2 satellites) and dust() (if galaxy
-  *       is in an output time, dust extinction is computed).
-  *
-  *       All these calculations are done in time steps of 1/STEPS the time
-  *       between each snapshot (STEPS=20).
-  */
+#ifdef ADAPTIVE_SUBSTEPS
+/* galaxy-substeps evolved so far, and how many of them were quiescent */
+static double NSubsteps, NSubstepsSkipped;
 
-/* Note: halonr is here the FOF-background subhalo (i.e. main halo) */
-void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
+#ifdef ADAPTIVE_SUBSTEPS_CHECK
+#define NADAPTIVECHECK 4
+
+static const char *AdaptiveCheckName[NADAPTIVECHECK] = { "stellar mass", "cold gas", "hot gas", "black hole mass" };
+
+/* differences of the adaptive with respect to the fixed-step evolution,
+ * summed over all galaxies, and the largest relative one of any galaxy */
+static double AdaptiveCheckTotal[NADAPTIVECHECK], AdaptiveCheckDiff[NADAPTIVECHECK], AdaptiveCheckMaxRel[NADAPTIVECHECK];
+
+/* state of a FOF group kept while it is evolved twice */
+struct adaptive_check
 {
-  int p, q, nstep, centralgal, merger_centralgal, currenthalo, prevgal, start, i;
-  double infallingGas, deltaT, Zcurr;
-  double time, previoustime, newtime;
-  double AGNaccreted, t_Edd;
+  struct GALAXY *start, *fixed;
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+  struct GALAXY_LUM *lum;
+#endif
+#endif
+  int nummergers;
+};
 
-#ifdef STAR_FORMATION_HISTORY
-  double age_in_years;
+static void adaptive_check_masses(struct GALAXY *g, double m[NADAPTIVECHECK])
+{
+  m[0] = g->DiskMass + g->BulgeMass;
+  m[1] = g->ColdGas;
+  m[2] = g->HotGas;
+  m[3] = g->BlackHoleMass;
+}
+
+/**@brief Saves the galaxies of the group, with their photometry, before
+  *       they are evolved on fixed steps for the comparison. */
+static void check_adaptive_substeps_start(struct adaptive_check *c, int ngal)
+{
+  c->start = static_cast < GALAXY * >(mymalloc("AdaptiveCheckGal", sizeof(struct GALAXY) * 2 * ngal));
+  c->fixed = c->start + ngal;
+  memcpy(c->start, Gal, sizeof(struct GALAXY) * ngal);
+
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+  int p;
+
+  c->lum = static_cast < GALAXY_LUM * >(mymalloc("AdaptiveCheckLum", sizeof(struct GALAXY_LUM) * ngal));
+  for(p = 0; p < ngal; p++)
+    if(Gal[p].LumIndex >= 0)
+      c->lum[p] = GalLum[Gal[p].LumIndex];
+#endif
 #endif
 
-  // Eddington time in code units
-  // code units are UnitTime_in_s/Hubble_h
-  t_Edd = 1.42e16 * Hubble_h / UnitTime_in_s;
+  c->nummergers = NumMergers;
+}
 
-  //previoustime = NumToTime(Gal[0].SnapNum);
-  previoustime = NumToTime(Halo[halonr].SnapNum - 1);
-  newtime = NumToTime(Halo[halonr].SnapNum);
+/**@brief Keeps the result of the fixed-step evolution and puts the
+  *       galaxies back into the state they started from. */
+static void check_adaptive_substeps_swap(struct adaptive_check *c, int ngal)
+{
+  memcpy(c->fixed, Gal, sizeof(struct GALAXY) * ngal);
+  memcpy(Gal, c->start, sizeof(struct GALAXY) * ngal);
 
-  /* Time between snapshots */
-  deltaT = previoustime - newtime;
-  /* Redshift of current Snapnum */
-  Zcurr = ZZ[Halo[halonr].SnapNum];
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+  int p;
 
-  centralgal = Gal[0].CentralGal;
+  for(p = 0; p < ngal; p++)
+    if(Gal[p].LumIndex >= 0)
+      GalLum[Gal[p].LumIndex] = c->lum[p];
+#endif
+#endif
+
+  NumMergers = c->nummergers;
+}
+
+/**@brief Adds the differences between the adaptive and the fixed-step
+  *       evolution of the group to the totals reported at the end. */
+static void check_adaptive_substeps_finish(struct adaptive_check *c, int ngal)
+{
+  double total[NADAPTIVECHECK] = { 0 }, diff[NADAPTIVECHECK] = { 0 }, maxrel[NADAPTIVECHECK] = { 0 };
+  double madaptive[NADAPTIVECHECK], mfixed[NADAPTIVECHECK];
+  int p, k;
 
   for(p = 0; p < ngal; p++)
-    mass_checks("Evolve_galaxies #0", p);
+    {
+      adaptive_check_masses(&Gal[p], madaptive);
+      adaptive_check_masses(&c->fixed[p], mfixed);
 
-  //print_galaxy("\n\ncheck1", centralgal, halonr);
+      for(k = 0; k < NADAPTIVECHECK; k++)
+        {
+          total[k] += mfixed[k];
+          diff[k] += fabs(madaptive[k] - mfixed[k]);
+          if(mfixed[k] > 0 && fabs(madaptive[k] - mfixed[k]) / mfixed[k] > maxrel[k])
+            maxrel[k] = fabs(madaptive[k] - mfixed[k]) / mfixed[k];
+        }
+    }
 
-  if(Gal[centralgal].Type != 0 || Gal[centralgal].HaloNr != halonr)
-    terminate("Something wrong here ..... \n");
+#ifdef OPENMP
+#pragma omp critical (adaptive_check)
+#endif
+  for(k = 0; k < NADAPTIVECHECK; k++)
+    {
+      AdaptiveCheckTotal[k] += total[k];
+      AdaptiveCheckDiff[k] += diff[k];
+      if(maxrel[k] > AdaptiveCheckMaxRel[k])
+        AdaptiveCheckMaxRel[k] = maxrel[k];
+    }
+
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+  myfree(c->lum);
+#endif
+#endif
+  myfree(c->start);
+}
+#endif //ADAPTIVE_SUBSTEPS_CHECK
+
+/**@brief Forms the stars of galaxy p over the skipped[p] it has been
+  *       quiescent for, in one step ending at time to present endtime and
+  *       filed under substep nstep, and clears skipped[p]. */
+static void catch_up_quiescent(int p, int centralgal, double endtime, double deltaT, int nstep, double *skipped)
+{
+  starformation_interval(p, centralgal, endtime + skipped[p] / 2., skipped[p], deltaT, nstep);
+  mass_checks("Evolve_galaxies #3", p);
+  skipped[p] = 0.;
+}
+
+/**@brief Prints how many galaxy-substeps were merged into coarse steps and,
+  *       with ADAPTIVE_SUBSTEPS_CHECK, how far the adaptive evolution is
+  *       from the fixed-step one. The numbers add up over all files. */
+void report_adaptive_substeps(int filenr)
+{
+  printf("Task %d file %d: %g of %g galaxy substeps taken in coarse steps as quiescent\n", ThisTask, filenr,
+         NSubstepsSkipped, NSubsteps);
+#ifdef ADAPTIVE_SUBSTEPS_CHECK
+  int k;
+
+  for(k = 0; k < NADAPTIVECHECK; k++)
+    printf("Task %d file %d: %s, adaptive vs fixed steps: summed |difference| / total = %g, "
+           "largest in a galaxy = %g\n", ThisTask, filenr, AdaptiveCheckName[k],
+           AdaptiveCheckTotal[k] > 0 ? AdaptiveCheckDiff[k] / AdaptiveCheckTotal[k] : 0., AdaptiveCheckMaxRel[k]);
+#endif
+}
+#endif //ADAPTIVE_SUBSTEPS
+
+
+/**@brief Advances the ngal galaxies of the FOF group of halonr through the
+  *       STEPS substeps between previoustime and previoustime - deltaT,
+  *       adding infallingGas to the hot gas of centralgal. relink lists the
+  *       satellites a merging Type 1 re-points to cenngal. With adaptive
+  *       set (ADAPTIVE_SUBSTEPS), quiescent galaxies skip cooling and AGN
+  *       heating and form their stars in one coarse step over all the
+  *       substeps they stay quiescent for; returns how many galaxy-substeps
+  *       were quiescent. */
+static int evolve_substeps(int halonr, int ngal, int centralgal, int cenngal, double previoustime, double deltaT,
+                           double infallingGas, int *relink, int nrelink, int adaptive)
+{
+  int p, nstep, merger_centralgal, i, nskipped = 0;
+  double time;
 
-  /* Update all galaxies to same star-formation history time-bins.
-   * Needed in case some galaxy has skipped a snapshot. */
 #ifdef STAR_FORMATION_HISTORY
-  age_in_years = (Age[0] - previoustime) * UnitTime_in_years / Hubble_h;        //ROB: age_in_years is in units of "real years"!
-  nstep = 0;
-  for(p = 0; p < ngal; p++)
-    sfh_update_bins(p, Halo[halonr].SnapNum - 1, nstep, age_in_years);
+  double age_in_years;
 #endif
 
-  /* Handle the transfer of mass between satellites and central galaxies */
-  deal_with_satellites(centralgal, ngal);
+#ifdef ADAPTIVE_SUBSTEPS
+  /* whether each galaxy is quiescent in the current substep, and the time
+   * it has been quiescent for without forming its stars yet */
+  char *quiescent = static_cast < char *>(mymalloc("QuiescentGal", sizeof(char) * ngal));
+  double *skipped = static_cast < double *>(mymalloc("QuiescentTime", sizeof(double) * ngal));
 
-  /* Delete inconsequential galaxies */
-  for(p = 0; p < ngal; p++)
-    if(Gal[p].Type == 2 && Gal[p].ColdGas + Gal[p].DiskMass + Gal[p].BulgeMass < 1.e-8)
-      Gal[p].Type = 3;
-    else
-      mass_checks("Evolve_galaxies #0.1", p);
+  memset(quiescent, 0, sizeof(char) * ngal);
+  memset(skipped, 0, sizeof(double) * ngal);
+#else
+  char *quiescent = NULL;
+#endif
 
-  /* Calculate how much hot gas needs to be accreted to give the correct baryon fraction
-   * in the main halo. This is the universal fraction, less any reduction due to reionization. */
-  infallingGas = infall_recipe(centralgal, ngal, Zcurr);
-  Gal[centralgal].PrimordialAccretionRate = infallingGas / deltaT;
+#ifdef GALAXY_SOA
+  alloc_galaxy_soa(ngal);
+#endif
 
-  /* All the physics are computed in a number of intervals between snapshots
-   * equal to STEPS */
   for(nstep = 0; nstep < STEPS; nstep++)
     {
       /* time to present of the current step */
@@ -786,6 +903,19 @@ void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
 
       mass_checks("Evolve_galaxies #0.5", centralgal);
 
+#ifdef ADAPTIVE_SUBSTEPS
+      /* nothing in the substep before their star formation changes the
+       * state of type 2 galaxies, so they are flagged once for all passes */
+      if(adaptive)
+        for(p = 0; p < ngal; p++)
+          quiescent[p] = galaxy_is_quiescent(p);
+#endif
+
+#if defined(MULTIPASS_SUBSTEPS) || defined(GALAXY_SOA)
+#ifdef GALAXY_SOA
+      gather_galaxy_soa(ngal);
+      reincorporate_gas_soa(ngal, deltaT / STEPS);
+#else
       for(p = 0; p < ngal; p++)
         {
           /* don't treat galaxies that have already merged */
@@ -796,20 +926,87 @@ void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
           if(Gal[p].Type == 0 || Gal[p].Type == 1)
             {
               reincorporate_gas(p, deltaT / STEPS);
-              /* determine cooling gas given halo properties and add it to the cold phase */
               mass_checks("Evolve_galaxies #1.5", p);
-              compute_cooling(p, deltaT / STEPS, ngal);
             }
         }
+#endif
+
+      /* reincorporation only changes the galaxy itself, so the cooling
+       * functions of the whole group can be looked up at once */
+      double *cooling_lambda = static_cast < double *>(mymalloc("CoolingLambda", sizeof(double) * ngal));
+
+#ifdef GALAXY_SOA
+      /* the vectorised recipe runs over every galaxy, also those for which
+       * compute_cooling_rates() leaves lambda unset and whose result is dropped */
+      memset(cooling_lambda, 0, sizeof(double) * ngal);
+      compute_cooling_rates(ngal, cooling_lambda);
+      compute_cooling_soa(ngal, deltaT / STEPS, cooling_lambda);
+#else
+      compute_cooling_rates(ngal, cooling_lambda);
+
+      for(p = 0; p < ngal; p++)
+        if(Gal[p].Type == 0 || Gal[p].Type == 1)
+          {
+            /* determine cooling gas given halo properties and add it to the cold phase */
+            compute_cooling(p, deltaT / STEPS, ngal, cooling_lambda[p]);
+          }
+#endif
+
+      myfree(cooling_lambda);
 
       //this must be separated as now satellite AGN can heat central galaxies
       //therefore the AGN from all satellites must be computed, in a loop inside this function,
       //before gas is cooled into central galaxies (only suppress cooling, the gas is not actually heated)
       if(AGNRadioModeModel != 5)
-        do_AGN_heating(deltaT / STEPS, ngal);
+        do_AGN_heating(deltaT / STEPS, ngal, quiescent);
+#else
+      /* Fused substep: reincorporation, cooling and AGN heating only change
+       * the galaxy itself, so they are applied one galaxy at a time while
+       * its record is in cache. The exception is AGNRadioModeModel 0, where
+       * type 1 galaxies heat the cooling gas of the FOF central, so AGN
+       * heating gets a pass of its own after the cooling of all galaxies.
+       * Star formation feeds back into the hot gas of the centrals, so it
+       * can only start once all galaxies have cooled. */
+      for(p = 0; p < ngal; p++)
+        {
+          /* don't treat galaxies that have already merged */
+          if(Gal[p].Type != 3)
+            mass_checks("Evolve_galaxies #1", p);
+
+          if(Gal[p].Type == 0 || Gal[p].Type == 1)
+            {
+              reincorporate_gas(p, deltaT / STEPS);
+              mass_checks("Evolve_galaxies #1.5", p);
+
+              /* determine cooling gas given halo properties and add it to the cold phase */
+              compute_cooling(p, deltaT / STEPS, ngal, get_cooling_rate(p));
+            }
+
+          if(AGNRadioModeModel != 0 && AGNRadioModeModel != 5 && (quiescent == NULL || !quiescent[p]))
+            do_AGN_heating_galaxy(p, -1, deltaT / STEPS);
+        }
+
+      if(AGNRadioModeModel == 0)
+        do_AGN_heating(deltaT / STEPS, ngal, quiescent);
+#endif
 
       for(p = 0; p < ngal; p++)
         {
+#ifdef ADAPTIVE_SUBSTEPS
+          /* nothing cools onto a quiescent galaxy, so its cooling is just
+           * what cool_gas_onto_galaxy() does then; its star formation is
+           * left for catch_up_quiescent() once the galaxy stops being
+           * quiescent, merges or reaches the end of the snapshot */
+          if(quiescent[p])
+            {
+              Gal[p].XrayLum = 0.0;
+              skipped[p] += deltaT / STEPS;
+              nskipped++;
+              continue;
+            }
+          if(skipped[p] > 0.)
+            catch_up_quiescent(p, centralgal, previoustime - nstep * (deltaT / STEPS), deltaT, nstep - 1, skipped);
+#endif
           cool_gas_onto_galaxy(p, deltaT / STEPS);
           mass_checks("Evolve_galaxies #2", p);
           starformation(p, centralgal, time, deltaT / STEPS, nstep);
@@ -827,16 +1024,28 @@ void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
                 {
                   NumMergers++;
 
-                  if(Gal[p].Type == 1)
-                    for(q = 0; q < ngal; q++)
-                      if(Gal[q].Type == 2 && Gal[p].CentralGal == p)
-                        Gal[q].CentralGal = cenngal;
+                  if(Gal[p].Type == 1 && Gal[p].CentralGal == p)
+                    {
+                      for(i = 0; i < nrelink; i++)
+                        if(Gal[relink[i]].Type == 2)
+                          Gal[relink[i]].CentralGal = cenngal;
+                      nrelink = 0;
+                    }
 
                   if(Gal[p].Type == 2)
                     merger_centralgal = Gal[p].CentralGal;
                   else
                     merger_centralgal = cenngal;
 
+#ifdef ADAPTIVE_SUBSTEPS
+                  if(skipped[p] > 0.)
+                    catch_up_quiescent(p, centralgal, previoustime - (nstep + 1) * (deltaT / STEPS), deltaT, nstep,
+                                       skipped);
+                  if(skipped[merger_centralgal] > 0.)
+                    catch_up_quiescent(merger_centralgal, centralgal, previoustime - (nstep + 1) * (deltaT / STEPS),
+                                       deltaT, nstep, skipped);
+#endif
+
                   mass_checks("Evolve_galaxies #4", p);
                   mass_checks("Evolve_galaxies #4", merger_centralgal);
                   mass_checks("Evolve_galaxies #4", centralgal);
@@ -859,6 +1068,134 @@ void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
 
     }                           /* end move forward in interval STEPS */
 
+#ifdef GALAXY_SOA
+  free_galaxy_soa();
+#endif
+
+#ifdef ADAPTIVE_SUBSTEPS
+  for(p = 0; p < ngal; p++)
+    if(skipped[p] > 0.)
+      catch_up_quiescent(p, centralgal, previoustime - deltaT, deltaT, STEPS - 1, skipped);
+
+  myfree(skipped);
+  myfree(quiescent);
+#endif
+
+  return nskipped;
+}
+
+
+/**@brief evolve_galaxies() deals with most of the SA recipes. This is
+  *       where most of the physical recipes are called, including:
+  *       infall_recipe() (gets the fraction of primordial gas that infalled),
+  *       add_infall_to_hot() (adds the infalled gas to the hot phase),
+  *       reincorporate_gas() (reincorporates gas ejected by SN),
+  *       cooling_recipe() (gets the amount of gas that cooled - takes into
+  *       account AGN feedback), cool_gas_onto_galaxy() (adds the gas that
+  *       cooled into the cold phase, starformation_and_feedback() (normal
+  *       SF and SN feedback), deal_with_galaxy_merger() (adds components,
+  *       grows black hole and deals with SF burst), disruption() (total and
+  *       instantaneous disruption of type 2 satellites) and dust() (if galaxy
+  *       is in an output time, dust extinction is computed).
+  *
+  *       All these calculations are done in time steps of 1/STEPS the time
+  *       between each snapshot (STEPS=20).
+  */
+
+/* Note: halonr is here the FOF-background subhalo (i.e. main halo) */
+void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
+{
+  int p, nstep, centralgal, currenthalo, prevgal, i;
+  double infallingGas, deltaT;
+  double previoustime, newtime;
+
+#ifdef STAR_FORMATION_HISTORY
+  double age_in_years;
+#endif
+
+  //previoustime = NumToTime(Gal[0].SnapNum);
+  previoustime = NumToTime(Halo[halonr].SnapNum - 1);
+  newtime = NumToTime(Halo[halonr].SnapNum);
+
+  /* Time between snapshots */
+  deltaT = previoustime - newtime;
+
+  centralgal = Gal[0].CentralGal;
+
+  for(p = 0; p < ngal; p++)
+    mass_checks("Evolve_galaxies #0", p);
+
+  //print_galaxy("\n\ncheck1", centralgal, halonr);
+
+  if(Gal[centralgal].Type != 0 || Gal[centralgal].HaloNr != halonr)
+    terminate("Something wrong here ..... \n");
+
+  /* Update all galaxies to same star-formation history time-bins.
+   * Needed in case some galaxy has skipped a snapshot. */
+#ifdef STAR_FORMATION_HISTORY
+  age_in_years = (Age[0] - previoustime) * UnitTime_in_years / Hubble_h;        //ROB: age_in_years is in units of "real years"!
+  nstep = 0;
+  for(p = 0; p < ngal; p++)
+    sfh_update_bins(p, Halo[halonr].SnapNum - 1, nstep, age_in_years);
+#endif
+
+  /* Handle the transfer of mass between satellites and central galaxies */
+  deal_with_satellites(centralgal, ngal);
+
+  /* Delete inconsequential galaxies */
+  for(p = 0; p < ngal; p++)
+    if(Gal[p].Type == 2 && Gal[p].ColdGas + Gal[p].DiskMass + Gal[p].BulgeMass < 1.e-8)
+      Gal[p].Type = 3;
+    else
+      mass_checks("Evolve_galaxies #0.1", p);
+
+  /* Calculate how much hot gas needs to be accreted to give the correct baryon fraction
+   * in the main halo. This is the universal fraction, less any reduction due to reionization. */
+  infallingGas = infall_recipe(centralgal, ngal);
+  Gal[centralgal].PrimordialAccretionRate = infallingGas / deltaT;
+
+  /* When a Type 1 merges, every Type 2 of the group is re-pointed to
+   * cenngal (Gal[p].CentralGal == p holds for any Type 1, the central of
+   * its own subhalo). Nothing else changes CentralGal or makes new Type 2s
+   * here, so only the satellites listed now can be changed by that, and
+   * each only once. */
+  int nrelink = 0;
+  int *relink = static_cast < int *>(mymalloc("RelinkSatellites", sizeof(int) * ngal));
+
+  for(p = 0; p < ngal; p++)
+    if(Gal[p].Type == 2 && Gal[p].CentralGal != cenngal)
+      relink[nrelink++] = p;
+
+  /* All the physics are computed in a number of intervals between snapshots
+   * equal to STEPS */
+#ifdef ADAPTIVE_SUBSTEPS
+#ifdef ADAPTIVE_SUBSTEPS_CHECK
+  /* evolve the group on fixed steps first, as the reference */
+  struct adaptive_check check;
+
+  check_adaptive_substeps_start(&check, ngal);
+  evolve_substeps(halonr, ngal, centralgal, cenngal, previoustime, deltaT, infallingGas, relink, nrelink, 0);
+  check_adaptive_substeps_swap(&check, ngal);
+#endif
+  int nskipped = evolve_substeps(halonr, ngal, centralgal, cenngal, previoustime, deltaT, infallingGas, relink,
+                                 nrelink, 1);
+#ifdef ADAPTIVE_SUBSTEPS_CHECK
+  check_adaptive_substeps_finish(&check, ngal);
+#endif
+#ifdef OPENMP
+#pragma omp atomic
+#endif
+  NSubsteps += ngal * STEPS;
+#ifdef OPENMP
+#pragma omp atomic
+#endif
+  NSubstepsSkipped += nskipped;
+#else
+  evolve_substeps(halonr, ngal, centralgal, cenngal, previoustime, deltaT, infallingGas, relink, nrelink, 0);
+#endif
+
+  myfree(relink);
+
   for(p = 0; p < ngal; p++)
     {
       if(Gal[p].Type == 2)
@@ -925,7 +1262,11 @@ void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
       prog = Halo[prog].NextProgenitor;
     }
 
-  for(p = 0, prevgal = -1, currenthalo = -1, centralgal = -1, start = NGalTree; p < ngal; p++)
+#ifdef GALAXYTREE
+  int start = NGalTree;
+#endif
+
+  for(p = 0, prevgal = -1, currenthalo = -1, centralgal = -1; p < ngal; p++)
     {
       if(Gal[p].HaloNr != currenthalo)
         {
@@ -1003,6 +1344,12 @@ void evolve_galaxies(int halonr, int ngal, int treenr, int cenngal)
           NGalTree++;
 #endif
         }
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+      else
+        free_galaxy_lum(Gal[p].LumIndex);
+#endif
+#endif
     }
 
 #ifdef GALAXYTREE
@@ -1052,6 +1399,13 @@ void output_galaxy(int treenr, int heap_index)
     if(ListOutputSnaps[n] == HaloGal[gal_index].SnapNum)
       save_galaxy_append(treenr, gal_index, n);
 #endif
+#endif
+
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+  free_galaxy_lum(HaloGal[gal_index].LumIndex);
+  HaloGal[gal_index].LumIndex = -1;
+#endif
 #endif
 
   /* fill the gap in the heap with the galaxy in the last occupied slot */
@@ -1130,6 +1484,63 @@ void check_options()
 #endif
 #endif
 
+#ifdef DYNAMIC_FILE_ASSIGNMENT
+#ifdef MCMC
+  terminate("\n\n> Error : Makefile option DYNAMIC_FILE_ASSIGNMENT cannot run with MCMC \n");
+#endif
+#endif
+
+#ifdef MMAP_TREES
+#ifdef PRELOAD_TREES
+  terminate("\n\n> Error : Makefile options MMAP_TREES and PRELOAD_TREES cannot run together\n");
+#endif
+#ifdef MCMC
+  terminate("\n\n> Error : Makefile option MMAP_TREES cannot run with MCMC \n");
+#endif
+#endif
+
+#ifdef PREFETCH_TREES
+#ifdef PRELOAD_TREES
+  terminate("\n\n> Error : Makefile options PREFETCH_TREES and PRELOAD_TREES cannot run together\n");
+#endif
+#ifdef MMAP_TREES
+  terminate("\n\n> Error : Makefile options PREFETCH_TREES and MMAP_TREES cannot run together\n");
+#endif
+#ifdef OPENMP
+  terminate("\n\n> Error : Makefile options PREFETCH_TREES and OPENMP cannot run together\n");
+#endif
+#ifdef MCMC
+  terminate("\n\n> Error : Makefile option PREFETCH_TREES cannot run with MCMC \n");
+#endif
+#endif
+
+#ifdef SCALED_TREE_CACHE
+#ifdef MR_PLUS_MRII
+  terminate("\n\n> Error : Makefile options SCALED_TREE_CACHE and MR_PLUS_MRII cannot run together\n");
+#endif
+#endif
+
+#ifdef ADAPTIVE_SUBSTEPS_CHECK
+#ifndef ADAPTIVE_SUBSTEPS
+  terminate("\n\n> Error : Makefile option ADAPTIVE_SUBSTEPS_CHECK requires option ADAPTIVE_SUBSTEPS\n");
+#endif
+#ifdef GALAXYTREE
+  terminate("\n\n> Error : Makefile options ADAPTIVE_SUBSTEPS_CHECK and GALAXYTREE cannot run together\n");
+#endif
+#endif
+
+#ifdef ASYNC_OUTPUT
+#ifdef OPENMP
+  terminate("\n\n> Error : Makefile options ASYNC_OUTPUT and OPENMP cannot run together\n");
+#endif
+#ifdef GALAXYTREE
+  terminate("\n\n> Error : Makefile option ASYNC_OUTPUT cannot run with GALAXYTREE \n");
+#endif
+#ifdef MCMC
+  terminate("\n\n> Error : Makefile option ASYNC_OUTPUT cannot run with MCMC \n");
+#endif
+#endif
+
 #ifdef HALOMODEL
 #ifdef MR_PLUS_MRII
   terminate("\n\n> Error : Makefile option HALOMODEL doesn't work yet with MR_PLUS_MRII\n");
@@ -1147,6 +1558,15 @@ void check_options()
 #endif
 #endif
 
+#ifdef OPENMP
+#ifdef GALAXYTREE
+  terminate("\n\n> Error : Makefile option OPENMP cannot run with GALAXYTREE \n");
+#endif
+#ifdef MCMC
+  terminate("\n\n> Error : Makefile option OPENMP cannot run with MCMC \n");
+#endif
+#endif //OPENMP
+
 #ifdef LIGHT_OUTPUT
 #ifdef POST_PROCESS_MAGS
   terminate("\n\n> Error : Makefile option LIGHT_OUTPUT cannot run with POST_PROCESS_MAGS \n");
@@ -931,6 +931,10 @@ void change_dark_matter_sim(char SimName[])
   read_zlist_original_cosm();
   read_output_snaps();
 
+  //redshift-dependent tables built from the lists just read
+  init_scale_cosmology();
+  init_snapshot_factors();
+
   //CREATE ARRAYS OF SFH TIME STRUCTURE:
 #ifdef  STAR_FORMATION_HISTORY
   create_sfh_bins();
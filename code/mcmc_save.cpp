@@ -105,19 +105,19 @@ void save_galaxy_for_mcmc(int gal_index)
 
 #else
             MCMC_GAL[TotMCMCGals[snap]].MagU[snap] =
-              lum_to_mag(HaloGal[gal_index].LumDust[0][snap]) - 5. * log10_Hubble_h;
+              lum_to_mag(GALLUM(HaloGal[gal_index]).LumDust[0][snap]) - 5. * log10_Hubble_h;
             MCMC_GAL[TotMCMCGals[snap]].MagB[snap] =
-              lum_to_mag(HaloGal[gal_index].LumDust[1][snap]) - 5. * log10_Hubble_h;
+              lum_to_mag(GALLUM(HaloGal[gal_index]).LumDust[1][snap]) - 5. * log10_Hubble_h;
             MCMC_GAL[TotMCMCGals[snap]].MagV[snap] =
-              lum_to_mag(HaloGal[gal_index].LumDust[2][snap]) - 5. * log10_Hubble_h;
+              lum_to_mag(GALLUM(HaloGal[gal_index]).LumDust[2][snap]) - 5. * log10_Hubble_h;
             MCMC_GAL[TotMCMCGals[snap]].MagJ[snap] =
-              lum_to_mag(HaloGal[gal_index].LumDust[3][snap]) - 5. * log10_Hubble_h;
+              lum_to_mag(GALLUM(HaloGal[gal_index]).LumDust[3][snap]) - 5. * log10_Hubble_h;
             MCMC_GAL[TotMCMCGals[snap]].MagK[snap] =
-              lum_to_mag(HaloGal[gal_index].LumDust[4][snap]) - 5. * log10_Hubble_h;
+              lum_to_mag(GALLUM(HaloGal[gal_index]).LumDust[4][snap]) - 5. * log10_Hubble_h;
             MCMC_GAL[TotMCMCGals[snap]].Magu[snap] =
-              lum_to_mag(HaloGal[gal_index].LumDust[5][snap]) - 5. * log10_Hubble_h;
+              lum_to_mag(GALLUM(HaloGal[gal_index]).LumDust[5][snap]) - 5. * log10_Hubble_h;
             MCMC_GAL[TotMCMCGals[snap]].Magr[snap] =
-              lum_to_mag(HaloGal[gal_index].LumDust[6][snap]) - 5. * log10_Hubble_h;
+              lum_to_mag(GALLUM(HaloGal[gal_index]).LumDust[6][snap]) - 5. * log10_Hubble_h;
 #endif //POST_PROCESS_MAGS
 #endif //COMPUTE_SPECPHOT_PROPERTIES
 
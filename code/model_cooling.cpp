@@ -81,17 +81,87 @@
  *
 */
 
-/** @brief main cooling recipe, where the cooling rates are calculated */
+/** @brief temperature and metallicity of the hot gas of galaxy p, the
+  * arguments of the cooling function */
+static void cooling_rate_arguments(int p, double *logTemp, double *logZ)
+{
+  double Vvir, temp, tot_hotMass, tot_metals;
+
+  tot_hotMass = Gal[p].HotGas;
+  tot_metals = metals_total(Gal[p].MetalsHotGas);
+  Vvir = Gal[p].Vvir;
+  temp = 35.9 * Vvir * Vvir;
+
+  *logTemp = log10(temp);
+  if(tot_metals > 0)
+    *logZ = log10(tot_metals / tot_hotMass);
+  else
+    *logZ = -10.0;
+}
+
+
+/** @brief cooling function of the hot gas of galaxy p, the same value
+  * compute_cooling_rates() gives for a whole FOF group. Returns 0 if
+  * the galaxy has no hot gas, in which case compute_cooling() does not
+  * use it. */
+double get_cooling_rate(int p)
+{
+  double logTemp, logZ;
+
+  if(Gal[p].HotGas <= 1.0e-6)
+    return 0.;
+
+  cooling_rate_arguments(p, &logTemp, &logZ);
 
-void compute_cooling(int p, double dt, int ngal)
+  return get_metaldependent_cooling_rate(logTemp, logZ);
+}
+
+
+/** @brief cooling function of the hot gas of all the type 0 and 1 galaxies
+  * of a FOF group that have hot gas, obtained in one call to
+  * get_metaldependent_cooling_rates(). lambda[p] is left unset for the
+  * others, for which compute_cooling() does not use it. */
+void compute_cooling_rates(int ngal, double *lambda)
+{
+  double *logTemp, *logZ, *rate;
+  int p, n, *gal;
+
+  gal = static_cast < int *>(mymalloc("CoolingGal", sizeof(int) * ngal));
+  logTemp = static_cast < double *>(mymalloc("CoolingLogTemp", sizeof(double) * ngal));
+  logZ = static_cast < double *>(mymalloc("CoolingLogZ", sizeof(double) * ngal));
+  rate = static_cast < double *>(mymalloc("CoolingRate", sizeof(double) * ngal));
+
+  for(p = 0, n = 0; p < ngal; p++)
+    if((Gal[p].Type == 0 || Gal[p].Type == 1) && Gal[p].HotGas > 1.0e-6)
+      {
+        gal[n] = p;
+        cooling_rate_arguments(p, &logTemp[n], &logZ[n]);
+        n++;
+      }
+
+  get_metaldependent_cooling_rates(n, logTemp, logZ, rate);
+
+  for(p = 0; p < n; p++)
+    lambda[gal[p]] = rate[p];
+
+  myfree(rate);
+  myfree(logZ);
+  myfree(logTemp);
+  myfree(gal);
+}
+
+
+/** @brief main cooling recipe, where the cooling rates are calculated;
+  * lambda is the cooling function of the hot gas, from
+  * compute_cooling_rates() */
+void compute_cooling(int p, double dt, int ngal, double lambda)
 {
-  double Vvir, Rvir, x, lambda, tcool, rcool, temp, tot_hotMass, tot_metals, HotRadius;
-  double coolingGas, logZ, rho_rcool, rho0;
+  double Vvir, Rvir, x, tcool, rcool, temp, tot_hotMass, HotRadius;
+  double coolingGas, rho_rcool, rho0;
 
   mass_checks("cooling_recipe #1", p);
 
   tot_hotMass = Gal[p].HotGas;
-  tot_metals = metals_total(Gal[p].MetalsHotGas);
 
   if(tot_hotMass > 1.0e-6)
     {
@@ -110,13 +180,7 @@ void compute_cooling(int p, double dt, int ngal)
       else
         HotRadius = Gal[p].HotRadius;
 
-      if(tot_metals > 0)
-        logZ = log10(tot_metals / tot_hotMass);
-      else
-        logZ = -10.0;
-
       //eq. 3 and 4 Guo2010
-      lambda = get_metaldependent_cooling_rate(log10(temp), logZ);
       x = PROTONMASS * BOLTZMANN * temp / lambda;       // now this has units sec g/cm^3
       x /= (UnitDensity_in_cgs * UnitTime_in_s);        // now in internal units
       rho_rcool = x / (0.28086 * tcool);
@@ -159,6 +223,70 @@ void compute_cooling(int p, double dt, int ngal)
 }
 
 
+#ifdef GALAXY_SOA
+/** @brief compute_cooling() for all the galaxies of a FOF group at once, on
+  * the arrays of GalSoA and with the cooling functions from
+  * compute_cooling_rates(). Every galaxy goes through the same arithmetic,
+  * so the loop vectorises; the results are written back to CoolingRadius
+  * and CoolingGas of the type 0 and 1 galaxies only, as in the scalar
+  * recipe. lambda must be defined for all galaxies. */
+void compute_cooling_soa(int ngal, double dt, double *lambda)
+{
+  double Vvir, Rvir, x, tcool, rcool, temp, tot_hotMass, HotRadius;
+  double coolingGas, rho_rcool, rho0;
+  int p;
+
+  for(p = 0; p < ngal; p++)
+    {
+      tot_hotMass = GalSoA.HotGas[p];
+      Vvir = GalSoA.Vvir[p];
+      Rvir = GalSoA.Rvir[p];
+
+      tcool = Rvir / Vvir;
+      temp = 35.9 * Vvir * Vvir;
+      HotRadius = (GalSoA.Type[p] == 0) ? GalSoA.Rvir[p] : GalSoA.HotRadius[p];
+
+      x = PROTONMASS * BOLTZMANN * temp / lambda[p];
+      x /= (UnitDensity_in_cgs * UnitTime_in_s);
+      rho_rcool = x / (0.28086 * tcool);
+      rho0 = tot_hotMass / (4 * M_PI * HotRadius);
+      rcool = sqrt(rho0 / rho_rcool);
+
+      if(rcool > Rvir)
+        coolingGas = tot_hotMass / (HotRadius / Vvir) * dt;
+      else
+        coolingGas = (tot_hotMass / HotRadius) * (rcool / tcool) * dt;
+
+      if(log10(temp) < 4.0)
+        coolingGas = 0.;
+
+      if(coolingGas > tot_hotMass)
+        coolingGas = tot_hotMass;
+      else if(coolingGas < 0.0)
+        coolingGas = 0.0;
+
+      if(tot_hotMass > 1.0e-6)
+        {
+          if(GalSoA.CoolingRadius[p] < rcool)
+            GalSoA.CoolingRadius[p] = rcool;
+        }
+      else
+        coolingGas = 0.0;
+
+      GalSoA.CoolingGas[p] = coolingGas;
+    }
+
+  for(p = 0; p < ngal; p++)
+    if(GalSoA.Type[p] == 0 || GalSoA.Type[p] == 1)
+      {
+        Gal[p].CoolingRadius = GalSoA.CoolingRadius[p];
+        Gal[p].CoolingGas = GalSoA.CoolingGas[p];
+        mass_checks("cooling_recipe_soa #1.5", p);
+      }
+}
+#endif //GALAXY_SOA
+
+
 
 /** @brief calculates the energy released by black holes due to passive accretion,
   * that will be used to reduced the cooling.*/
@@ -186,14 +314,12 @@ void compute_cooling(int p, double dt, int ngal)
 //might be assigned the centre of a cluster leading to huge cooling. It is therefore
 //not necessary to do the same correction for satellites of subhalos.
 
+// Galaxies flagged in skip (if not NULL) are left out; for the quiescent
+// satellites of ADAPTIVE_SUBSTEPS, with no cooling gas, heating does nothing.
 
-
-void do_AGN_heating(double dt, int ngal)
+void do_AGN_heating(double dt, int ngal, const char *skip)
 {
-  double AGNrate, AGNheating, AGNaccreted, AGNcoeff, fraction, EDDrate, FreeFallRadius;
-  double dist, HotGas, HotRadius, Rvir, Vvir, Mvir;
-  double LeftOverEnergy, CoolingGas, AGNAccretedFromCentral;
-  int p, FoFCentralGal;
+  int p, FoFCentralGal = -1;
 
   if(AGNRadioModeModel == 0)
     {
@@ -203,153 +329,164 @@ void do_AGN_heating(double dt, int ngal)
     }
 
   for(p = 0; p < ngal; p++)
-    {
-      Gal[p].CoolingRate_beforeAGN += Gal[p].CoolingGas / (dt * STEPS);
+    if(skip == NULL || !skip[p])
+      do_AGN_heating_galaxy(p, FoFCentralGal, dt);
+}
 
-      AGNrate = 0.;
-      LeftOverEnergy = 0.;
 
-      HotGas = Gal[p].HotGas;
-      HotRadius = Gal[p].HotRadius;
-      CoolingGas = Gal[p].CoolingGas;
-      Mvir = Gal[p].Mvir;
-      Rvir = Gal[p].Rvir;
-      Vvir = Gal[p].Vvir;
+/** @brief AGN heating of galaxy p. Only with AGNRadioModeModel = 0 does a
+  * type 1 galaxy also heat the cooling gas of FoFCentralGal; otherwise
+  * the galaxy is treated on its own and FoFCentralGal is not used. */
+void do_AGN_heating_galaxy(int p, int FoFCentralGal, double dt)
+{
+  double AGNrate, AGNheating, AGNaccreted, AGNcoeff, fraction, EDDrate, FreeFallRadius;
+  double dist, HotGas, HotRadius, Rvir, Vvir, Mvir;
+  double LeftOverEnergy, CoolingGas;
+
+  Gal[p].CoolingRate_beforeAGN += Gal[p].CoolingGas / (dt * STEPS);
+
+  AGNrate = 0.;
+  LeftOverEnergy = 0.;
 
-      if(HotGas > 0.0)
+  HotGas = Gal[p].HotGas;
+  HotRadius = Gal[p].HotRadius;
+  CoolingGas = Gal[p].CoolingGas;
+  Mvir = Gal[p].Mvir;
+  Rvir = Gal[p].Rvir;
+  Vvir = Gal[p].Vvir;
+
+  if(HotGas > 0.0)
+    {
+      if(AGNRadioModeModel == 0)
+        AGNrate = AgnEfficiency * (UnitTime_in_s * SOLAR_MASS) / (UNITMASS_IN_G * SEC_PER_YEAR)
+          * Gal[p].BlackHoleMass / Hubble_h * (HotGas / Hubble_h) * 10.;
+      else if(AGNRadioModeModel == 2)
         {
-          if(AGNRadioModeModel == 0)
-            AGNrate = AgnEfficiency * (UnitTime_in_s * SOLAR_MASS) / (UNITMASS_IN_G * SEC_PER_YEAR)
-              * Gal[p].BlackHoleMass / Hubble_h * (HotGas / Hubble_h) * 10.;
-          else if(AGNRadioModeModel == 2)
-            {
-              //empirical (standard) accretion recipe - Eq. 10 in Croton 2006
-              AGNrate = AgnEfficiency / (UNITMASS_IN_G / UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS)
-                * (Gal[p].BlackHoleMass / 0.01) * pow3(Vvir / 200.0)
-                * ((HotGas / HotRadius * Rvir / Mvir) / 0.1);
-            }
-          else if(AGNRadioModeModel == 3 || AGNRadioModeModel == 4)
-            {
-              double x, lambda, temp, logZ, tot_metals;
+          //empirical (standard) accretion recipe - Eq. 10 in Croton 2006
+          AGNrate = AgnEfficiency / (UNITMASS_IN_G / UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS)
+            * (Gal[p].BlackHoleMass / 0.01) * pow3(Vvir / 200.0)
+            * ((HotGas / HotRadius * Rvir / Mvir) / 0.1);
+        }
+      else if(AGNRadioModeModel == 3 || AGNRadioModeModel == 4)
+        {
+          double x, lambda, temp, logZ, tot_metals;
 
-              tot_metals = metals_total(Gal[p].MetalsHotGas);
+          tot_metals = metals_total(Gal[p].MetalsHotGas);
 
-              /* temp -> Temperature of the Gas in Kelvin, obtained from
-               * hidrostatic equilibrium KT=0.5*mu_p*(Vc)^2 assuming Vvir~Vc */
-              temp = 35.9 * Vvir * Vvir;
-              if(tot_metals > 0)
-                logZ = log10(tot_metals / HotGas);
+          /* temp -> Temperature of the Gas in Kelvin, obtained from
+           * hidrostatic equilibrium KT=0.5*mu_p*(Vc)^2 assuming Vvir~Vc */
+          temp = 35.9 * Vvir * Vvir;
+          if(tot_metals > 0)
+            logZ = log10(tot_metals / HotGas);
+          else
+            logZ = -10.0;
+          lambda = get_metaldependent_cooling_rate(log10(temp), logZ);
+          x = PROTONMASS * BOLTZMANN * temp / lambda;       // now this has units sec g/cm^3
+          x /= (UnitDensity_in_cgs * UnitTime_in_s);        // now in internal units
+
+          /* Bondi-Hoyle accretion recipe -- efficiency = 0.15
+           * Eq. 29 in Croton 2006 */
+          if(AGNRadioModeModel == 3)
+            AGNrate = (2.5 * M_PI * G) * (0.75 * 0.6 * x) * Gal[p].BlackHoleMass * 0.15;
+          else if(AGNRadioModeModel == 4)
+            {
+              /* Cold cloud accretion recipe -- trigger: Rff = 50 Rdisk,
+               * and accretion rate = 0.01% cooling rate
+               * Eq. 25 in Croton 2006 */
+              FreeFallRadius = HotGas / (6.0 * 0.6 * x * Rvir * Vvir) / HotRadius * Rvir;
+              if(Gal[p].BlackHoleMass > 0.0 && FreeFallRadius < Gal[p].GasDiskRadius * 50.0)
+                AGNrate = 0.0001 * CoolingGas / dt;
               else
-                logZ = -10.0;
-              lambda = get_metaldependent_cooling_rate(log10(temp), logZ);
-              x = PROTONMASS * BOLTZMANN * temp / lambda;       // now this has units sec g/cm^3
-              x /= (UnitDensity_in_cgs * UnitTime_in_s);        // now in internal units
-
-              /* Bondi-Hoyle accretion recipe -- efficiency = 0.15
-               * Eq. 29 in Croton 2006 */
-              if(AGNRadioModeModel == 3)
-                AGNrate = (2.5 * M_PI * G) * (0.75 * 0.6 * x) * Gal[p].BlackHoleMass * 0.15;
-              else if(AGNRadioModeModel == 4)
-                {
-                  /* Cold cloud accretion recipe -- trigger: Rff = 50 Rdisk,
-                   * and accretion rate = 0.01% cooling rate
-                   * Eq. 25 in Croton 2006 */
-                  FreeFallRadius = HotGas / (6.0 * 0.6 * x * Rvir * Vvir) / HotRadius * Rvir;
-                  if(Gal[p].BlackHoleMass > 0.0 && FreeFallRadius < Gal[p].GasDiskRadius * 50.0)
-                    AGNrate = 0.0001 * CoolingGas / dt;
-                  else
-                    AGNrate = 0.0;
-                }
+                AGNrate = 0.0;
             }
+        }
 
-          /* Eddington rate */
-          /* Note that this assumes an efficiency of 50%
-           * - it ignores the e/(1-e) factor in L = e/(1-e) Mdot c^2 */
-          EDDrate = 1.3e48 * Gal[p].BlackHoleMass / (UnitEnergy_in_cgs / UnitTime_in_s) / 9e10;
+      /* Eddington rate */
+      /* Note that this assumes an efficiency of 50%
+       * - it ignores the e/(1-e) factor in L = e/(1-e) Mdot c^2 */
+      EDDrate = 1.3e48 * Gal[p].BlackHoleMass / (UnitEnergy_in_cgs / UnitTime_in_s) / 9e10;
 
-          /* accretion onto BH is always limited by the Eddington rate */
-          if(AGNrate > EDDrate)
-            AGNrate = EDDrate;
+      /* accretion onto BH is always limited by the Eddington rate */
+      if(AGNrate > EDDrate)
+        AGNrate = EDDrate;
 
-          /*  accreted mass onto black hole the value of dt puts an h factor into AGNaccreted as required for code units */
-          AGNaccreted = AGNrate * dt;
+      /*  accreted mass onto black hole the value of dt puts an h factor into AGNaccreted as required for code units */
+      AGNaccreted = AGNrate * dt;
 
-          /* cannot accrete more mass than is available! */
-          if(AGNaccreted > HotGas)
-            AGNaccreted = HotGas;
+      /* cannot accrete more mass than is available! */
+      if(AGNaccreted > HotGas)
+        AGNaccreted = HotGas;
 
-          /*  coefficient to heat the cooling gas back to the virial temperature of the halo */
-          /*  1.34e5 = sqrt(2*eta*c^2), eta=0.1 (standard efficiency) and c in km/s
-           *  Eqs. 11 & 12 in Croton 2006 */
-          AGNcoeff = (1.34e5 / Vvir) * (1.34e5 / Vvir);
+      /*  coefficient to heat the cooling gas back to the virial temperature of the halo */
+      /*  1.34e5 = sqrt(2*eta*c^2), eta=0.1 (standard efficiency) and c in km/s
+       *  Eqs. 11 & 12 in Croton 2006 */
+      AGNcoeff = (1.34e5 / Vvir) * (1.34e5 / Vvir);
 
-          /*  cooling mass that can be suppressed from AGN heating */
-          AGNheating = AGNcoeff * AGNaccreted;
+      /*  cooling mass that can be suppressed from AGN heating */
+      AGNheating = AGNcoeff * AGNaccreted;
 
 
-          if(AGNRadioModeModel == 0 && Gal[p].Type == 1)
+      if(AGNRadioModeModel == 0 && Gal[p].Type == 1)
+        {
+          if(dist < Gal[FoFCentralGal].Rvir)
             {
-              if(dist < Gal[FoFCentralGal].Rvir)
+              if(AGNheating > (Gal[p].CoolingGas + Gal[FoFCentralGal].CoolingGas))
                 {
-                  if(AGNheating > (Gal[p].CoolingGas + Gal[FoFCentralGal].CoolingGas))
-                    {
-                      AGNheating = (Gal[p].CoolingGas + Gal[FoFCentralGal].CoolingGas);
-                      AGNaccreted = (Gal[p].CoolingGas + Gal[FoFCentralGal].CoolingGas) / AGNcoeff;
-                    }
-                  if(AGNheating > Gal[p].CoolingGas)
-                    LeftOverEnergy = AGNheating - Gal[p].CoolingGas;
+                  AGNheating = (Gal[p].CoolingGas + Gal[FoFCentralGal].CoolingGas);
+                  AGNaccreted = (Gal[p].CoolingGas + Gal[FoFCentralGal].CoolingGas) / AGNcoeff;
                 }
+              if(AGNheating > Gal[p].CoolingGas)
+                LeftOverEnergy = AGNheating - Gal[p].CoolingGas;
             }
-          else if(AGNheating > Gal[p].CoolingGas)
-            AGNaccreted = Gal[p].CoolingGas / AGNcoeff;
+        }
+      else if(AGNheating > Gal[p].CoolingGas)
+        AGNaccreted = Gal[p].CoolingGas / AGNcoeff;
 
-          /* limit heating to cooling rate */
-          if(AGNheating > Gal[p].CoolingGas)
-            AGNheating = Gal[p].CoolingGas;
+      /* limit heating to cooling rate */
+      if(AGNheating > Gal[p].CoolingGas)
+        AGNheating = Gal[p].CoolingGas;
 
 
 
 
-          /*  accreted mass onto black hole */
-          Gal[p].BlackHoleMass += AGNaccreted;  //ROB: transfer_mass functions should be used here
-          Gal[p].RadioAccretionRate += AGNaccreted / (dt * STEPS);
-          fraction = AGNaccreted / Gal[p].HotGas;
-          Gal[p].HotGas -= AGNaccreted;
-          Gal[p].MetalsHotGas = metals_add(Gal[p].MetalsHotGas, Gal[p].MetalsHotGas, -fraction);
+      /*  accreted mass onto black hole */
+      Gal[p].BlackHoleMass += AGNaccreted;  //ROB: transfer_mass functions should be used here
+      Gal[p].RadioAccretionRate += AGNaccreted / (dt * STEPS);
+      fraction = AGNaccreted / Gal[p].HotGas;
+      Gal[p].HotGas -= AGNaccreted;
+      Gal[p].MetalsHotGas = metals_add(Gal[p].MetalsHotGas, Gal[p].MetalsHotGas, -fraction);
 
 #ifdef INDIVIDUAL_ELEMENTS
-          Gal[p].HotGas_elements = elements_add(Gal[p].HotGas_elements, Gal[p].HotGas_elements, -fraction);
+      Gal[p].HotGas_elements = elements_add(Gal[p].HotGas_elements, Gal[p].HotGas_elements, -fraction);
 #endif
 #ifdef METALS_SELF
-          Gal[p].MetalsHotGasSelf = metals_add(Gal[p].MetalsHotGasSelf, Gal[p].MetalsHotGasSelf, -fraction);
+      Gal[p].MetalsHotGasSelf = metals_add(Gal[p].MetalsHotGasSelf, Gal[p].MetalsHotGasSelf, -fraction);
 #endif
 
-        }
-      else
-        AGNheating = 0.0;
-
+    }
+  else
+    AGNheating = 0.0;
 
-      Gal[p].CoolingGas -= AGNheating;
 
-      if(Gal[p].CoolingGas < 0.0)
-        Gal[p].CoolingGas = 0.0;
+  Gal[p].CoolingGas -= AGNheating;
 
-      Gal[p].CoolingRate += Gal[p].CoolingGas / (dt * STEPS);
+  if(Gal[p].CoolingGas < 0.0)
+    Gal[p].CoolingGas = 0.0;
 
-      if(AGNRadioModeModel == 0 && LeftOverEnergy > 0.)
-        {
-          Gal[FoFCentralGal].CoolingGas -= LeftOverEnergy;
+  Gal[p].CoolingRate += Gal[p].CoolingGas / (dt * STEPS);
 
-          if(Gal[FoFCentralGal].CoolingGas < 0.0)
-            Gal[FoFCentralGal].CoolingGas = 0.0;
-          else
-            Gal[FoFCentralGal].CoolingRate -= LeftOverEnergy / (dt * STEPS);
-        }
+  if(AGNRadioModeModel == 0 && LeftOverEnergy > 0.)
+    {
+      Gal[FoFCentralGal].CoolingGas -= LeftOverEnergy;
 
+      if(Gal[FoFCentralGal].CoolingGas < 0.0)
+        Gal[FoFCentralGal].CoolingGas = 0.0;
+      else
+        Gal[FoFCentralGal].CoolingRate -= LeftOverEnergy / (dt * STEPS);
+    }
 
-      mass_checks("cooling_recipe #2.", p);
 
-    }
+  mass_checks("cooling_recipe #2.", p);
 }
 
 
@@ -378,7 +515,7 @@ void cool_gas_onto_galaxy(int p, double dt)
 
       // We already know that 0<mcool<=Gal[p].HotGas
       fraction = ((float) Mcool) / Gal[p].HotGas;
-      transfer_gas(p, "Cold", p, "Hot", fraction, "cool_gas_onto_galaxy", __LINE__);
+      transfer_gas < GAS_COLD, GAS_HOT > (p, p, fraction, "cool_gas_onto_galaxy", __LINE__);
 
       if(DiskRadiusModel == 0)
         {
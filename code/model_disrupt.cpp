@@ -144,16 +144,16 @@ void disrupt(int p)
       /* Put gas component to the central galaxy hot gas and stellar material into the ICM.
        * Note that the satellite should have no extended components. */
 
-      transfer_gas(centralgal, "Hot", p, "Cold", 1., "disrupt", __LINE__);
-      transfer_gas(centralgal, "Hot", p, "Hot", 1., "disrupt", __LINE__);
+      transfer_gas < GAS_HOT, GAS_COLD > (centralgal, p, 1., "disrupt", __LINE__);
+      transfer_gas < GAS_HOT, GAS_HOT > (centralgal, p, 1., "disrupt", __LINE__);
 #ifdef TRACK_BURST
       /* Transfer burst component first */
-      transfer_stars(centralgal, "Burst", p, "Burst",
+      transfer_stars < STARS_BURST, STARS_BURST > (centralgal, p,
                      (Gal[p].DiskMass + Gal[p].BulgeMass) / (Gal[p].DiskMass + Gal[p].BulgeMass +
                                                              Gal[p].ICM));
 #endif
-      transfer_stars(centralgal, "ICM", p, "Disk", 1.);
-      transfer_stars(centralgal, "ICM", p, "Bulge", 1.);
+      transfer_stars < STARS_ICM, STARS_DISK > (centralgal, p, 1.);
+      transfer_stars < STARS_ICM, STARS_BULGE > (centralgal, p, 1.);
       /* Add satellite's luminosity into the luminosity of the ICL
        * component of the central galaxy. */
 
@@ -166,12 +166,12 @@ void disrupt(int p)
           for(j = 0; j < NMAG; j++)
             {
 #ifdef OUTPUT_REST_MAGS
-              Gal[centralgal].ICLLum[j][outputbin] += Gal[p].Lum[j][outputbin];
+              GALLUM(Gal[centralgal]).ICLLum[j][outputbin] += GALLUM(Gal[p]).Lum[j][outputbin];
 #endif
 #ifdef COMPUTE_OBS_MAGS
-              Gal[centralgal].ObsICL[j][outputbin] += Gal[p].ObsLum[j][outputbin];
+              GALLUM(Gal[centralgal]).ObsICL[j][outputbin] += GALLUM(Gal[p]).ObsLum[j][outputbin];
 #ifdef OUTPUT_MOMAF_INPUTS
-              Gal[centralgal].dObsICL[j][outputbin] += Gal[p].dObsLum[j][outputbin];
+              GALLUM(Gal[centralgal]).dObsICL[j][outputbin] += GALLUM(Gal[p]).dObsLum[j][outputbin];
 #endif
 #endif
             }
@@ -119,17 +119,17 @@ void dust_model(int p, int snap, int halonr)
           else
             alam = 1.;
 
-          Lum_disk = Gal[p].Lum[k][snap] - Gal[p].LumBulge[k][snap];
-          Gal[p].LumDust[k][snap] = Gal[p].LumBulge[k][snap] + Lum_disk * alam;
+          Lum_disk = GALLUM(Gal[p]).Lum[k][snap] - GALLUM(Gal[p]).LumBulge[k][snap];
+          GALLUM(Gal[p]).LumDust[k][snap] = GALLUM(Gal[p]).LumBulge[k][snap] + Lum_disk * alam;
 
           // now remove light from young stars absorbed by birth clouds
           tauvbc = tauv * (1. / mu - 1.);
           taubc = tauvbc * pow(FilterLambda[k] / VBand_WaveLength, -0.7);
 
-          dly = (Gal[p].YLum[k][snap] - Gal[p].YLumBulge[k][snap]) * alam * (1. - exp(-taubc)) +
-            Gal[p].YLumBulge[k][snap] * (1. - ExpTauBCBulge);
+          dly = (GALLUM(Gal[p]).YLum[k][snap] - GALLUM(Gal[p]).YLumBulge[k][snap]) * alam * (1. - exp(-taubc)) +
+            GALLUM(Gal[p]).YLumBulge[k][snap] * (1. - ExpTauBCBulge);
 
-          Gal[p].LumDust[k][snap] -= dly;
+          GALLUM(Gal[p]).LumDust[k][snap] -= dly;
         }
 #endif
 
@@ -146,17 +146,17 @@ void dust_model(int p, int snap, int halonr)
           else
             alam = 1.;
 
-          Lum_disk = Gal[p].ObsLum[k][snap] - Gal[p].ObsLumBulge[k][snap];
-          Gal[p].ObsLumDust[k][snap] = Gal[p].ObsLumBulge[k][snap] + Lum_disk * alam;
+          Lum_disk = GALLUM(Gal[p]).ObsLum[k][snap] - GALLUM(Gal[p]).ObsLumBulge[k][snap];
+          GALLUM(Gal[p]).ObsLumDust[k][snap] = GALLUM(Gal[p]).ObsLumBulge[k][snap] + Lum_disk * alam;
 
           // now remove light from young stars absorbed by birth clouds
           tauvbc = tauv * (1. / mu - 1.);
           taubc = tauvbc * pow((FilterLambda[k] * (1. + ZZ[ListOutputSnaps[snap]])) / VBand_WaveLength, -0.7);
 
-          dly = (Gal[p].ObsYLum[k][snap] - Gal[p].ObsYLumBulge[k][snap]) * alam * (1. - exp(-taubc)) +
-            Gal[p].ObsYLumBulge[k][snap] * (1. - ExpTauBCBulge);
+          dly = (GALLUM(Gal[p]).ObsYLum[k][snap] - GALLUM(Gal[p]).ObsYLumBulge[k][snap]) * alam * (1. - exp(-taubc)) +
+            GALLUM(Gal[p]).ObsYLumBulge[k][snap] * (1. - ExpTauBCBulge);
 
-          Gal[p].ObsLumDust[k][snap] -= dly;
+          GALLUM(Gal[p]).ObsLumDust[k][snap] -= dly;
 
 
 #ifdef OUTPUT_MOMAF_INPUTS      // compute same thing at z + 1
@@ -171,8 +171,8 @@ void dust_model(int p, int snap, int halonr)
           else
             alam = 1.;
 
-          Lum_disk = Gal[p].dObsLum[k][snap] - Gal[p].dObsLumBulge[k][snap];
-          Gal[p].dObsLumDust[k][snap] = Gal[p].dObsLumBulge[k][snap] + Lum_disk * alam;
+          Lum_disk = GALLUM(Gal[p]).dObsLum[k][snap] - GALLUM(Gal[p]).dObsLumBulge[k][snap];
+          GALLUM(Gal[p]).dObsLumDust[k][snap] = GALLUM(Gal[p]).dObsLumBulge[k][snap] + Lum_disk * alam;
 
           // now remove light from young stars absorbed by birth clouds
           if(snap < (LastDarkMatterSnapShot + 1) - 1)
@@ -182,10 +182,10 @@ void dust_model(int p, int snap, int halonr)
             taubc =
               tauvbc * pow((FilterLambda[k] * (1. + ZZ[ListOutputSnaps[snap]])) / VBand_WaveLength, -0.7);
 
-          dly = (Gal[p].dObsYLum[k][snap] - Gal[p].dObsYLumBulge[k][snap]) * alam * (1. - exp(-taubc)) +
-            Gal[p].dObsYLumBulge[k][snap] * (1. - ExpTauBCBulge);
+          dly = (GALLUM(Gal[p]).dObsYLum[k][snap] - GALLUM(Gal[p]).dObsYLumBulge[k][snap]) * alam * (1. - exp(-taubc)) +
+            GALLUM(Gal[p]).dObsYLumBulge[k][snap] * (1. - ExpTauBCBulge);
 
-          Gal[p].dObsLumDust[k][snap] -= dly;
+          GALLUM(Gal[p]).dObsLumDust[k][snap] -= dly;
 
 #endif //OUTPUT_MOMAF_INPUTS
 
@@ -336,16 +336,24 @@ constexpr auto NDIV = (1 + (IM - 1) / NTAB);
 constexpr auto EPS = 1.2e-7;
 constexpr auto RNMX = (1.0 - EPS);
 
+/* state of gasdev() and ran1() */
+static int gasdev_iset = 0;
+static float gasdev_gset;
+static long ran1_iy = 0;
+static long ran1_iv[NTAB];
+
+#ifdef OPENMP
+#pragma omp threadprivate(gasdev_iset, gasdev_gset, ran1_iy, ran1_iv)
+#endif
+
 /** @brief computes a gaussian random deviate to calculate a random
  *         inclination for extinction. */
 float gasdev(long *idum)
 {
   float ran1(long *idum);
-  static int iset = 0;
-  static float gset;
   float fac, rsq, v1, v2;
 
-  if(iset == 0)
+  if(gasdev_iset == 0)
     {
       do
         {
@@ -355,14 +363,14 @@ float gasdev(long *idum)
         }
       while(rsq >= 1.0 || rsq == 0.0);
       fac = sqrt(-2.0 * log(rsq) / rsq);
-      gset = v1 * fac;
-      iset = 1;
+      gasdev_gset = v1 * fac;
+      gasdev_iset = 1;
       return v2 * fac;
     }
   else
     {
-      iset = 0;
-      return gset;
+      gasdev_iset = 0;
+      return gasdev_gset;
     }
 }
 
@@ -370,11 +378,9 @@ float ran1(long *idum)
 {
   int j;
   long k;
-  static long iy = 0;
-  static long iv[NTAB];
   float temp;
 
-  if(*idum <= 0 || !iy)
+  if(*idum <= 0 || !ran1_iy)
     {
       if(-(*idum) < 1)
         *idum = 1;
@@ -387,23 +393,33 @@ float ran1(long *idum)
           if(*idum < 0)
             *idum += IM;
           if(j < NTAB)
-            iv[j] = *idum;
+            ran1_iv[j] = *idum;
         }
-      iy = iv[0];
+      ran1_iy = ran1_iv[0];
     }
   k = (*idum) / IQ;
   *idum = IA * (*idum - k * IQ) - IR * k;
   if(*idum < 0)
     *idum += IM;
-  j = iy / NDIV;
-  iy = iv[j];
-  iv[j] = *idum;
-  if((temp = AM * iy) > RNMX)
+  j = ran1_iy / NDIV;
+  ran1_iy = ran1_iv[j];
+  ran1_iv[j] = *idum;
+  if((temp = AM * ran1_iy) > RNMX)
     return RNMX;
   else
     return temp;
 }
 
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+/** @brief restarts the sequence of random inclinations used by the
+ *         dust model from a given (negative) seed. */
+void seed_dust_inclinations(long seed)
+{
+  mu_seed = seed;
+  gasdev_iset = 0;
+}
+#endif
+
 #undef IA
 #undef IM
 #undef AM
@@ -33,9 +33,9 @@ using namespace std;
  *       into account.
  */
 
-double infall_recipe(int centralgal, int ngal, double Zcurr)
+double infall_recipe(int centralgal, int ngal)
 {
-  int i;
+  int i, snapnum;
   double tot_mass, reionization_modifier, infallingMass;
   double dis;
 
@@ -43,12 +43,13 @@ double infall_recipe(int centralgal, int ngal, double Zcurr)
    *  what baryonic fraction is missing/in excess. That will give the mass of gas
    *  that need to be added/subtracted to the hot phase, gas that infalled.*/
   tot_mass = 0.0;
+  snapnum = Halo[Gal[centralgal].HaloNr].SnapNum;
 
   for(i = 0; i < ngal; i++)
     {                           /* Loop over all galaxies in the FoF-halo */
 
       /* dis is the separation of the galaxy which i orbits from the type 0 */
-      dis = separation_gal(centralgal, Gal[i].CentralGal) / (1 + ZZ[Halo[Gal[centralgal].HaloNr].SnapNum]);
+      dis = separation_gal(centralgal, Gal[i].CentralGal) / (1 + ZZ[snapnum]);
 
       /* If galaxy is orbiting a galaxy inside Rvir of the type 0 it will contribute
        * to the baryon sum */
@@ -77,7 +78,7 @@ double infall_recipe(int centralgal, int ngal, double Zcurr)
   if(ReionizationModel == 2)
     reionization_modifier = 1.0;
   else
-    reionization_modifier = do_reionization(Gal[centralgal].Mvir, Zcurr);
+    reionization_modifier = do_reionization(Gal[centralgal].Mvir, SnapFactors[snapnum].ReionMass);
 
   infallingMass = reionization_modifier * BaryonFrac * Gal[centralgal].Mvir - tot_mass;
 
@@ -85,9 +86,15 @@ double infall_recipe(int centralgal, int ngal, double Zcurr)
 
 }
 
-double do_reionization(float Mvir, double Zcurr)
+/**@brief Characteristic mass of the reionization modifier at redshift Zcurr.
+ *
+ * Depends only on the redshift, so it is tabulated once per snapshot by
+ * init_snapshot_factors() and read back by do_reionization(). For
+ * ReionizationModel 0 it is the Okamoto et al. (2008) Mc, for model 1 the
+ * larger of the filtering mass and the mass of a 10^4K halo. */
+double reionization_mass(double Zcurr)
 {
-  double modifier, a, alpha;
+  double a, alpha;
 
   //Gnedin (2000)
   double f_of_a, a_on_a0, a_on_ar, Mfiltering, Mjeans, Mchar, mass_to_use;
@@ -98,14 +105,9 @@ double do_reionization(float Mvir, double Zcurr)
   int tabindex;
   double f1, f2;
 
-  modifier = 1.;
+  mass_to_use = 0.;
 
-  if(ReionizationModel == 2)
-    {
-      printf("Should not be called with this option\n");
-      exit(0);
-    }
-  else if(ReionizationModel == 0)
+  if(ReionizationModel == 0)
     {
       /* reionization recipie described in Gnedin (2000), with the fitting
        * from Okamoto et al. 2008 -> Qi(2010)*/
@@ -129,7 +131,7 @@ double do_reionization(float Mvir, double Zcurr)
       Mc = f1 * log10(Reion_Mc[tabindex]) + f2 * log10(Reion_Mc[tabindex + 1]);
       Mc = pow(10, Mc - 10);
 
-      modifier = pow(1 + (pow(2, alpha / 3.) - 1) * pow(Mc / Mvir, alpha), -3. / alpha);
+      mass_to_use = Mc;
     }
   else if(ReionizationModel == 1)
     {
@@ -178,9 +180,35 @@ double do_reionization(float Mvir, double Zcurr)
 
       /*  we use the maximum of Mfiltering and Mchar */
       mass_to_use = max(Mfiltering, Mchar);
-      modifier = 1.0 / pow3(1.0 + 0.26 * (mass_to_use / Mvir));
     }
 
+  return mass_to_use;
+
+}
+
+
+/**@brief Fraction of the baryons that can collapse into a halo of mass Mvir
+ *        after reionization, given the characteristic mass Mchar tabulated
+ *        for the current snapshot in SnapFactors[].ReionMass. */
+double do_reionization(float Mvir, double Mchar)
+{
+  double modifier, alpha;
+
+  modifier = 1.;
+
+  if(ReionizationModel == 2)
+    {
+      printf("Should not be called with this option\n");
+      exit(0);
+    }
+  else if(ReionizationModel == 0)
+    {
+      alpha = 2.0;
+      modifier = pow(1 + (pow(2, alpha / 3.) - 1) * pow(Mchar / Mvir, alpha), -3. / alpha);
+    }
+  else if(ReionizationModel == 1)
+    modifier = 1.0 / pow3(1.0 + 0.26 * (Mchar / Mvir));
+
   return modifier;
 
 }
@@ -475,20 +475,20 @@ void add_galaxies_together(int t, int p)
   Gal[t].MergeSat += (Gal[p].DiskMass + Gal[p].BulgeMass);
   Gal[p].MergeSat = 0.;
 
-  transfer_gas(t, "Cold", p, "Cold", 1., "add_galaxies_together", __LINE__);
+  transfer_gas < GAS_COLD, GAS_COLD > (t, p, 1., "add_galaxies_together", __LINE__);
   //transfer_gas(t,"Ejected",p,"Cold",1.,"add_galaxies_together", __LINE__);
-  transfer_gas(t, "Hot", p, "Hot", 1., "add_galaxies_together", __LINE__);
-  transfer_gas(t, "Ejected", p, "Ejected", 1., "add_galaxies_together", __LINE__);
+  transfer_gas < GAS_HOT, GAS_HOT > (t, p, 1., "add_galaxies_together", __LINE__);
+  transfer_gas < GAS_EJECTED, GAS_EJECTED > (t, p, 1., "add_galaxies_together", __LINE__);
 #ifdef TRACK_BURST
   /* The whole burst component gets transferred */
-  transfer_stars(t, "Burst", p, "Burst", 1.);
+  transfer_stars < STARS_BURST, STARS_BURST > (t, p, 1.);
 #endif
   if(BulgeFormationInMinorMergersOn)
-    transfer_stars(t, "Bulge", p, "Disk", 1.);
+    transfer_stars < STARS_BULGE, STARS_DISK > (t, p, 1.);
   else
-    transfer_stars(t, "Disk", p, "Disk", 1.);
-  transfer_stars(t, "Bulge", p, "Bulge", 1.);
-  transfer_stars(t, "ICM", p, "ICM", 1.);
+    transfer_stars < STARS_DISK, STARS_DISK > (t, p, 1.);
+  transfer_stars < STARS_BULGE, STARS_BULGE > (t, p, 1.);
+  transfer_stars < STARS_ICM, STARS_ICM > (t, p, 1.);
 
   Gal[t].BlackHoleMass += Gal[p].BlackHoleMass;
   Gal[p].BlackHoleMass = 0.;
@@ -525,26 +525,26 @@ void add_galaxies_together(int t, int p)
 
       for(j = 0; j < NMAG; j++)
         {
-          Gal[t].Lum[j][outputbin] += Gal[p].Lum[j][outputbin];
-          Gal[t].YLum[j][outputbin] += Gal[p].YLum[j][outputbin];
+          GALLUM(Gal[t]).Lum[j][outputbin] += GALLUM(Gal[p]).Lum[j][outputbin];
+          GALLUM(Gal[t]).YLum[j][outputbin] += GALLUM(Gal[p]).YLum[j][outputbin];
 #ifdef ICL
-          Gal[t].ICLLum[j][outputbin] += Gal[p].ICLLum[j][outputbin];
+          GALLUM(Gal[t]).ICLLum[j][outputbin] += GALLUM(Gal[p]).ICLLum[j][outputbin];
 #endif
         }
       if(BulgeFormationInMinorMergersOn)
         {
           for(j = 0; j < NMAG; j++)
             {
-              Gal[t].LumBulge[j][outputbin] += Gal[p].Lum[j][outputbin];
-              Gal[t].YLumBulge[j][outputbin] += Gal[p].YLum[j][outputbin];
+              GALLUM(Gal[t]).LumBulge[j][outputbin] += GALLUM(Gal[p]).Lum[j][outputbin];
+              GALLUM(Gal[t]).YLumBulge[j][outputbin] += GALLUM(Gal[p]).YLum[j][outputbin];
             }
         }
       else
         {
           for(j = 0; j < NMAG; j++)
             {
-              Gal[t].LumBulge[j][outputbin] += Gal[p].LumBulge[j][outputbin];
-              Gal[t].YLumBulge[j][outputbin] += Gal[p].YLumBulge[j][outputbin];
+              GALLUM(Gal[t]).LumBulge[j][outputbin] += GALLUM(Gal[p]).LumBulge[j][outputbin];
+              GALLUM(Gal[t]).YLumBulge[j][outputbin] += GALLUM(Gal[p]).YLumBulge[j][outputbin];
             }
         }
     }
@@ -555,17 +555,17 @@ void add_galaxies_together(int t, int p)
     {
       for(j = 0; j < NMAG; j++)
         {
-          Gal[t].ObsLum[j][outputbin] += Gal[p].ObsLum[j][outputbin];
-          Gal[t].ObsYLum[j][outputbin] += Gal[p].ObsYLum[j][outputbin];
+          GALLUM(Gal[t]).ObsLum[j][outputbin] += GALLUM(Gal[p]).ObsLum[j][outputbin];
+          GALLUM(Gal[t]).ObsYLum[j][outputbin] += GALLUM(Gal[p]).ObsYLum[j][outputbin];
 #ifdef ICL
-          Gal[t].ObsICL[j][outputbin] += Gal[p].ObsICL[j][outputbin];
+          GALLUM(Gal[t]).ObsICL[j][outputbin] += GALLUM(Gal[p]).ObsICL[j][outputbin];
 #endif
 
 #ifdef OUTPUT_MOMAF_INPUTS
-          Gal[t].dObsLum[j][outputbin] += Gal[p].dObsLum[j][outputbin];
-          Gal[t].dObsYLum[j][outputbin] += Gal[p].dObsYLum[j][outputbin];
+          GALLUM(Gal[t]).dObsLum[j][outputbin] += GALLUM(Gal[p]).dObsLum[j][outputbin];
+          GALLUM(Gal[t]).dObsYLum[j][outputbin] += GALLUM(Gal[p]).dObsYLum[j][outputbin];
 #ifdef ICL
-          Gal[t].dObsICL[j][outputbin] += Gal[p].dObsICL[j][outputbin];
+          GALLUM(Gal[t]).dObsICL[j][outputbin] += GALLUM(Gal[p]).dObsICL[j][outputbin];
 #endif
 #endif
         }
@@ -573,11 +573,11 @@ void add_galaxies_together(int t, int p)
         {
           for(j = 0; j < NMAG; j++)
             {
-              Gal[t].ObsLumBulge[j][outputbin] += Gal[p].ObsLum[j][outputbin];
-              Gal[t].ObsYLumBulge[j][outputbin] += Gal[p].ObsYLum[j][outputbin];
+              GALLUM(Gal[t]).ObsLumBulge[j][outputbin] += GALLUM(Gal[p]).ObsLum[j][outputbin];
+              GALLUM(Gal[t]).ObsYLumBulge[j][outputbin] += GALLUM(Gal[p]).ObsYLum[j][outputbin];
 #ifdef OUTPUT_MOMAF_INPUTS
-              Gal[t].dObsLumBulge[j][outputbin] += Gal[p].dObsLum[j][outputbin];
-              Gal[t].dObsYLumBulge[j][outputbin] += Gal[p].dObsYLum[j][outputbin];
+              GALLUM(Gal[t]).dObsLumBulge[j][outputbin] += GALLUM(Gal[p]).dObsLum[j][outputbin];
+              GALLUM(Gal[t]).dObsYLumBulge[j][outputbin] += GALLUM(Gal[p]).dObsYLum[j][outputbin];
 #endif
             }
         }
@@ -585,11 +585,11 @@ void add_galaxies_together(int t, int p)
         {
           for(j = 0; j < NMAG; j++)
             {
-              Gal[t].ObsLumBulge[j][outputbin] += Gal[p].ObsLumBulge[j][outputbin];
-              Gal[t].ObsYLumBulge[j][outputbin] += Gal[p].ObsYLumBulge[j][outputbin];
+              GALLUM(Gal[t]).ObsLumBulge[j][outputbin] += GALLUM(Gal[p]).ObsLumBulge[j][outputbin];
+              GALLUM(Gal[t]).ObsYLumBulge[j][outputbin] += GALLUM(Gal[p]).ObsYLumBulge[j][outputbin];
 #ifdef OUTPUT_MOMAF_INPUTS
-              Gal[t].dObsLumBulge[j][outputbin] += Gal[p].dObsLumBulge[j][outputbin];
-              Gal[t].dObsYLumBulge[j][outputbin] += Gal[p].dObsYLumBulge[j][outputbin];
+              GALLUM(Gal[t]).dObsLumBulge[j][outputbin] += GALLUM(Gal[p]).dObsLumBulge[j][outputbin];
+              GALLUM(Gal[t]).dObsYLumBulge[j][outputbin] += GALLUM(Gal[p]).dObsYLumBulge[j][outputbin];
 #endif
             }
         }
@@ -608,7 +608,7 @@ void make_bulge_from_burst(int p)
   int outputbin;
 
   /* generate bulge */
-  transfer_stars(p, "Bulge", p, "Disk", 1.);
+  transfer_stars < STARS_BULGE, STARS_DISK > (p, p, 1.);
 
   /*  update the star formation rate */
   Gal[p].SfrBulge = Gal[p].Sfr;
@@ -621,8 +621,8 @@ void make_bulge_from_burst(int p)
     {
       for(j = 0; j < NMAG; j++)
         {
-          Gal[p].LumBulge[j][outputbin] = Gal[p].Lum[j][outputbin];
-          Gal[p].YLumBulge[j][outputbin] = Gal[p].YLum[j][outputbin];
+          GALLUM(Gal[p]).LumBulge[j][outputbin] = GALLUM(Gal[p]).Lum[j][outputbin];
+          GALLUM(Gal[p]).YLumBulge[j][outputbin] = GALLUM(Gal[p]).YLum[j][outputbin];
         }
     }
 #endif
@@ -631,11 +631,11 @@ void make_bulge_from_burst(int p)
     {
       for(j = 0; j < NMAG; j++)
         {
-          Gal[p].ObsLumBulge[j][outputbin] = Gal[p].ObsLum[j][outputbin];
-          Gal[p].ObsYLumBulge[j][outputbin] = Gal[p].ObsYLum[j][outputbin];
+          GALLUM(Gal[p]).ObsLumBulge[j][outputbin] = GALLUM(Gal[p]).ObsLum[j][outputbin];
+          GALLUM(Gal[p]).ObsYLumBulge[j][outputbin] = GALLUM(Gal[p]).ObsYLum[j][outputbin];
 #ifdef OUTPUT_MOMAF_INPUTS
-          Gal[p].dObsLumBulge[j][outputbin] = Gal[p].dObsLum[j][outputbin];
-          Gal[p].dObsYLumBulge[j][outputbin] = Gal[p].dObsYLum[j][outputbin];
+          GALLUM(Gal[p]).dObsLumBulge[j][outputbin] = GALLUM(Gal[p]).dObsLum[j][outputbin];
+          GALLUM(Gal[p]).dObsYLumBulge[j][outputbin] = GALLUM(Gal[p]).dObsYLum[j][outputbin];
 #endif
         }
     }
@@ -180,6 +180,109 @@ double get_initial_disk_radius(int halonr, int p)
 }
 
 
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+/** @brief Takes a photometry record from the GalLum pool, growing the pool
+ *         when its free stack is empty, and returns its index with all
+ *         luminosities set to zero. Growing may move GalLum, so callers
+ *         must not hold pointers into it across this call. */
+int new_galaxy_lum(void)
+{
+  int i, oldmax;
+
+  if(NGalLumFree == 0)
+    {
+      oldmax = MaxGalLum;
+      MaxGalLum = ALLOC_INCREASE_FACTOR * MaxGalLum + 1;
+      GalLum = static_cast < GALAXY_LUM * >(myrealloc_movable(GalLum, sizeof(struct GALAXY_LUM) * MaxGalLum));
+      GalLumFree = static_cast < int *>(myrealloc_movable(GalLumFree, sizeof(int) * MaxGalLum));
+
+      for(i = MaxGalLum - 1; i >= oldmax; i--)
+        GalLumFree[NGalLumFree++] = i;
+    }
+
+  i = GalLumFree[--NGalLumFree];
+  memset(&GalLum[i], 0, sizeof(struct GALAXY_LUM));
+
+  return i;
+}
+
+/** @brief Returns a photometry record to the GalLum pool. */
+void free_galaxy_lum(int i)
+{
+  if(i < 0)
+    return;
+
+  GalLumFree[NGalLumFree++] = i;
+}
+
+/** @brief Called when a descendant takes over the photometry record i of a
+ *         progenitor at snapshot snapnum. The progenitor is only written out
+ *         after the descendant has been evolved, so it gets a new record
+ *         holding the output columns it will be saved with (all of them
+ *         under MCMC), or -1 if it is not saved at this snapshot. */
+int copy_galaxy_lum_for_output(int i, int snapnum)
+{
+  int j, k, n;
+
+#ifndef MCMC
+  for(n = 0; n < NOUT; n++)
+    if(ListOutputSnaps[n] == snapnum)
+      break;
+  if(n == NOUT)
+    return -1;
+#endif
+
+  j = new_galaxy_lum();
+
+#ifdef MCMC
+  GalLum[j] = GalLum[i];
+#else
+#define COPY_LUM_COLUMN(field) GalLum[j].field[k][n] = GalLum[i].field[k][n]
+  for(; n < NOUT; n++)
+    if(ListOutputSnaps[n] == snapnum)
+      for(k = 0; k < NMAG; k++)
+        {
+#ifdef OUTPUT_REST_MAGS
+          COPY_LUM_COLUMN(Lum);
+          COPY_LUM_COLUMN(YLum);
+          COPY_LUM_COLUMN(LumBulge);
+          COPY_LUM_COLUMN(YLumBulge);
+          COPY_LUM_COLUMN(LumDust);
+#ifdef ICL
+          COPY_LUM_COLUMN(ICLLum);
+#endif
+#endif
+#ifdef COMPUTE_OBS_MAGS
+          COPY_LUM_COLUMN(ObsLum);
+          COPY_LUM_COLUMN(ObsYLum);
+          COPY_LUM_COLUMN(ObsLumBulge);
+          COPY_LUM_COLUMN(ObsYLumBulge);
+          COPY_LUM_COLUMN(ObsLumDust);
+#ifdef ICL
+          COPY_LUM_COLUMN(ObsICL);
+#endif
+#ifdef OUTPUT_MOMAF_INPUTS
+          COPY_LUM_COLUMN(dObsLum);
+          COPY_LUM_COLUMN(dObsYLum);
+          COPY_LUM_COLUMN(dObsLumBulge);
+          COPY_LUM_COLUMN(dObsYLumBulge);
+          COPY_LUM_COLUMN(dObsLumDust);
+#ifdef ICL
+          COPY_LUM_COLUMN(dObsICL);
+#endif
+#endif
+#endif
+        }
+#undef COPY_LUM_COLUMN
+#endif
+
+  return j;
+}
+#endif //POST_PROCESS_MAGS
+#endif //COMPUTE_SPECPHOT_PROPERTIES
+
+
 
 /** @brief Initializes the Galaxy Structure by setting all its
  *         elements to zero. */
@@ -305,51 +408,12 @@ void init_galaxy(int p, int halonr)
   for(outputbin = 0; outputbin < NOUT; outputbin++)
     Gal[p].MassWeightAge[outputbin] = 0.0;
 
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
 #ifndef  POST_PROCESS_MAGS
-#ifdef OUTPUT_REST_MAGS
-  for(outputbin = 0; outputbin < NOUT; outputbin++)
-    {
-      for(j = 0; j < NMAG; j++)
-        {
-          Gal[p].Lum[j][outputbin] = 0.0;
-          Gal[p].YLum[j][outputbin] = 0.0;
-          Gal[p].LumBulge[j][outputbin] = 0.0;
-          Gal[p].YLumBulge[j][outputbin] = 0.0;
-          Gal[p].LumDust[j][outputbin] = 0.0;
-#ifdef ICL
-          Gal[p].ICLLum[j][outputbin] = 0.0;
+  /* luminosities start from a zeroed record in GalLum */
+  Gal[p].LumIndex = new_galaxy_lum();
 #endif
-        }
-    }
 #endif
-#ifdef COMPUTE_OBS_MAGS
-  for(outputbin = 0; outputbin < NOUT; outputbin++)
-    {
-      for(j = 0; j < NMAG; j++)
-        {
-          Gal[p].ObsLum[j][outputbin] = 0.0;
-          Gal[p].ObsYLum[j][outputbin] = 0.0;
-          Gal[p].ObsLumBulge[j][outputbin] = 0.0;
-          Gal[p].ObsYLumBulge[j][outputbin] = 0.0;
-          Gal[p].ObsLumDust[j][outputbin] = 0.0;
-#ifdef ICL
-          Gal[p].ObsICL[j][outputbin] = 0.0;
-#endif
-
-#ifdef OUTPUT_MOMAF_INPUTS
-          Gal[p].dObsLum[j][outputbin] = 0.0;
-          Gal[p].dObsYLum[j][outputbin] = 0.0;
-          Gal[p].dObsLumBulge[j][outputbin] = 0.0;
-          Gal[p].dObsYLumBulge[j][outputbin] = 0.0;
-          Gal[p].dObsLumDust[j][outputbin] = 0.0;
-#ifdef ICL
-          Gal[p].dObsICL[j][outputbin] = 0.0;
-#endif
-#endif
-        }
-    }
-#endif
-#endif //POST_PROCESS_MAGS
 
 #ifdef GALAXYTREE
   Gal[p].FirstProgGal = -1;
@@ -396,13 +460,39 @@ void init_galaxy(int p, int halonr)
   * */
 #ifdef COMPUTE_SPECPHOT_PROPERTIES
 #ifndef  POST_PROCESS_MAGS
+#ifdef LUMTABLES_BANDS_INNERMOST
+/**@brief Interpolates between the four SSP table entries around (metindex,
+ *        tabindex) for all bands at once: lo and hi point to the bands of
+ *        ages tabindex and tabindex+1 at metallicities metindex and
+ *        metindex+1. Same arithmetic as the loop over bands it replaces. */
+static void interpolate_lum_all_bands(double X1, double f1, double f2, double fmet1, double fmet2,
+                                      const float *__restrict lo, const float *__restrict hi,
+                                      double *__restrict lum)
+{
+  int j;
+
+  for(j = 0; j < NMAG_PADDED; j++)
+    lum[j] = X1 * (fmet1 * (f1 * lo[j] + f2 * lo[NMAG_PADDED + j]) +
+                   fmet2 * (f1 * hi[j] + f2 * hi[NMAG_PADDED + j]));
+}
+#endif
+
 void add_to_luminosities(int p, double mstars, double time, double dt, double metallicity)
 {
-  int outputbin, metindex, tabindex, j;
-  double f1, f2, fmet1, fmet2, LuminosityToAdd, dLuminosityToAdd;
+  int outputbin, metindex, tabindex, j, young;
+  double f1, f2, fmet1, fmet2;
   double X1, age, tbc;
   int N_AgeBins = 1, ii;
   double upper_time;
+  struct lum_age_weights *weights;
+#ifdef LUMTABLES_BANDS_INNERMOST
+  double lum[NMAG_PADDED];
+#ifdef OUTPUT_MOMAF_INPUTS
+  double dlum[NMAG_PADDED];
+#endif
+#else
+  double LuminosityToAdd, dLuminosityToAdd;
+#endif
 
   /* Time bellow which the luminosities are corrected for extinction due to
    * molecular birth clouds.  */
@@ -419,6 +509,12 @@ void add_to_luminosities(int p, double mstars, double time, double dt, double me
    * in terms of age and metallicity. Time gives the time_to_present for
    * the current step while NumToTime(ListOutputSnaps[outputbin]) gives
    * the time of the output snap - units Mpc/Km/s/h */
+  /* for the steps of evolve_galaxies() the age interpolation at each output
+   * time is tabulated, and only the metallicity has to be looked up */
+  weights = (N_AgeBins == 1) ? get_lum_age_weights(p, time, dt) : NULL;
+  if(weights)
+    find_interpolated_metallicity(metallicity, &metindex, &fmet1, &fmet2);
+
   upper_time = time + dt / 2.;
 
   //if one wants to have finner bins for the star formation then the STEPS
@@ -430,28 +526,49 @@ void add_to_luminosities(int p, double mstars, double time, double dt, double me
 #ifdef OUTPUT_REST_MAGS
       for(outputbin = 0; outputbin < NOUT; outputbin++)
         {
-          find_interpolated_lum(time, NumToTime(ListOutputSnaps[outputbin]), metallicity,
-                                &metindex, &tabindex, &f1, &f2, &fmet1, &fmet2);
+          if(weights)
+            {
+              tabindex = weights[outputbin].tabindex;
+              f1 = weights[outputbin].f1;
+              f2 = weights[outputbin].f2;
+              young = weights[outputbin].young;
+            }
+          else
+            {
+              find_interpolated_lum(time, NumToTime(ListOutputSnaps[outputbin]), metallicity,
+                                    &metindex, &tabindex, &f1, &f2, &fmet1, &fmet2);
+              age = time - NumToTime(ListOutputSnaps[outputbin]);
+              young = (age <= tbc);
+            }
 
           if(MetallicityOption == 0)
             metindex = 4;       // reset met index to use only solar metallicity
 
-          age = time - NumToTime(ListOutputSnaps[outputbin]);
           /* For rest-frame, there is no K-correction on magnitudes,
            * hence the 0 in LumTables[j][metindex][0][tabindex] */
+#ifdef LUMTABLES_BANDS_INNERMOST
+          interpolate_lum_all_bands(X1, f1, f2, fmet1, fmet2, LumTables[metindex][0][tabindex],
+                                    LumTables[metindex + 1][0][tabindex], lum);
+          for(j = 0; j < NMAG; j++)
+            GALLUM(Gal[p]).Lum[j][outputbin] += lum[j];
+          if(young)
+            for(j = 0; j < NMAG; j++)
+              GALLUM(Gal[p]).YLum[j][outputbin] += lum[j];
+#else
           for(j = 0; j < NMAG; j++)
             {
               //interpolation between the points found by find_interpolated_lum
-              LuminosityToAdd = X1 * (fmet1 * (f1 * LumTables[j][metindex][0][tabindex] +
-                                               f2 * LumTables[j][metindex][0][tabindex + 1]) +
-                                      fmet2 * (f1 * LumTables[j][metindex + 1][0][tabindex] +
-                                               f2 * LumTables[j][metindex + 1][0][tabindex + 1]));
-              Gal[p].Lum[j][outputbin] += LuminosityToAdd;
+              LuminosityToAdd = X1 * (fmet1 * (f1 * LUMTABLES(j, metindex, 0, tabindex) +
+                                               f2 * LUMTABLES(j, metindex, 0, tabindex + 1)) +
+                                      fmet2 * (f1 * LUMTABLES(j, metindex + 1, 0, tabindex) +
+                                               f2 * LUMTABLES(j, metindex + 1, 0, tabindex + 1)));
+              GALLUM(Gal[p]).Lum[j][outputbin] += LuminosityToAdd;
 
               /*luminosity used for extinction due to young birth clouds */
-              if(age <= tbc)
-                Gal[p].YLum[j][outputbin] += LuminosityToAdd;
+              if(young)
+                GALLUM(Gal[p]).YLum[j][outputbin] += LuminosityToAdd;
             }
+#endif
 
         }
 #endif //OUTPUT_REST_MAGS
@@ -459,45 +576,74 @@ void add_to_luminosities(int p, double mstars, double time, double dt, double me
 #ifdef COMPUTE_OBS_MAGS
       for(outputbin = 0; outputbin < NOUT; outputbin++)
         {
-          find_interpolated_lum(time, NumToTime(ListOutputSnaps[outputbin]), metallicity,
-                                &metindex, &tabindex, &f1, &f2, &fmet1, &fmet2);
+          if(weights)
+            {
+              tabindex = weights[outputbin].tabindex;
+              f1 = weights[outputbin].f1;
+              f2 = weights[outputbin].f2;
+              young = weights[outputbin].young;
+            }
+          else
+            {
+              find_interpolated_lum(time, NumToTime(ListOutputSnaps[outputbin]), metallicity,
+                                    &metindex, &tabindex, &f1, &f2, &fmet1, &fmet2);
+              age = time - NumToTime(ListOutputSnaps[outputbin]);
+              young = (age <= tbc);
+            }
 
           if(MetallicityOption == 0)
             metindex = 4;       // reset met index to use only solar metallicity
 
           int zindex = ((LastDarkMatterSnapShot + 1) - 1) - ListOutputSnaps[outputbin];
 
-          age = time - NumToTime(ListOutputSnaps[outputbin]);
-
           /* Note the zindex in LumTables[][][][] meaning the magnitudes are now
            * "inversely k-corrected to get observed frame at output bins" */
+#ifdef LUMTABLES_BANDS_INNERMOST
+          interpolate_lum_all_bands(X1, f1, f2, fmet1, fmet2, LumTables[metindex][zindex][tabindex],
+                                    LumTables[metindex + 1][zindex][tabindex], lum);
+          for(j = 0; j < NMAG; j++)
+            GALLUM(Gal[p]).ObsLum[j][outputbin] += lum[j];
+          if(young)
+            for(j = 0; j < NMAG; j++)
+              GALLUM(Gal[p]).ObsYLum[j][outputbin] += lum[j];
+#ifdef OUTPUT_MOMAF_INPUTS
+          interpolate_lum_all_bands(X1, f1, f2, fmet1, fmet2, LumTables[metindex][zindex + 1][tabindex],
+                                    LumTables[metindex + 1][zindex + 1][tabindex], dlum);
+          for(j = 0; j < NMAG; j++)
+            GALLUM(Gal[p]).dObsLum[j][outputbin] += dlum[j];
+          if(young)
+            for(j = 0; j < NMAG; j++)
+              GALLUM(Gal[p]).dObsYLum[j][outputbin] += dlum[j];
+#endif
+#else
           for(j = 0; j < NMAG; j++)
             {
               //interpolation between the points found by find_interpolated_lum
-              LuminosityToAdd = X1 * (fmet1 * (f1 * LumTables[j][metindex][zindex][tabindex] +
-                                               f2 * LumTables[j][metindex][zindex][tabindex + 1]) +
-                                      fmet2 * (f1 * LumTables[j][metindex + 1][zindex][tabindex] +
-                                               f2 * LumTables[j][metindex + 1][zindex][tabindex + 1]));
-              Gal[p].ObsLum[j][outputbin] += LuminosityToAdd;
+              LuminosityToAdd = X1 * (fmet1 * (f1 * LUMTABLES(j, metindex, zindex, tabindex) +
+                                               f2 * LUMTABLES(j, metindex, zindex, tabindex + 1)) +
+                                      fmet2 * (f1 * LUMTABLES(j, metindex + 1, zindex, tabindex) +
+                                               f2 * LUMTABLES(j, metindex + 1, zindex, tabindex + 1)));
+              GALLUM(Gal[p]).ObsLum[j][outputbin] += LuminosityToAdd;
 
 #ifdef OUTPUT_MOMAF_INPUTS
-              dLuminosityToAdd = X1 * (fmet1 * (f1 * LumTables[j][metindex][zindex + 1][tabindex] +
-                                                f2 * LumTables[j][metindex][zindex + 1][tabindex + 1]) +
-                                       fmet2 * (f1 * LumTables[j][metindex + 1][zindex + 1][tabindex] +
-                                                f2 * LumTables[j][metindex + 1][zindex + 1][tabindex + 1]));
-              Gal[p].dObsLum[j][outputbin] += dLuminosityToAdd;
+              dLuminosityToAdd = X1 * (fmet1 * (f1 * LUMTABLES(j, metindex, zindex + 1, tabindex) +
+                                                f2 * LUMTABLES(j, metindex, zindex + 1, tabindex + 1)) +
+                                       fmet2 * (f1 * LUMTABLES(j, metindex + 1, zindex + 1, tabindex) +
+                                                f2 * LUMTABLES(j, metindex + 1, zindex + 1, tabindex + 1)));
+              GALLUM(Gal[p]).dObsLum[j][outputbin] += dLuminosityToAdd;
 #endif
 
               /*luminosity used for extinction due to young birth clouds */
-              if(age <= tbc)
+              if(young)
                 {
-                  Gal[p].ObsYLum[j][outputbin] += LuminosityToAdd;
+                  GALLUM(Gal[p]).ObsYLum[j][outputbin] += LuminosityToAdd;
 #ifdef OUTPUT_MOMAF_INPUTS
-                  Gal[p].dObsYLum[j][outputbin] += dLuminosityToAdd;
+                  GALLUM(Gal[p]).dObsYLum[j][outputbin] += dLuminosityToAdd;
 #endif
                 }
 
             }
+#endif
         }
 #endif //COMPUTE_OBS_MAGS
 
@@ -521,10 +667,7 @@ double NumToTime(int num)
 
 double get_virial_mass(int halonr)
 {
-  if(halonr == Halo[halonr].FirstHaloInFOFgroup && Halo[halonr].M_Crit200)
-    return Halo[halonr].M_Crit200;      /* take spherical overdensity mass estimate */
-  else
-    return Halo[halonr].Len * PartMass;
+  return HaloAux[halonr].Mvir;
 }
 
 
@@ -535,19 +678,14 @@ double get_virial_mass(int halonr)
 
 double get_virial_velocity(int halonr)
 {
-  return sqrt(G * get_virial_mass(halonr) / get_virial_radius(halonr));
+  return HaloAux[halonr].Vvir;
 }
 
 
 double hubble_of_z(int halonr)
 {
-  double zplus1;
-
-  zplus1 = 1 + ZZ[Halo[halonr].SnapNum];
-
   /*get H for current z */
-  return Hubble * sqrt(Omega * zplus1 * zplus1 * zplus1 + (1 - Omega - OmegaLambda) * zplus1 * zplus1 +
-                       OmegaLambda);
+  return SnapFactors[Halo[halonr].SnapNum].HubbleZ;
 }
 
 /**@brief Calculates virial radius from a critical overdensity
@@ -557,17 +695,48 @@ double hubble_of_z(int halonr)
  *
  * From which, assuming \f$ \Delta_c=200\f$, *
  * \f$ R_{\rm{vir}}=\left( \frac{3M_{\rm{vir}}}{4\pi 200 \rho_c}\right)^{1/3}\f$
+ *
+ * The redshift-dependent factor \f$ 3/(4\pi 200 \rho_c)\f$ is tabulated
+ * per snapshot by init_snapshot_factors().
  */
 double get_virial_radius(int halonr)
 {
-  double hubble_z, rhocrit, fac;
+  return HaloAux[halonr].Rvir;
+}
 
-  /*get H for current z */
-  hubble_z = hubble_of_z(halonr);
 
-  rhocrit = 3 * hubble_z * hubble_z / (8 * M_PI * G);
-  fac = 1 / (200 * 4 * M_PI / 3.0 * rhocrit);
-  return pow(get_virial_mass(halonr) * fac, 1.0 / 3);
+/**@brief Computes the virial mass, radius and velocity of every halo of the
+ *        current tree into HaloAux, so that get_virial_mass(),
+ *        get_virial_radius() and get_virial_velocity() are plain lookups.
+ *        Called from SAM() once the tree has been loaded and scaled, and after
+ *        any change_dark_matter_sim(), so SnapFactors[] matches the tree; the
+ *        values live as long as HaloAux, i.e. until free_galaxies_and_tree().
+ *        Halos beyond the redshift list are never evolved and are set to 0. */
+void set_halo_virial_properties(int nhalos)
+{
+  int i;
+  double mass, radius;
+
+  for(i = 0; i < nhalos; i++)
+    {
+      /* SnapFactors[] only covers the snapshots of the redshift list */
+      if(Halo[i].SnapNum >= Zlistlen)
+        {
+          HaloAux[i].Mvir = HaloAux[i].Rvir = HaloAux[i].Vvir = 0.;
+          continue;
+        }
+
+      if(i == Halo[i].FirstHaloInFOFgroup && Halo[i].M_Crit200)
+        mass = Halo[i].M_Crit200;       /* take spherical overdensity mass estimate */
+      else
+        mass = Halo[i].Len * PartMass;
+
+      radius = pow(mass * SnapFactors[Halo[i].SnapNum].VirialRadiusFac, 1.0 / 3);
+
+      HaloAux[i].Mvir = mass;
+      HaloAux[i].Rvir = radius;
+      HaloAux[i].Vvir = sqrt(G * mass / radius);
+    }
 }
 
 
@@ -769,45 +938,14 @@ void update_type_2(int ngal, int halonr, int prog, int mostmassive)
     }
 }
 
-void transfer_stars(int p, const char cp[], int q, const char cq[], double fraction)
+/** @brief Sanity checks of transfer_stars<to, from>(), only called once one of
+ *         them has failed. */
+void transfer_stars_check(int p, int q, double fraction)
 {
-
-  /* Transfers a fraction of component cq of galaxy q onto component cp of galaxy p.
-   * cp and cq must each be one of:
-   *   Disk
-   *   Bulge
-   *   ICM
-   * If -DTRACK_BURST is set then can also specify BurstMass as an option.  This is
-   * a little different in that it is not a separate component, so it should only
-   * be transferred if both cq and cp are BurstMass
-   *
-   */
-
-  float Mass;
-
-#ifdef DETAILED_METALS_AND_MASS_RETURN
-  struct metals Metals;
-
-#ifdef INDIVIDUAL_ELEMENTS
-  struct elements Yield;
-  struct elements sfh_Elements[SFH_NBIN];
-#endif
-#else
-  float Metals;
-#endif //DETAILED_METALS_AND_MASS_RETURN
-
 #ifdef STAR_FORMATION_HISTORY
   int i;
-  float sfh_Mass[SFH_NBIN];
-
-#ifdef DETAILED_METALS_AND_MASS_RETURN
-  struct metals sfh_Metals[SFH_NBIN];
-#else
-  float sfh_Metals[SFH_NBIN];
-#endif
 #endif
 
-  /* Sanity checks */
   if(fraction > 1.)
     {
       printf("\n*** transfer_stars: fraction>1 ***\n");
@@ -824,403 +962,179 @@ void transfer_stars(int p, const char cp[], int q, const char cq[], double fract
       exit(1);
     }
 #endif
-#ifdef TRACK_BURST
-  if((strcmp(cp, "BurstMass") == 0 && !strcmp(cq, "BurstMass") == 0) ||
-     (strcmp(cq, "BurstMass") == 0 && !strcmp(cp, "BurstMass") == 0))
-    {
-      printf("\n*** transfer_stars: used incorrectly with BurstMass ***\n");
-      exit(1);
-    }
-#endif
+}
 
-  //Mass and metals to be transfered
-  if(strcmp(cq, "Disk") == 0)
-    {
-      Mass = fraction * Gal[q].DiskMass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        sfh_Mass[i] = fraction * Gal[q].sfh_DiskMass[i];
-#endif
-      Metals = metals_add(metals_init(), Gal[q].MetalsDiskMass, fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-      Yield = elements_add(elements_init(), Gal[q].DiskMass_elements, fraction);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        {
-          sfh_Metals[i] = metals_add(metals_init(), Gal[q].sfh_MetalsDiskMass[i], fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-          sfh_Elements[i] = elements_add(elements_init(), Gal[q].sfh_ElementsDiskMass[i], fraction);
-#endif
-        }
-#endif
-    }
-  else if(strcmp(cq, "Bulge") == 0)
-    {
-      Mass = fraction * Gal[q].BulgeMass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        sfh_Mass[i] = fraction * Gal[q].sfh_BulgeMass[i];
-#endif
-      Metals = metals_add(metals_init(), Gal[q].MetalsBulgeMass, fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-      Yield = elements_add(elements_init(), Gal[q].BulgeMass_elements, fraction);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        {
-          sfh_Metals[i] = metals_add(metals_init(), Gal[q].sfh_MetalsBulgeMass[i], fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-          sfh_Elements[i] = elements_add(elements_init(), Gal[q].sfh_ElementsBulgeMass[i], fraction);
-#endif
-        }
-#endif
-    }
-  else if(strcmp(cq, "ICM") == 0)
-    {
-      Mass = fraction * Gal[q].ICM;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        sfh_Mass[i] = fraction * Gal[q].sfh_ICM[i];
-#endif
-      Metals = metals_add(metals_init(), Gal[q].MetalsICM, fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-      Yield = elements_add(elements_init(), Gal[q].ICM_elements, fraction);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        {
-          sfh_Metals[i] = metals_add(metals_init(), Gal[q].sfh_MetalsICM[i], fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-          sfh_Elements[i] = elements_add(elements_init(), Gal[q].sfh_ElementsICM[i], fraction);
-#endif
-        }
-#endif
+
+static int star_component_from_name(const char c[])
+{
+  if(strcmp(c, "Disk") == 0)
+    return STARS_DISK;
+  if(strcmp(c, "Bulge") == 0)
+    return STARS_BULGE;
+  if(strcmp(c, "ICM") == 0)
+    return STARS_ICM;
 #ifdef TRACK_BURST
-    }
-  else if(strcmp(cq, "Burst") == 0)
-    {
-      Mass = fraction * Gal[q].BurstMass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        sfh_Mass[i] = fraction * Gal[q].sfh_BurstMass[i];
+  if(strcmp(c, "Burst") == 0)
+    return STARS_BURST;
 #endif
-#endif
-    }
-  else
-    {
-      printf("Unknown component type %s in call to transfer_stars\n", cq);
-      exit(1);
-    }
+  printf("Unknown component type %s in call to transfer_stars\n", c);
+  exit(1);
+}
 
-  //Add to galaxy p
-  if(strcmp(cp, "Disk") == 0)
-    {
-      Gal[p].DiskMass += Mass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[p].sfh_ibin; i++)
-        Gal[p].sfh_DiskMass[i] += sfh_Mass[i];
-#endif
-      Gal[p].MetalsDiskMass = metals_add(Gal[p].MetalsDiskMass, Metals, 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[p].DiskMass_elements = elements_add(Gal[p].DiskMass_elements, Yield, 1.);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[p].sfh_ibin; i++)
-        {
-          Gal[p].sfh_MetalsDiskMass[i] = metals_add(Gal[p].sfh_MetalsDiskMass[i], sfh_Metals[i], 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-          Gal[p].sfh_ElementsDiskMass[i] = elements_add(Gal[p].sfh_ElementsDiskMass[i], sfh_Elements[i], 1.);
-#endif
-        }
-#endif
-    }
-  else if(strcmp(cp, "Bulge") == 0)
-    {
-      Gal[p].BulgeMass += Mass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[p].sfh_ibin; i++)
-        Gal[p].sfh_BulgeMass[i] += sfh_Mass[i];
-#endif
-      Gal[p].MetalsBulgeMass = metals_add(Gal[p].MetalsBulgeMass, Metals, 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[p].BulgeMass_elements = elements_add(Gal[p].BulgeMass_elements, Yield, 1.);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[p].sfh_ibin; i++)
-        {
-          Gal[p].sfh_MetalsBulgeMass[i] = metals_add(Gal[p].sfh_MetalsBulgeMass[i], sfh_Metals[i], 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-          Gal[p].sfh_ElementsBulgeMass[i] =
-            elements_add(Gal[p].sfh_ElementsBulgeMass[i], sfh_Elements[i], 1.);
-#endif
-        }
-#endif
+template < star_component to >
+static void transfer_stars_to(int p, int q, int cq, double fraction)
+{
+  switch (cq)
+    {
+    case STARS_DISK:
+      transfer_stars < to, STARS_DISK > (p, q, fraction);
+      break;
+    case STARS_BULGE:
+      transfer_stars < to, STARS_BULGE > (p, q, fraction);
+      break;
+    case STARS_ICM:
+      transfer_stars < to, STARS_ICM > (p, q, fraction);
+      break;
     }
-  else if(strcmp(cp, "ICM") == 0)
-    {
-      Gal[p].ICM += Mass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[p].sfh_ibin; i++)
-        Gal[p].sfh_ICM[i] += sfh_Mass[i];
-#endif
-      Gal[p].MetalsICM = metals_add(Gal[p].MetalsICM, Metals, 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[p].ICM_elements = elements_add(Gal[p].ICM_elements, Yield, 1.);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[p].sfh_ibin; i++)
-        {
-          Gal[p].sfh_MetalsICM[i] = metals_add(Gal[p].sfh_MetalsICM[i], sfh_Metals[i], 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-          Gal[p].sfh_ElementsICM[i] = elements_add(Gal[p].sfh_ElementsICM[i], sfh_Elements[i], 1.);
-#endif
-        }
-#endif
+}
+
+/** @brief String interface to transfer_stars<to, from>(), kept for code that
+ *         still names the components: "Disk", "Bulge", "ICM" and, with
+ *         TRACK_BURST, "Burst" (which can only be moved onto "Burst"). */
+void transfer_stars(int p, const char cp[], int q, const char cq[], double fraction)
+{
+  int to = star_component_from_name(cp);
+  int from = star_component_from_name(cq);
+
 #ifdef TRACK_BURST
-    }
-  else if(strcmp(cp, "Burst") == 0)
+  if((to == STARS_BURST) != (from == STARS_BURST))
     {
-      Gal[p].BurstMass += Mass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[p].sfh_ibin; i++)
-        Gal[p].sfh_BurstMass[i] += sfh_Mass[i];
-#endif
-#endif
-    }
-  else
-    {
-      printf("Unknown component type %s in call to transfer_stars\n", cp);
+      printf("\n*** transfer_stars: used incorrectly with BurstMass ***\n");
       exit(1);
     }
-
-  //Subtract from galaxy q; 
-  if(strcmp(cq, "Disk") == 0)
-    {
-      Gal[q].DiskMass -= Mass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        Gal[q].sfh_DiskMass[i] -= sfh_Mass[i];
-#endif
-      Gal[q].MetalsDiskMass = metals_add(Gal[q].MetalsDiskMass, Metals, -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[q].DiskMass_elements = elements_add(Gal[q].DiskMass_elements, Yield, -1.);
 #endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        {
-          Gal[q].sfh_MetalsDiskMass[i] = metals_add(Gal[q].sfh_MetalsDiskMass[i], sfh_Metals[i], -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-          Gal[q].sfh_ElementsDiskMass[i] = elements_add(Gal[q].sfh_ElementsDiskMass[i], sfh_Elements[i], -1.);
-#endif
-        }
-#endif
-    }
-  else if(strcmp(cq, "Bulge") == 0)
-    {
-      Gal[q].BulgeMass -= Mass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        Gal[q].sfh_BulgeMass[i] -= sfh_Mass[i];
-#endif
-      Gal[q].MetalsBulgeMass = metals_add(Gal[q].MetalsBulgeMass, Metals, -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[q].BulgeMass_elements = elements_add(Gal[q].BulgeMass_elements, Yield, -1.);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        {
-          Gal[q].sfh_MetalsBulgeMass[i] = metals_add(Gal[q].sfh_MetalsBulgeMass[i], sfh_Metals[i], -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-          Gal[q].sfh_ElementsBulgeMass[i] =
-            elements_add(Gal[q].sfh_ElementsBulgeMass[i], sfh_Elements[i], -1.);
-#endif
-        }
-#endif
-    }
-  else if(strcmp(cq, "ICM") == 0)
+
+  switch (to)
     {
-      Gal[q].ICM -= Mass;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        Gal[q].sfh_ICM[i] -= sfh_Mass[i];
-#endif
-      Gal[q].MetalsICM = metals_add(Gal[q].MetalsICM, Metals, -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[q].ICM_elements = elements_add(Gal[q].ICM_elements, Yield, -1.);
-#endif
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        {
-          Gal[q].sfh_MetalsICM[i] = metals_add(Gal[q].sfh_MetalsICM[i], sfh_Metals[i], -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-          Gal[q].sfh_ElementsICM[i] = elements_add(Gal[q].sfh_ElementsICM[i], sfh_Elements[i], -1.);
-#endif
-        }
-#endif
+    case STARS_DISK:
+      transfer_stars_to < STARS_DISK > (p, q, from, fraction);
+      break;
+    case STARS_BULGE:
+      transfer_stars_to < STARS_BULGE > (p, q, from, fraction);
+      break;
+    case STARS_ICM:
+      transfer_stars_to < STARS_ICM > (p, q, from, fraction);
+      break;
 #ifdef TRACK_BURST
-    }
-  else if(strcmp(cq, "Burst") == 0)
-    {
-      Gal[q].BurstMass -= 0.;
-#ifdef STAR_FORMATION_HISTORY
-      for(i = 0; i <= Gal[q].sfh_ibin; i++)
-        Gal[q].sfh_BurstMass[i] -= sfh_Mass[i];
-#endif
+    case STARS_BURST:
+      transfer_stars < STARS_BURST, STARS_BURST > (p, q, fraction);
+      break;
 #endif
     }
-  else
-    {
-      printf("Unknown component type %s in call to transfer_stars\n", cq);
-      exit(1);
-    }
+}
 
-  return;
+
+static int gas_component_from_name(const char c[])
+{
+  if(strcmp(c, "Cold") == 0)
+    return GAS_COLD;
+  if(strcmp(c, "Hot") == 0)
+    return GAS_HOT;
+  if(strcmp(c, "Ejected") == 0)
+    return GAS_EJECTED;
+  printf("Unknown component type %s in call to transfer_gas\n", c);
+  exit(1);
 }
 
+template < gas_component to >
+static void transfer_gas_to(int p, int q, int cq, double fraction, const char call_function[], int call_line)
+{
+  switch (cq)
+    {
+    case GAS_COLD:
+      transfer_gas < to, GAS_COLD > (p, q, fraction, call_function, call_line);
+      break;
+    case GAS_HOT:
+      transfer_gas < to, GAS_HOT > (p, q, fraction, call_function, call_line);
+      break;
+    case GAS_EJECTED:
+      transfer_gas < to, GAS_EJECTED > (p, q, fraction, call_function, call_line);
+      break;
+    }
+}
 
+/** @brief String interface to transfer_gas<to, from>(), kept for code that
+ *         still names the components: "Cold", "Hot" or "Ejected". */
 void transfer_gas(int p, const char cp[], int q, const char cq[], double fraction, const char call_function[],
                   int call_line)
 {
+  int to = gas_component_from_name(cp);
+  int from = gas_component_from_name(cq);
 
-  /* Transfers a fraction of component cq of galaxy q onto component cp of galaxy p.
-   * cp and cq must each be one of:
-   *   Cold
-   *   Hot
-   *   Ejected
-   */
-  float Mass;
-
-#ifdef DETAILED_METALS_AND_MASS_RETURN
-  struct metals Metals;
-
-#ifdef INDIVIDUAL_ELEMENTS
-  struct elements Yield;
-#endif
-#else
-  float Metals;
-#endif
+  switch (to)
+    {
+    case GAS_COLD:
+      transfer_gas_to < GAS_COLD > (p, q, from, fraction, call_function, call_line);
+      break;
+    case GAS_HOT:
+      transfer_gas_to < GAS_HOT > (p, q, from, fraction, call_function, call_line);
+      break;
+    case GAS_EJECTED:
+      transfer_gas_to < GAS_EJECTED > (p, q, from, fraction, call_function, call_line);
+      break;
+    }
+}
 
-  /* Sanity check */
 
-  if(fraction > 1.)             //1.000001
-    {
-      char sbuf[1000];
+#ifdef GALAXY_SOA
+/** @brief Allocates the per-field arrays of GalSoA for the ngal galaxies
+ *         of the FOF group being evolved, as a single block. */
+void alloc_galaxy_soa(int ngal)
+{
+  char *block;
+
+  block = static_cast < char *>(mymalloc("GalSoA", ngal * (sizeof(double) + 8 * sizeof(float) + sizeof(int))));
+
+  GalSoA.n = ngal;
+  GalSoA.Fraction = (double *) block;
+  GalSoA.Mvir = (float *) (GalSoA.Fraction + ngal);
+  GalSoA.Rvir = GalSoA.Mvir + ngal;
+  GalSoA.Vvir = GalSoA.Rvir + ngal;
+  GalSoA.HotRadius = GalSoA.Vvir + ngal;
+  GalSoA.HotGas = GalSoA.HotRadius + ngal;
+  GalSoA.EjectedMass = GalSoA.HotGas + ngal;
+  GalSoA.CoolingRadius = GalSoA.EjectedMass + ngal;
+  GalSoA.CoolingGas = GalSoA.CoolingRadius + ngal;
+  GalSoA.Type = (int *) (GalSoA.CoolingGas + ngal);
+}
 
-      sprintf(sbuf,
-              "\nparent call from: %s, line %d \ntransfer_gas: fraction>1\nfraction = %.11f\nFrom '%s' to '%s\n",
-              call_function, call_line, fraction, cq, cp);
-      terminate(sbuf);
-    }
-  //if (fraction > 1. && fraction < 1.000001) { //1.0000001
-  //  fraction = 1.0;
-  /*printf("\n*** fraction forced to 1.0 ***\n");
-     printf("*** fraction was = %.11f ***\n", fraction);
-     printf("*** From '%s' to '%s' ***\n\n", cq, cp); */
-  // }
-
-  //Mass and Metals to be transfered
-  if(strcmp(cq, "Cold") == 0)
-    {
-      Mass = fraction * Gal[q].ColdGas;
-      Metals = metals_add(metals_init(), Gal[q].MetalsColdGas, fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-      Yield = elements_add(elements_init(), Gal[q].ColdGas_elements, fraction);
-#endif
-    }
-  else if(strcmp(cq, "Hot") == 0)
-    {
-      Mass = fraction * Gal[q].HotGas;
-      Metals = metals_add(metals_init(), Gal[q].MetalsHotGas, fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-      Yield = elements_add(elements_init(), Gal[q].HotGas_elements, fraction);
-#endif
-    }
-  else if(strcmp(cq, "Ejected") == 0)
-    {
-      Mass = fraction * Gal[q].EjectedMass;
-      Metals = metals_add(metals_init(), Gal[q].MetalsEjectedMass, fraction);
-#ifdef INDIVIDUAL_ELEMENTS
-      Yield = elements_add(elements_init(), Gal[q].EjectedMass_elements, fraction);
-#endif
-    }
-  else
-    {
-      printf("Unknown component type %s in call to transfer_gas\n", cq);
-      exit(1);
-    }
+void free_galaxy_soa(void)
+{
+  myfree(GalSoA.Fraction);
+  GalSoA.n = 0;
+}
 
-  //Add to galaxy p
-  if(strcmp(cp, "Cold") == 0)
-    {
-      Gal[p].ColdGas += Mass;
-      Gal[p].MetalsColdGas = metals_add(Gal[p].MetalsColdGas, Metals, 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[p].ColdGas_elements = elements_add(Gal[p].ColdGas_elements, Yield, 1.);
-#endif
-    }
-  else if(strcmp(cp, "Hot") == 0)
-    {
-      Gal[p].HotGas += Mass;
-      Gal[p].MetalsHotGas = metals_add(Gal[p].MetalsHotGas, Metals, 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[p].HotGas_elements = elements_add(Gal[p].HotGas_elements, Yield, 1.);
-#endif
-#ifdef METALS_SELF
-      if(p == q)
-        Gal[p].MetalsHotGasSelf = metals_add(Gal[p].MetalsHotGasSelf, Metals, 1.);
-#endif
-    }
-  else if(strcmp(cp, "Ejected") == 0)
-    {
-      Gal[p].EjectedMass += Mass;
-      Gal[p].MetalsEjectedMass = metals_add(Gal[p].MetalsEjectedMass, Metals, 1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[p].EjectedMass_elements = elements_add(Gal[p].EjectedMass_elements, Yield, 1.);
-#endif
-    }
-  else
-    {
-      printf("Unknown component type %s in call to transfer_gas\n", cp);
-      exit(1);
-    }
+/** @brief Copies the fields read by the vectorised recipes from Gal into
+ *         GalSoA. Called at the start of each substep, after the infall
+ *         onto the central galaxy. */
+void gather_galaxy_soa(int ngal)
+{
+  int p;
 
-  //Subtract from galaxy q;
-  if(strcmp(cq, "Cold") == 0)
+  for(p = 0; p < ngal; p++)
     {
-      Gal[q].ColdGas -= Mass;
-      Gal[q].MetalsColdGas = metals_add(Gal[q].MetalsColdGas, Metals, -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[q].ColdGas_elements = elements_add(Gal[q].ColdGas_elements, Yield, -1.);
-#endif
+      GalSoA.Type[p] = Gal[p].Type;
+      GalSoA.Mvir[p] = Gal[p].Mvir;
+      GalSoA.Rvir[p] = Gal[p].Rvir;
+      GalSoA.Vvir[p] = Gal[p].Vvir;
+      GalSoA.HotRadius[p] = Gal[p].HotRadius;
+      GalSoA.HotGas[p] = Gal[p].HotGas;
+      GalSoA.EjectedMass[p] = Gal[p].EjectedMass;
+      GalSoA.CoolingRadius[p] = Gal[p].CoolingRadius;
+      GalSoA.CoolingGas[p] = Gal[p].CoolingGas;
     }
-  else if(strcmp(cq, "Hot") == 0)
-    {
-      Gal[q].HotGas -= Mass;
-      Gal[q].MetalsHotGas = metals_add(Gal[q].MetalsHotGas, Metals, -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[q].HotGas_elements = elements_add(Gal[q].HotGas_elements, Yield, -1.);
-#endif
-#ifdef METALS_SELF
-      Gal[q].MetalsHotGasSelf = metals_add(Gal[q].MetalsHotGasSelf, Metals, -1.);
-#endif
-    }
-  else if(strcmp(cq, "Ejected") == 0)
-    {
-      Gal[q].EjectedMass -= Mass;
-      Gal[q].MetalsEjectedMass = metals_add(Gal[q].MetalsEjectedMass, Metals, -1.);
-#ifdef INDIVIDUAL_ELEMENTS
-      Gal[q].EjectedMass_elements = elements_add(Gal[q].EjectedMass_elements, Yield, -1.);
-#endif
-    }
-  else
-    {
-      printf("Unknown component type %s in call to transfer_gas\n", cq);
-      exit(1);
-    }
-
-  return;
 }
+#endif //GALAXY_SOA
 
 
 
@@ -1612,6 +1526,10 @@ void assign_files_to_tasks(int *FileToProcess, int *TaskToProcess, int ThisTask,
 #endif
         }
     }
+#ifdef DYNAMIC_FILE_ASSIGNMENT
+  if(ThisTask == 0)
+    sort_files_by_cost(FileToProcess, TaskToProcess, nfiles);
+#endif
 #ifdef PARALLEL
   MPI_Bcast(FileToProcess, sizeof(int) * nfiles, MPI_BYTE, 0, MPI_COMM_WORLD);
   MPI_Bcast(TaskToProcess, sizeof(int) * nfiles, MPI_BYTE, 0, MPI_COMM_WORLD);
@@ -1619,6 +1537,106 @@ void assign_files_to_tasks(int *FileToProcess, int *TaskToProcess, int ThisTask,
 }
 
 
+#ifdef DYNAMIC_FILE_ASSIGNMENT
+/* With DYNAMIC_FILE_ASSIGNMENT files are not given to tasks in advance.
+ * They are sorted from the most to the least expensive (number of halos
+ * in the trees_** header) and each task takes the next one from a counter
+ * kept on task 0 whenever it has finished its previous file. */
+
+static int NextFileCounter;
+
+#ifdef PARALLEL
+static MPI_Win NextFileWin;
+static int *NextFileBase;
+#endif
+
+struct file_cost_data
+{
+  int nhalos;
+  int file;
+};
+
+static int compare_file_cost(const void *a, const void *b)
+{
+  const struct file_cost_data *fa = static_cast < const struct file_cost_data *>(a);
+  const struct file_cost_data *fb = static_cast < const struct file_cost_data *>(b);
+
+  if(fa->nhalos > fb->nhalos)
+    return -1;
+  if(fa->nhalos < fb->nhalos)
+    return +1;
+
+  return (fa->file > fb->file) - (fa->file < fb->file);
+}
+
+/**@brief Orders FileToProcess from the most to the least halos; the
+ *        task for each file is only known at run time (-1). */
+void sort_files_by_cost(int *FileToProcess, int *TaskToProcess, int nfiles)
+{
+  int i;
+  struct file_cost_data *cost;
+
+  cost = static_cast < struct file_cost_data *>(mymalloc("FileCost", sizeof(struct file_cost_data) * nfiles));
+
+  for(i = 0; i < nfiles; i++)
+    {
+      cost[i].file = FileToProcess[i];
+      cost[i].nhalos = get_tree_file_nhalos(FileToProcess[i]);
+    }
+
+  qsort(cost, nfiles, sizeof(struct file_cost_data), compare_file_cost);
+
+  for(i = 0; i < nfiles; i++)
+    {
+      FileToProcess[i] = cost[i].file;
+      TaskToProcess[i] = -1;
+    }
+
+  myfree(cost);
+}
+
+/**@brief Sets up the shared counter of files already taken; collective. */
+void init_file_counter(void)
+{
+  NextFileCounter = 0;
+#ifdef PARALLEL
+  MPI_Win_allocate(ThisTask == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &NextFileBase,
+                   &NextFileWin);
+  if(ThisTask == 0)
+    *NextFileBase = 0;
+  MPI_Barrier(MPI_COMM_WORLD);
+#endif
+}
+
+/**@brief Returns the index (in FileToProcess) of the next file that
+ *        nobody has taken yet; nfiles or more once all are taken. */
+int get_next_file_to_process(void)
+{
+  int file;
+
+#ifdef PARALLEL
+  int one = 1;
+
+  MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, NextFileWin);
+  MPI_Fetch_and_op(&one, &file, MPI_INT, 0, 0, MPI_SUM, NextFileWin);
+  MPI_Win_unlock(0, NextFileWin);
+#else
+  file = NextFileCounter++;
+#endif
+
+  return file;
+}
+
+/**@brief Releases the shared counter; collective. */
+void free_file_counter(void)
+{
+#ifdef PARALLEL
+  MPI_Win_free(&NextFileWin);
+#endif
+}
+#endif //DYNAMIC_FILE_ASSIGNMENT
+
+
 //MATH MISC - PROBABLY SHOULD GO INTO SEPARATE FILE
 //Finds interpolation point
 //the value j so that xx[j]<x<xx[jj+1]
@@ -1801,3 +1819,20 @@ void print_galaxy(char string[], int p, int halonr)
     exit(0);
 
 }
+
+
+/**@brief FNV-1a hash of n bytes of data, continuing from h; used for the
+ *        keys of the on-disk caches. */
+unsigned long long hash_bytes(const void *data, size_t n, unsigned long long h)
+{
+  const unsigned char *c = static_cast < const unsigned char *>(data);
+  size_t i;
+
+  for(i = 0; i < n; i++)
+    {
+      h ^= c[i];
+      h *= 1099511628211ULL;
+    }
+
+  return h;
+}
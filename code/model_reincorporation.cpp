@@ -83,9 +83,67 @@ void reincorporate_gas(int p, double dt)
   if(Gal[p].EjectedMass > 0.)
     {
       fraction = ((float) reincorporated) / Gal[p].EjectedMass;
-      transfer_gas(p, "Hot", p, "Ejected", fraction, "reincorporate_gas", __LINE__);
+      transfer_gas < GAS_HOT, GAS_EJECTED > (p, p, fraction, "reincorporate_gas", __LINE__);
     }
 
   mass_checks("reincorporate_gas #2", p);
 
 }
+
+
+#ifdef GALAXY_SOA
+/** @brief reincorporate_gas() for all the type 0 and 1 galaxies of a FOF
+ *  group at once. The reincorporated fractions are computed from GalSoA in
+ *  loops without calls, one per model, and then applied with
+ *  transfer_gas(), keeping GalSoA.HotGas and EjectedMass up to date. */
+void reincorporate_gas_soa(int ngal, double dt)
+{
+  double reincorporated, reinc_time;
+  float *Mvir = GalSoA.Mvir, *Rvir = GalSoA.Rvir, *Vvir = GalSoA.Vvir, *EjectedMass = GalSoA.EjectedMass;
+  double *fraction = GalSoA.Fraction;
+  int p;
+
+  if(FeedbackEjectionModel == 0 && ReIncorporationModel == 0)
+    for(p = 0; p < ngal; p++)
+      {
+        reinc_time = (Hubble_h / Mvir[p]) * (ReIncorporationFactor / UnitTime_in_years);
+        fraction[p] = EjectedMass[p] / reinc_time * dt;
+      }
+  else if(FeedbackEjectionModel == 0 && ReIncorporationModel == 1)
+    for(p = 0; p < ngal; p++)
+      fraction[p] = ReIncorporationFactor * EjectedMass[p] / (Rvir[p] / Vvir[p]) * Vvir[p] / 220. * dt;
+  else if(FeedbackEjectionModel == 0 && ReIncorporationModel == 2)
+    for(p = 0; p < ngal; p++)
+      fraction[p] = ReIncorporationFactor * EjectedMass[p] / (Rvir[p] / Vvir[p]) * dt;
+  else if(FeedbackEjectionModel == 1)
+    for(p = 0; p < ngal; p++)
+      fraction[p] = ReIncorporationFactor * EjectedMass[p] /
+        (Rvir[p] * min(FeedbackEjectionEfficiency, 1.) * sqrt(EtaSNcode * EnergySNcode) /
+         (Vvir[p] * Vvir[p])) * Vvir[p] / 220. * 1.e-6 * dt;
+  else
+    for(p = 0; p < ngal; p++)
+      fraction[p] = 0.;
+
+  for(p = 0; p < ngal; p++)
+    {
+      reincorporated = fraction[p];
+      if(reincorporated > EjectedMass[p])
+        reincorporated = EjectedMass[p];
+      fraction[p] = (EjectedMass[p] > 0.) ? ((float) reincorporated) / EjectedMass[p] : 0.;
+    }
+
+  for(p = 0; p < ngal; p++)
+    if(GalSoA.Type[p] == 0 || GalSoA.Type[p] == 1)
+      {
+        mass_checks("reincorporate_gas_soa #1", p);
+
+        if(EjectedMass[p] > 0.)
+          transfer_gas < GAS_HOT, GAS_EJECTED > (p, p, fraction[p], "reincorporate_gas_soa", __LINE__);
+
+        GalSoA.HotGas[p] = Gal[p].HotGas;
+        GalSoA.EjectedMass[p] = Gal[p].EjectedMass;
+
+        mass_checks("reincorporate_gas_soa #2", p);
+      }
+}
+#endif //GALAXY_SOA
@@ -29,14 +29,185 @@ using namespace std;
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <gsl/gsl_rng.h>
+#ifdef PARALLEL
+#include <mpi.h>
+#endif
 
 #include "allvars.h"
 #include "proto.h"
 
 
 #ifdef COMPUTE_SPECPHOT_PROPERTIES
+/* Binary cache of the PhotTables: a header followed by LumTables and the
+ * age, metallicity, redshift and filter wavelength tables. It is written
+ * as <dir>/PhotTables_<kind>_<key>.bin by the first run that builds the
+ * tables and read back by later runs whose inputs hash to the same key.
+ * The version is part of the magic number and the checksum covers the
+ * tables, so a stale, truncated or corrupted file is rebuilt. */
+struct phottables_cache_header
+{
+  char magic[8];
+  unsigned long long key;
+  unsigned long long checksum;
+  size_t lumtables_size;
+};
+
+static const char PhotTablesCacheMagic[8] = { 'L', 'G', 'P', 'H', 'O', 'T', '0', '3' };
+
+/* the tables stored in the cache, in file order */
+static struct
+{
+  void *data;
+  size_t size;
+} PhotTablesCacheBlocks[] =
+{
+  {LumTables, sizeof(LumTables)},
+  {SSP_logAgeTab, sizeof(SSP_logAgeTab)},
+  {SSP_logMetalTab, sizeof(SSP_logMetalTab)},
+  {RedshiftTab, sizeof(RedshiftTab)},
+  {FilterLambda, sizeof(float) * NMAG},
+};
+
+constexpr auto NPhotTablesCacheBlocks = sizeof(PhotTablesCacheBlocks) / sizeof(PhotTablesCacheBlocks[0]);
+
+
+/**@brief Starting key of the cache: the shape and layout of the tables
+ *        and the parameters that enter their construction. */
+unsigned long long phottables_config_hash(void)
+{
+  int dims[] = { NMAG, SSP_NAGES, SSP_NMETALLICITES, MAXSNAPS, LastDarkMatterSnapShot,
+    static_cast < int >(sizeof(LumTables) / sizeof(float)),
+#ifdef LUMTABLES_BANDS_INNERMOST
+    -1, NMAG_PADDED,            /* bands innermost: same size as the default layout when NMAG_PADDED == NMAG */
+#endif
+#ifdef SPEC_PHOTABLES_ON_THE_FLY
+    SSP_NLambda,
+#endif
+#ifdef FULL_SPECTRA
+    1,
+#endif
+#ifdef AB
+    2,
+#endif
+#ifdef VEGA
+    3,
+#endif
+#ifdef APP
+    4,
+#endif
+  };
+  double pars[] = { Hubble_h, Omega, OmegaLambda, UnitTime_in_Megayears };
+  unsigned long long h = 14695981039346656037ULL;
+
+  h = hash_bytes(dims, sizeof(dims), h);
+  h = hash_bytes(pars, sizeof(pars), h);
+
+  return h;
+}
+
+
+static unsigned long long phottables_checksum(void)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  size_t i;
+
+  for(i = 0; i < NPhotTablesCacheBlocks; i++)
+    h = hash_bytes(PhotTablesCacheBlocks[i].data, PhotTablesCacheBlocks[i].size, h);
+
+  return h;
+}
+
+
+static void get_phottables_cache_name(char *fname, const char *dir, const char *kind, unsigned long long key)
+{
+  sprintf(fname, "%s/PhotTables_%s_%016llx.bin", dir, kind, key);
+}
+
+
+/**@brief Loads the tables from the cache with a single read of each
+ *        table. Returns 0 if there is no valid cache for this key. */
+int read_phottables_cache(const char *dir, const char *kind, unsigned long long key)
+{
+  struct phottables_cache_header header;
+  char fname[1000];
+  FILE *fd;
+  size_t i;
+  int ok;
+
+  get_phottables_cache_name(fname, dir, kind, key);
+  if(!(fd = fopen(fname, "r")))
+    return 0;
+
+  ok = (fread(&header, sizeof(header), 1, fd) == 1 &&
+        memcmp(header.magic, PhotTablesCacheMagic, sizeof(PhotTablesCacheMagic)) == 0 &&
+        header.key == key && header.lumtables_size == sizeof(LumTables));
+  for(i = 0; ok && i < NPhotTablesCacheBlocks; i++)
+    ok = (fread(PhotTablesCacheBlocks[i].data, PhotTablesCacheBlocks[i].size, 1, fd) == 1);
+  fclose(fd);
+
+  if(ok && header.checksum != phottables_checksum())
+    ok = 0;
+
+  if(!ok)
+    {
+      printf("PhotTables cache %s is out of date or damaged, rebuilding it\n", fname);
+      return 0;
+    }
+
+#ifdef PARALLEL
+  if(ThisTask == 0)
+    printf("\nPhotTables read from cache %s\n", fname);
+#else
+  printf("\nPhotTables read from cache %s\n", fname);
+#endif
+  return 1;
+}
+
+
+/**@brief Writes the tables read by read_phottables_cache(). The file is
+ *        written under a temporary name and renamed, so a run never sees
+ *        a partial cache. Failing to write it is not an error: returns 0. */
+int write_phottables_cache(const char *dir, const char *kind, unsigned long long key)
+{
+  struct phottables_cache_header header;
+  char fname[1000], tmpname[1100];
+  FILE *fd;
+  size_t i;
+  int ok;
+
+  get_phottables_cache_name(fname, dir, kind, key);
+  sprintf(tmpname, "%s.%d.tmp", fname, static_cast < int >(getpid()));
+  if(!(fd = fopen(tmpname, "w")))
+    {
+      printf("can't write PhotTables cache %s\n", tmpname);
+      return 0;
+    }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PhotTablesCacheMagic, sizeof(PhotTablesCacheMagic));
+  header.key = key;
+  header.checksum = phottables_checksum();
+  header.lumtables_size = sizeof(LumTables);
+
+  ok = (fwrite(&header, sizeof(header), 1, fd) == 1);
+  for(i = 0; ok && i < NPhotTablesCacheBlocks; i++)
+    ok = (fwrite(PhotTablesCacheBlocks[i].data, PhotTablesCacheBlocks[i].size, 1, fd) == 1);
+  ok = (fclose(fd) == 0) && ok;
+
+  if(!ok || rename(tmpname, fname) != 0)
+    {
+      printf("can't write PhotTables cache %s\n", fname);
+      remove(tmpname);
+      return 0;
+    }
+
+  return 1;
+}
+
+
 /**@brief Reads in the look up tables from Stellar Population Synthesis Models.
  *
  * Reads in the look up tables from a given Stellar Population Synthesis Model.
@@ -57,17 +228,8 @@ using namespace std;
  *
  * agTableZz[Mag][mettallicity][Snapshot][Age]. */
 #ifdef PHOTTABLES_PRECOMPUTED
-void setup_LumTables_precomputed(const char SimName[])
+static void get_precomputed_ssp_name(char *SSP)
 {
-  //printf("a %s\n", SpecPhotDir);
-  //assert(0);
-  FILE *fa, *fb;
-  int MetalLoop, AgeLoop, band, snap;
-  char buf[1900], FilterName[100], dummy[100], SSP[1000];
-  char dumb_FilterFile[100];
-  float dumb_filterlambda;
-  int dumb_ssp_nsnaps, dumb_ssp_nage, dumb_ssp_nmetallicites, dumb_nmag;
-
 #ifdef BC03
   sprintf(SSP, "BC03");
 #endif
@@ -77,8 +239,17 @@ void setup_LumTables_precomputed(const char SimName[])
 #ifdef CB07
   sprintf(SSP, "CB07");
 #endif
+}
+
+
+/* Read list of metallicities available from SSP */
+static void read_precomputed_MetalTab(void)
+{
+  FILE *fa;
+  int MetalLoop, dumb_ssp_nmetallicites;
+  char buf[1900], SSP[1000];
 
-  /*Read list of metallicities available from SSP */
+  get_precomputed_ssp_name(SSP);
   sprintf(buf, "%s/PhotTables/%s_%s_Metallicity_list.dat", SpecPhotDir, SSP, SpecPhotIMF);
   if(!(fa = fopen(buf, "r")))
     {
@@ -100,8 +271,69 @@ void setup_LumTables_precomputed(const char SimName[])
       SSP_logMetalTab[MetalLoop] = log10(SSP_logMetalTab[MetalLoop]);
     }
   fclose(fa);
+}
+
+
+static void get_precomputed_table_name(char *buf, const char SimName[], const char *FilterName, int MetalLoop)
+{
+  sprintf(buf, "%s/PhotTables/%s_%s_Phot_Table_%s_Mag%s_m%0.4f.dat", SpecPhotDir, PhotPrefix,
+          SpecPhotIMF, SimName, FilterName, pow(10, SSP_logMetalTab[MetalLoop]));
+}
+
+
+/**@brief Key of the binary cache of the ASCII tables: the table shape and
+ *        LumTables layout (phottables_config_hash()), the metallicity and
+ *        filter lists and the name, size and modification time of every
+ *        table file, so that the tables themselves are not opened. The
+ *        cache directory is shared by all builds, so the layout matters. */
+static unsigned long long precomputed_phottables_key(const char SimName[])
+{
+  FILE *fa;
+  struct stat st;
+  int MetalLoop, band, dumb_nmag;
+  char buf[1900], FilterName[100], dumb_FilterFile[100];
+  float dumb_filterlambda;
+  unsigned long long key = phottables_config_hash();
+
+  key = hash_bytes(SSP_logMetalTab, sizeof(SSP_logMetalTab), key);
+
+  if((fa = fopen(FileWithFilterNames, "r")) == NULL)
+    {
+      char sbuf[2000];
+
+      sprintf(sbuf, "file `%s' not found.\n", FileWithFilterNames);
+      terminate(sbuf);
+    }
+  fscanf(fa, "%d", &dumb_nmag);
+
+  for(band = 0; band < NMAG && fscanf(fa, "%s %f %s", dumb_FilterFile, &dumb_filterlambda, FilterName) == 3; band++)
+    for(MetalLoop = 0; MetalLoop < SSP_NMETALLICITES; MetalLoop++)
+      {
+        get_precomputed_table_name(buf, SimName, FilterName, MetalLoop);
+        key = hash_bytes(buf, strlen(buf), key);
+        if(stat(buf, &st) == 0)
+          {
+            key = hash_bytes(&st.st_size, sizeof(st.st_size), key);
+            key = hash_bytes(&st.st_mtime, sizeof(st.st_mtime), key);
+          }
+      }
+  fclose(fa);
+
+  return key;
+}
+
+
+/* Loop over the different ASCII files corresponding to different
+ * metallicities and bands */
+static void read_LumTables_ascii(const char SimName[])
+{
+  FILE *fa, *fb;
+  int MetalLoop, AgeLoop, band, snap;
+  char buf[1900], FilterName[100], dummy[100];
+  char dumb_FilterFile[100];
+  float dumb_filterlambda;
+  int dumb_ssp_nsnaps, dumb_ssp_nage, dumb_nmag;
 
-  /*Loop over the different files corresponding to different metallicities */
   for(MetalLoop = 0; MetalLoop < SSP_NMETALLICITES; MetalLoop++)
     {
       sprintf(buf, "%s", FileWithFilterNames);
@@ -122,8 +354,7 @@ void setup_LumTables_precomputed(const char SimName[])
         {
           fscanf(fa, "%s %f %s", dumb_FilterFile, &dumb_filterlambda, FilterName);
           //READ TABLES
-          sprintf(buf, "%s/PhotTables/%s_%s_Phot_Table_%s_Mag%s_m%0.4f.dat", SpecPhotDir, PhotPrefix,
-                  SpecPhotIMF, SimName, FilterName, pow(10, SSP_logMetalTab[MetalLoop]));
+          get_precomputed_table_name(buf, SimName, FilterName, MetalLoop);
           if(!(fb = fopen(buf, "r")))
             {
               char sbuf[2000];
@@ -177,9 +408,9 @@ void setup_LumTables_precomputed(const char SimName[])
               //for each age
               for(AgeLoop = 0; AgeLoop < SSP_NAGES; AgeLoop++)
                 {
-                  fscanf(fb, "%e", &LumTables[band][MetalLoop][snap][AgeLoop]);
-                  LumTables[band][MetalLoop][snap][AgeLoop] =
-                    pow(10., -LumTables[band][MetalLoop][snap][AgeLoop] / 2.5);
+                  fscanf(fb, "%e", &LUMTABLES(band, MetalLoop, snap, AgeLoop));
+                  LUMTABLES(band, MetalLoop, snap, AgeLoop) =
+                    pow(10., -LUMTABLES(band, MetalLoop, snap, AgeLoop) / 2.5);
                 }               //end loop on age
             }                   //end loop on redshift (everything done for current band)
 
@@ -188,8 +419,55 @@ void setup_LumTables_precomputed(const char SimName[])
 
       fclose(fa);
     }                           //end loop on metallicity
+}
+
+
+void setup_LumTables_precomputed(const char SimName[])
+{
+  char dir[1000], kind[200];
+  unsigned long long key = 0;
+  int cached = 0;
+
+  /* the binary cache lives next to the ASCII tables */
+  sprintf(dir, "%s/PhotTables", SpecPhotDir);
+  sprintf(kind, "%s_%s_%s", PhotPrefix, SpecPhotIMF, SimName);
+
+  /* without MCMC only the first task looks at the ASCII tables; the others
+   * load the cache it wrote (or get the tables from it if it could not) */
+#if defined(PARALLEL) && !defined(MCMC)
+  if(ThisTask == 0)
+#endif
+    {
+      read_precomputed_MetalTab();
+      key = precomputed_phottables_key(SimName);
+      cached = read_phottables_cache(dir, kind, key);
+      if(!cached)
+        {
+          read_LumTables_ascii(SimName);
+          cached = write_phottables_cache(dir, kind, key);
+        }
+    }
+
+#if defined(PARALLEL) && !defined(MCMC)
+  size_t i;
+  int loaded;
+
+  MPI_Bcast(&key, sizeof(key), MPI_BYTE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&cached, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  loaded = (ThisTask == 0 || (cached && read_phottables_cache(dir, kind, key)));
+  MPI_Allreduce(MPI_IN_PLACE, &loaded, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if(!loaded)
+    for(i = 0; i < NPhotTablesCacheBlocks; i++)
+      MPI_Bcast(PhotTablesCacheBlocks[i].data, PhotTablesCacheBlocks[i].size, MPI_BYTE, 0, MPI_COMM_WORLD);
+#endif
 
   init_jump_index();
+#ifdef POST_PROCESS_MAGS
+  init_post_process_lum_kernels();
+#else
+  init_lum_age_weights();
+#endif
 }
 #endif //PHOTTABLES_PRECOMPUTED
 
@@ -202,30 +480,161 @@ void setup_LumTables_precomputed(const char SimName[])
  * Developed by Chiara Tonini, adapted by Bruno Henriques
  * */
 #ifdef SPEC_PHOTABLES_ON_THE_FLY
-void setup_Spec_LumTables_onthefly(void)
+#ifndef FULL_SPECTRA
+/* a filter (and the Vega spectrum) regridded onto the wavelengths of an
+ * input SSP spectrum redshifted to the current snapshot */
+struct filter_on_grid
+{
+  int Min_Wave_Grid, Grid_Length;
+  double *lgrid, *FluxFilterOnGrid, *FluxInputSSPConv;
+  double FluxFilterInt, FluxVegaInt;
+};
+
+
+static void regrid_filter(struct filter_on_grid *g, int band, int AgeLoop, double redshift,
+                          double LambdaInputSSP[SSP_NAGES][SSP_NLambda],
+                          double LambdaFilter[NMAG][MAX_NLambdaFilter], double FluxFilter[NMAG][MAX_NLambdaFilter],
+                          double *LambdaVega, double *FluxVega)
 {
-  double AbsMAG;
+  double *FluxVegaOnGrid, *FluxVegaConv;
+  int Max_Wave_Grid = 0, i;
+
+  //ALLOCATE GRID - size of filter, binning of the spectra
+  g->Min_Wave_Grid = 0;
+  g->Grid_Length = 0;
+  g->lgrid = create_grid(LambdaFilter[band][0], LambdaFilter[band][NLambdaFilter[band] - 1], AgeLoop, redshift,
+                         LambdaInputSSP, &g->Min_Wave_Grid, &Max_Wave_Grid, &g->Grid_Length);
+  g->FluxFilterOnGrid = static_cast < double *>(malloc(sizeof(double) * g->Grid_Length));
+  g->FluxInputSSPConv = static_cast < double *>(malloc(sizeof(double) * g->Grid_Length));
+
+  if(g->Grid_Length == 0)      //filter outside the spectra, can happen for observed frame
+    return;
+
+  for(i = 0; i < g->Grid_Length; i++)
+    g->lgrid[i] = (1 + redshift) * LambdaInputSSP[AgeLoop][g->Min_Wave_Grid + i];
+
+  //VEGA - interpolate spectrum on integral grid
+  FluxVegaOnGrid = static_cast < double *>(malloc(sizeof(double) * g->Grid_Length));
+  interpolate(g->lgrid, g->Grid_Length, LambdaVega, NLambdaVega, FluxVega, FluxVegaOnGrid);
+
+  //FILTERS - interpolate on integral grid
+  interpolate(g->lgrid, g->Grid_Length, LambdaFilter[band], NLambdaFilter[band], FluxFilter[band],
+              g->FluxFilterOnGrid);
+
+  FluxVegaConv = static_cast < double *>(malloc(sizeof(double) * g->Grid_Length));
+  for(i = 0; i < g->Grid_Length; i++)
+    FluxVegaConv[i] = FluxVegaOnGrid[i] * g->FluxFilterOnGrid[i];
+
+  //INTEGRATE
+  g->FluxFilterInt = integrate(g->FluxFilterOnGrid, g->Grid_Length);
+  g->FluxVegaInt = integrate(FluxVegaConv, g->Grid_Length);
+
+  free(FluxVegaConv);
+  free(FluxVegaOnGrid);
+}
+
 
+static void free_filter_on_grid(struct filter_on_grid *g)
+{
+  free(g->FluxInputSSPConv);
+  free(g->FluxFilterOnGrid);
+  free(g->lgrid);
+}
+#endif //FULL_SPECTRA
+
+
+/**@brief Fills the tables of one metallicity at one snapshot. The filters
+ *        are regridded once per band when all the ages of the input spectra
+ *        share the same wavelengths (same_lambda), otherwise for every age,
+ *        so the tables are the same in both cases. */
+static void compute_LumTables_onthefly(int MetalLoop, int snap, double LambdaInputSSP[SSP_NAGES][SSP_NLambda],
+                                       double FluxInputSSP[SSP_NAGES][SSP_NLambda], int same_lambda,
+                                       double LambdaFilter[NMAG][MAX_NLambdaFilter],
+                                       double FluxFilter[NMAG][MAX_NLambdaFilter], double *LambdaVega,
+                                       double *FluxVega)
+{
+  double redshift = RedshiftTab[(LastDarkMatterSnapShot + 1) - snap - 1];
+  int AgeLoop, band;
+
+#ifndef FULL_SPECTRA
+  struct filter_on_grid g;
+  double AbsMAG, FluxInputSSPInt;
+  int i;
+
+  for(band = 0; band < NMAG; band++)
+    for(AgeLoop = 0; AgeLoop < SSP_NAGES; AgeLoop++)
+      {
+        if(AgeLoop == 0 || !same_lambda)
+          {
+            if(AgeLoop > 0)
+              free_filter_on_grid(&g);
+            regrid_filter(&g, band, AgeLoop, redshift, LambdaInputSSP, LambdaFilter, FluxFilter, LambdaVega,
+                          FluxVega);
+          }
+
+        if(g.Grid_Length > 0)
+          {
+            /* SSP - multiply by (1+z) to go from rest to observed SSP flux.
+             * CONVOLUTION: direct (configuration) space
+             * simply multiply filter*spectrum it's a convolution in Fourier space */
+            for(i = 0; i < g.Grid_Length; i++)
+              g.FluxInputSSPConv[i] =
+                ((1. + redshift) * FluxInputSSP[AgeLoop][g.Min_Wave_Grid + i]) * g.FluxFilterOnGrid[i];
+
+            FluxInputSSPInt = integrate(g.FluxInputSSPConv, g.Grid_Length);
+
+            //Absolute Observed Frame Magnitudes
+            if(FluxInputSSPInt == 0. || g.FluxFilterInt == 0.)
+              AbsMAG = 99.;
+            else
+              {
+#ifdef AB
+                AbsMAG = get_AbsAB_magnitude(FluxInputSSPInt, g.FluxFilterInt, redshift);
+#endif
+#ifdef VEGA
+                AbsMAG = get_AbsAB_magnitude(FluxInputSSPInt, g.FluxFilterInt, redshift);
+                AbsMAG = AbsMAG + 2.5 * (log10(g.FluxVegaInt) - log10(g.FluxFilterInt)) + 48.6;
+#endif
+              }
+          }
+        else                    //if Grid_Length=0 (filter outside the spectra, can happen for observed frame)
+          AbsMAG = 99.;
+
+        LUMTABLES(band, MetalLoop, snap, AgeLoop) = pow(10., -AbsMAG / 2.5);
+
+        if(AgeLoop == SSP_NAGES - 1)
+          free_filter_on_grid(&g);
+      }
+#else //ifdef FULL_SPECTRA
+  //FULL_SPECTRA defined -> a band corresponds to a wavelength on the SSP spectra
+  for(AgeLoop = 0; AgeLoop < SSP_NAGES; AgeLoop++)
+    for(band = 0; band < NMAG; band++)
+      LUMTABLES(band, MetalLoop, snap, AgeLoop) = (1. + redshift) * FluxInputSSP[AgeLoop][band];
+#endif
+}
+
+
+/**@brief Computes the PhotTables from the full SEDs, or reads them from
+ *        the cache written by a previous run with the same inputs.
+ *
+ *  The (metallicity, snapshot) pairs are shared among the MPI tasks (not
+ *  with MCMC, where the tasks are independent) and, with OPENMP, among
+ *  threads. The key of the cache is a hash of the SSP spectra, filter
+ *  curves, Vega spectrum, redshift list and table layout. */
+void setup_Spec_LumTables_onthefly(void)
+{
   //FILTERS
   double LambdaFilter[NMAG][MAX_NLambdaFilter], FluxFilter[NMAG][MAX_NLambdaFilter];
-  double *FluxFilterOnGrid, FluxFilterInt;
 
-  //InputSSP spectra
-  double LambdaInputSSP[SSP_NAGES][SSP_NLambda], FluxInputSSP[SSP_NAGES][SSP_NLambda];
-  double *FluxInputSSPConv, *FluxInputSSPOnGrid, FluxInputSSPInt;
+  //InputSSP spectra, for all metallicities
+  double (*LambdaInputSSP)[SSP_NAGES][SSP_NLambda], (*FluxInputSSP)[SSP_NAGES][SSP_NLambda];
+  int same_lambda[SSP_NMETALLICITES];
 
   //VEGA
   double LambdaVega[NLambdaVega], FluxVega[NLambdaVega];
-  double *FluxVegaConv, *FluxVegaOnGrid, FluxVegaInt;
-
-  //AUX ARRAYS for FILTERS and InputSSP
-  double LambdaFilter_SingleFilter[MAX_NLambdaFilter], FluxFilter_SingleFilter[MAX_NLambdaFilter],
-    LambdaInputSSP_SingleAge[SSP_NLambda];
-  double redshift;
 
-  //Loops in the code
-  int MetalLoop, AgeLoop, snap, band, i;
-  FILE *File_PhotTables[NMAG];
+  unsigned long long key;
+  int MetalLoop, AgeLoop, band, i, nsnaps = LastDarkMatterSnapShot + 1;
 
 #ifdef PARALLEL
   if(ThisTask == 0)
@@ -242,119 +651,119 @@ void setup_Spec_LumTables_onthefly(void)
   setup_RedshiftTab();
   read_MetalTab();
 
-  //1st loop on the mettalicity files
+  LambdaInputSSP =
+    static_cast < double (*)[SSP_NAGES][SSP_NLambda] >
+    (malloc(sizeof(double) * SSP_NMETALLICITES * SSP_NAGES * SSP_NLambda));
+  FluxInputSSP =
+    static_cast < double (*)[SSP_NAGES][SSP_NLambda] >
+    (malloc(sizeof(double) * SSP_NMETALLICITES * SSP_NAGES * SSP_NLambda));
+
+  key = phottables_config_hash();
+  key = hash_bytes(LambdaVega, sizeof(LambdaVega), key);
+  key = hash_bytes(FluxVega, sizeof(FluxVega), key);
+#ifndef FULL_SPECTRA
+  key = hash_bytes(NLambdaFilter, sizeof(int) * NMAG, key);
+  key = hash_bytes(FilterLambda, sizeof(float) * NMAG, key);
+  for(band = 0; band < NMAG; band++)
+    {
+      key = hash_bytes(LambdaFilter[band], sizeof(double) * NLambdaFilter[band], key);
+      key = hash_bytes(FluxFilter[band], sizeof(double) * NLambdaFilter[band], key);
+    }
+#endif
+  key = hash_bytes(RedshiftTab, sizeof(float) * nsnaps, key);
+  key = hash_bytes(SSP_logMetalTab, sizeof(SSP_logMetalTab), key);
+
+  //READ FULL INPUT SPECTRA into units of erg.s^-1.Hz^-1
   for(MetalLoop = 0; MetalLoop < SSP_NMETALLICITES; MetalLoop++)
     {
 #ifdef PARALLEL
       if(ThisTask == 0)
-        printf("Doing Metallicity File %d of %d\n", MetalLoop + 1, SSP_NMETALLICITES);
+        printf("Reading Metallicity File %d of %d\n", MetalLoop + 1, SSP_NMETALLICITES);
+#else
+      printf("Reading Metallicity File %d of %d\n", MetalLoop + 1, SSP_NMETALLICITES);
+#endif
+      read_InputSSP_spectra(LambdaInputSSP[MetalLoop], FluxInputSSP[MetalLoop], MetalLoop);
+
+      key = hash_bytes(LambdaInputSSP[MetalLoop], sizeof(double) * SSP_NAGES * SSP_NLambda, key);
+      key = hash_bytes(FluxInputSSP[MetalLoop], sizeof(double) * SSP_NAGES * SSP_NLambda, key);
+
+      same_lambda[MetalLoop] = 1;
+      for(AgeLoop = 1; AgeLoop < SSP_NAGES; AgeLoop++)
+        if(memcmp(LambdaInputSSP[MetalLoop][AgeLoop], LambdaInputSSP[MetalLoop][0], sizeof(double) * SSP_NLambda))
+          same_lambda[MetalLoop] = 0;
+    }
+  key = hash_bytes(SSP_logAgeTab, sizeof(SSP_logAgeTab), key);
+
+  /* the first task decides whether the cache is used, so that either all
+   * tasks or none enter the collective computation below; tasks that cannot
+   * read the cache it found get the tables from it */
+#if defined(PARALLEL) && !defined(MCMC)
+  size_t block;
+  int cached = 0, loaded;
+
+  MPI_Bcast(&key, sizeof(key), MPI_BYTE, 0, MPI_COMM_WORLD);
+  if(ThisTask == 0)
+    cached = read_phottables_cache(OutputDir, "onthefly", key);
+  MPI_Bcast(&cached, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  loaded = (ThisTask == 0 || (cached && read_phottables_cache(OutputDir, "onthefly", key)));
+  MPI_Allreduce(MPI_IN_PLACE, &loaded, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if(cached && !loaded)
+    for(block = 0; block < NPhotTablesCacheBlocks; block++)
+      MPI_Bcast(PhotTablesCacheBlocks[block].data, PhotTablesCacheBlocks[block].size, MPI_BYTE, 0,
+                MPI_COMM_WORLD);
 #else
-      printf("Doing Metallicity File %d of %d\n", MetalLoop + 1, SSP_NMETALLICITES);
+  int cached = read_phottables_cache(OutputDir, "onthefly", key);
+#endif
+
+  if(!cached)
+    {
+#if defined(PARALLEL) && !defined(MCMC)
+      memset(LumTables, 0, sizeof(LumTables));
 #endif
-      //READ FULL INPUT SPECTRA into units of erg.s^-1.Hz^-1
-      read_InputSSP_spectra(LambdaInputSSP, FluxInputSSP, MetalLoop);
 
-      //2nd Loop on redshift
-      for(snap = 0; snap < (LastDarkMatterSnapShot + 1); snap++)
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for(i = 0; i < SSP_NMETALLICITES * nsnaps; i++)
         {
-          redshift = RedshiftTab[(LastDarkMatterSnapShot + 1) - snap - 1];
+#if defined(PARALLEL) && !defined(MCMC)
+          if(i % NTask != ThisTask)
+            continue;
+#endif
+          int met = i / nsnaps;
 
-          //3rd loop on Age
-          for(AgeLoop = 0; AgeLoop < SSP_NAGES; AgeLoop++)
-            {
-              //4th loop on Bands
-              //IF FULL_SPECTRA defined a band correspond to a wavelength on the SSP spectra
-              for(band = 0; band < NMAG; band++)
-                {
-#ifndef FULL_SPECTRA
-                  //ALLOCATE GRID - size of filter, binning of the spectra
-                  int Min_Wave_Grid = 0, Max_Wave_Grid = 0, Grid_Length = 0;
-
-                  double *lgrid =
-                    create_grid(LambdaFilter[band][0], LambdaFilter[band][NLambdaFilter[band] - 1], AgeLoop,
-                                redshift,
-                                LambdaInputSSP, &Min_Wave_Grid, &Max_Wave_Grid, &Grid_Length);
-
-                  if(Grid_Length > 0)
-                    {
-
-                      for(i = 0; i < Grid_Length; i++)
-                        lgrid[i] = (1 + redshift) * LambdaInputSSP[AgeLoop][Min_Wave_Grid + i];
-
-                      //VEGA - interpolate spectrum on integral grid
-                      FluxVegaOnGrid = malloc(sizeof(double) * Grid_Length);
-                      interpolate(lgrid, Grid_Length, LambdaVega, NLambdaVega, FluxVega, FluxVegaOnGrid);
-
-
-                      /*SSP - multiply by (1+z) to go from rest to observed SSP flux */
-                      FluxInputSSPOnGrid = malloc(sizeof(double) * Grid_Length);
-                      for(i = 0; i < Grid_Length; i++)
-                        FluxInputSSPOnGrid[i] = (1. + redshift) * FluxInputSSP[AgeLoop][Min_Wave_Grid + i];
-
-                      //FILTERS - interpolate on integral grid
-                      for(i = 0; i < NLambdaFilter[band]; i++)
-                        {
-                          LambdaFilter_SingleFilter[i] = LambdaFilter[band][i];
-                          FluxFilter_SingleFilter[i] = FluxFilter[band][i];
-                        }
-                      FluxFilterOnGrid = malloc(sizeof(double) * Grid_Length);
-                      interpolate(lgrid, Grid_Length, LambdaFilter_SingleFilter, NLambdaFilter[band],
-                                  FluxFilter_SingleFilter, FluxFilterOnGrid);
-
-                      /* spectrum and filters are now defined on same grid
-                       * CONVOLUTION: direct (configuration) space
-                       * simply multiply filter*spectrum it's a convolution in Fourier space */
-                      FluxInputSSPConv = malloc(sizeof(double) * Grid_Length);
-                      for(i = 0; i < Grid_Length; i++)
-                        FluxInputSSPConv[i] = FluxInputSSPOnGrid[i] * FluxFilterOnGrid[i];
-
-                      FluxVegaConv = malloc(sizeof(double) * Grid_Length);
-                      for(i = 0; i < Grid_Length; i++)
-                        FluxVegaConv[i] = FluxVegaOnGrid[i] * FluxFilterOnGrid[i];
-
-                      //INTEGRATE
-                      FluxFilterInt = integrate(FluxFilterOnGrid, Grid_Length);
-                      FluxVegaInt = integrate(FluxVegaConv, Grid_Length);
-                      FluxInputSSPInt = integrate(FluxInputSSPConv, Grid_Length);
-
-                      //Absolute Observed Frame Magnitudes
-                      if(FluxInputSSPInt == 0. || FluxFilterInt == 0.)
-                        AbsMAG = 99.;
-                      else
-                        {
-#ifdef AB
-                          AbsMAG = get_AbsAB_magnitude(FluxInputSSPInt, FluxFilterInt, redshift);
+          compute_LumTables_onthefly(met, i % nsnaps, LambdaInputSSP[met], FluxInputSSP[met], same_lambda[met],
+                                     LambdaFilter, FluxFilter, LambdaVega, FluxVega);
+        }
+
+#if defined(PARALLEL) && !defined(MCMC)
+      /* every entry was filled by exactly one task and is zero on the others */
+      MPI_Allreduce(MPI_IN_PLACE, LumTables, sizeof(LumTables) / sizeof(float), MPI_FLOAT, MPI_SUM,
+                    MPI_COMM_WORLD);
 #endif
-#ifdef VEGA
-                          AbsMAG = get_AbsAB_magnitude(FluxInputSSPInt, FluxFilterInt, redshift);
-                          AbsMAG = AbsMAG + 2.5 * (log10(FluxVegaInt) - log10(FluxFilterInt)) + 48.6;
-                          //MagABVega[band]=-2.5*(log10(FluxVegaInt)
-                          //            -log10(FluxFilterInt))-48.6;
+
+#ifdef FULL_SPECTRA
+      //wavelengths of the last metallicity, snapshot and age, as when the tables were filled in sequence
+      for(band = 0; band < NMAG; band++)
+        FilterLambda[band] = (1 + RedshiftTab[0]) * LambdaInputSSP[SSP_NMETALLICITES - 1][SSP_NAGES - 1][band];
 #endif
-                        }
-                      free(FluxVegaOnGrid);
-                      free(FluxVegaConv);
-                      free(FluxInputSSPOnGrid);
-                      free(FluxInputSSPConv);
-                      free(FluxFilterOnGrid);
-                    }
-                  else          //if Grid_Length=0 (filter outside the spectra, can happen for observed frame)
-                    AbsMAG = 99.;
-
-                  LumTables[band][MetalLoop][snap][AgeLoop] = pow(10., -AbsMAG / 2.5);
-                  free(lgrid);
-#else //ifdef FULL_SPECTRA
-                  //FULL_SPECTRA defined -> a band corresponds to a wavelength on the SSP spectra
-                  FilterLambda[band] = (1 + redshift) * LambdaInputSSP[AgeLoop][band];
-                  LumTables[band][MetalLoop][snap][AgeLoop] = (1. + redshift) * FluxInputSSP[AgeLoop][band];
+
+#ifdef PARALLEL
+      if(ThisTask == 0)
 #endif
+        write_phottables_cache(OutputDir, "onthefly", key);
+    }
 
-                }               // end age loop
-            }                   //end snap loop
-        }                       //end Band loop
+  free(FluxInputSSP);
+  free(LambdaInputSSP);
 
-    }                           //end loop on metallicities
   printf("\nPhotTables Computed.\n\n");
+#ifdef POST_PROCESS_MAGS
+  init_post_process_lum_kernels();
+#else
+  init_lum_age_weights();
+#endif
 
 }
 #endif //SPEC_PHOTABLES_ON_THE_FLY
@@ -394,11 +803,18 @@ int get_jump_index(double age)
 void find_interpolated_lum(double timenow, double timetarget, double metallicity, int *metindex,
                            int *tabindex, double *f1, double *f2, double *fmet1, double *fmet2)
 {
-  int k, i, idx;
-  double age, frac;
-  double ft1, ft2, fm1, fm2;
+  find_interpolated_age(timenow - timetarget, tabindex, f1, f2);
+  find_interpolated_metallicity(metallicity, metindex, fmet1, fmet2);
+}
+
 
-  age = timenow - timetarget;
+/**@brief Finds the two closest ages in the SSP tables and their
+ *        interpolation weights for stars of a given age (code units). */
+void find_interpolated_age(double age, int *tabindex, double *f1, double *f2)
+{
+  int k, idx;
+  double frac;
+  double ft1, ft2;
 
   if(age > 0)
     {
@@ -437,6 +853,20 @@ void find_interpolated_lum(double timenow, double timetarget, double metallicity
       ft2 = 0;
     }
 
+  *tabindex = k;
+  *f1 = ft1;
+  *f2 = ft2;
+}
+
+
+/**@brief Finds the two closest metallicities in the SSP tables and
+ *        their interpolation weights. */
+void find_interpolated_metallicity(double metallicity, int *metindex, double *fmet1, double *fmet2)
+{
+  int i, idx;
+  double frac;
+  double fm1, fm2;
+
   /* Now interpolate also for the metallicity */
   metallicity = log10(metallicity);
 
@@ -464,14 +894,79 @@ void find_interpolated_lum(double timenow, double timetarget, double metallicity
       fm2 = frac;
     }
 
-
   *metindex = i;
-  *tabindex = k;
-
-  *f1 = ft1;
-  *f2 = ft2;
   *fmet1 = fm1;
   *fmet2 = fm2;
 }
 
+
+#ifndef POST_PROCESS_MAGS
+/**@brief Tabulates the age interpolation into the SSP tables, at every
+ *        output time, of the stars formed in each step of each snapshot.
+ *
+ *  The times are worked out with the same expressions as in
+ *  evolve_galaxies() and add_to_luminosities(), so that a table entry
+ *  is exactly what find_interpolated_lum() would give. Must be called
+ *  once the SSP tables, Age[] and ListOutputSnaps are set. */
+void init_lum_age_weights(void)
+{
+  int snap, nstep, outputbin;
+  double previoustime, deltaT, dt, time, age, tbc;
+  struct lum_age_weights *w;
+
+  tbc = 10.0 / UnitTime_in_Megayears * Hubble_h;
+
+  for(nstep = 0; nstep < STEPS; nstep++)
+    LumStepTime[0][nstep] = -1.;        /* nothing is formed before the first snapshot */
+
+  for(snap = 1; snap < MAXSNAPS; snap++)
+    {
+      previoustime = NumToTime(snap - 1);
+      deltaT = previoustime - NumToTime(snap);
+      dt = deltaT / STEPS;
+
+      for(nstep = 0; nstep < STEPS; nstep++)
+        {
+          LumStepTime[snap][nstep] = previoustime - (nstep + 0.5) * (deltaT / STEPS);
+
+          /* the centre of the (single) age bin in add_to_luminosities() */
+          time = LumStepTime[snap][nstep] + dt / 2.;
+          time -= dt / 2.;
+
+          for(outputbin = 0; outputbin < NOUT; outputbin++)
+            {
+              w = &LumAgeWeights[snap][nstep][outputbin];
+              age = time - NumToTime(ListOutputSnaps[outputbin]);
+              find_interpolated_age(age, &w->tabindex, &w->f1, &w->f2);
+              w->young = (age <= tbc);
+            }
+        }
+    }
+}
+
+
+/**@brief Returns the tabulated age weights (one per output) for stars
+ *        formed by galaxy p at the given time and step length, or NULL
+ *        if that time is not one of the steps of its snapshot. */
+struct lum_age_weights *get_lum_age_weights(int p, double time, double dt)
+{
+  int snap, nstep;
+  double deltaT;
+
+  snap = Halo[Gal[p].HaloNr].SnapNum;
+  if(snap < 1 || snap >= MAXSNAPS)
+    return NULL;
+
+  deltaT = NumToTime(snap - 1) - NumToTime(snap);
+  if(dt != deltaT / STEPS)
+    return NULL;
+
+  nstep = (int) ((NumToTime(snap - 1) - time) / dt);
+  if(nstep < 0 || nstep >= STEPS || LumStepTime[snap][nstep] != time)
+    return NULL;
+
+  return LumAgeWeights[snap][nstep];
+}
+#endif //POST_PROCESS_MAGS
+
 #endif // COMPUTE_SPECPHOT_PROPERTIES
@@ -57,26 +57,66 @@ using namespace std;
  * */
 
 
+/** @brief Dynamical time of the gas disk and critical cold gas mass for
+  *        star formation of galaxy p, as used by starformation(). */
+static void star_formation_scales(int p, double *tdyn, double *cold_crit)
+{
+  if(Gal[p].Type == 0)
+    {
+      *tdyn = Gal[p].GasDiskRadius / Gal[p].Vmax;
+      *cold_crit = SfrColdCrit * Gal[p].Vmax / 200. * Gal[p].GasDiskRadius * 100.;
+    }
+  else
+    {
+      *tdyn = Gal[p].GasDiskRadius / Gal[p].InfallVmax;
+      *cold_crit = SfrColdCrit * Gal[p].InfallVmax / 200. * Gal[p].GasDiskRadius * 100.;
+    }
+}
+
+
+#ifdef ADAPTIVE_SUBSTEPS
+/** @brief A galaxy is quiescent when it is a satellite without a halo
+  *        that has nothing to cool, (almost) no hot gas for its black hole
+  *        to accrete and (almost) no cold gas above the threshold for star
+  *        formation. evolve_galaxies() then skips its cooling and AGN
+  *        heating, which do nothing for it, and forms its stars in one
+  *        coarse step over all the substeps it stays quiescent for. With
+  *        QuiescentHotGas and QuiescentColdGas set to 0 no gas would have
+  *        cooled, been accreted or formed stars. */
+int galaxy_is_quiescent(int p)
+{
+  double tdyn, cold_crit;
+
+  if(Gal[p].Type != 2 || Gal[p].CoolingGas > 0. || Gal[p].HotGas > QuiescentHotGas)
+    return 0;
+
+  star_formation_scales(p, &tdyn, &cold_crit);
+
+  return Gal[p].ColdGas <= cold_crit + QuiescentColdGas;
+}
+#endif
+
+
 /** @brief Main recipe, calculates the fraction of cold gas turned into stars due
   *        to star formation; the fraction of mass instantaneously recycled and
   *        returned to the cold gas; the fraction of gas reheated from cold to hot,
   *        ejected from hot to external and returned from ejected to hot due to
   *        SN feedback.   */
 void starformation(int p, int centralgal, double time, double dt, int nstep)
+{
+  starformation_interval(p, centralgal, time, dt, dt * STEPS, nstep);
+}
+
+
+/** @brief Star formation of galaxy p over an interval dt centred at time,
+  *        which may span several substeps. snapdt is the time between
+  *        snapshots, over which the star formation rate is averaged. */
+void starformation_interval(int p, int centralgal, double time, double dt, double snapdt, int nstep)
 {
   /*! Variables: reff-Rdisk, tdyn=Rdisk/Vmax, strdot=Mstar_dot, stars=strdot*dt */
   double tdyn, strdot = 0., stars, cold_crit, metallicitySF;
 
-  if(Gal[p].Type == 0)
-    {
-      tdyn = Gal[p].GasDiskRadius / Gal[p].Vmax;
-      cold_crit = SfrColdCrit * Gal[p].Vmax / 200. * Gal[p].GasDiskRadius * 100.;
-    }
-  else
-    {
-      tdyn = Gal[p].GasDiskRadius / Gal[p].InfallVmax;
-      cold_crit = SfrColdCrit * Gal[p].InfallVmax / 200. * Gal[p].GasDiskRadius * 100.;
-    }
+  star_formation_scales(p, &tdyn, &cold_crit);
 
   //standard star formation law (Croton2006, Delucia2007, Guo2010)
   if(StarFormationModel == 0)
@@ -125,8 +165,8 @@ void starformation(int p, int centralgal, double time, double dt, int nstep)
   mass_checks("recipe_starform #2.1", centralgal);
 
   /*  update the star formation rate */
-  /*Sfr=stars/(dt*steps)=strdot*dt/(dt*steps)=strdot/steps -> average over the STEPS */
-  Gal[p].Sfr += stars / (dt * STEPS);
+  /*Sfr=stars/snapdt=strdot*dt/(dt*steps)=strdot/steps -> average over the STEPS */
+  Gal[p].Sfr += stars / snapdt;
 
 
   // update_from_star_formation can only be called
@@ -426,7 +466,7 @@ void update_from_feedback(int p, int centralgal, double reheated_mass, double ej
 
       if(Gal[p].Type == 0)
         {
-          transfer_gas(p, "Hot", p, "Cold", ((float) reheated_mass) / Gal[p].ColdGas, "update_from_feedback",
+          transfer_gas < GAS_HOT, GAS_COLD > (p, p, ((float) reheated_mass) / Gal[p].ColdGas, "update_from_feedback",
                        __LINE__);
         }
       else if(Gal[p].Type < 3)
@@ -459,13 +499,13 @@ void update_from_feedback(int p, int centralgal, double reheated_mass, double ej
             massremain = Gal[p].ColdGas - reheated_mass;
 
           //transfer massremain
-          transfer_gas(Gal[p].CentralGal, "Hot", p, "Cold", massremain / Gal[p].ColdGas,
+          transfer_gas < GAS_HOT, GAS_COLD > (Gal[p].CentralGal, p, massremain / Gal[p].ColdGas,
                        "update_from_feedback", __LINE__);
 
           //transfer reheated_mass-massremain from galaxy to the type 0
           if(reheated_mass > massremain)
             if(Gal[p].ColdGas > 0.)     //if the reheat to itself, left cold gas below limit do not reheat to central
-              transfer_gas(centralgal, "Hot", p, "Cold", (reheated_mass - massremain) / Gal[p].ColdGas,
+              transfer_gas < GAS_HOT, GAS_COLD > (centralgal, p, (reheated_mass - massremain) / Gal[p].ColdGas,
                            "update_from_feedback", __LINE__);
         }                       //types
 
@@ -485,20 +525,20 @@ void update_from_feedback(int p, int centralgal, double reheated_mass, double ej
         {
           /* If type 1, or type 2 orbiting type 1 near type 0 */
           if(FateOfSatellitesGas == 0)
-            transfer_gas(Gal[p].CentralGal, "Ejected", Gal[p].CentralGal, "Hot", fraction,
+            transfer_gas < GAS_EJECTED, GAS_HOT > (Gal[p].CentralGal, Gal[p].CentralGal, fraction,
                          "update_from_feedback", __LINE__);
           else if(FateOfSatellitesGas == 1)
             {
               if(dis < Gal[centralgal].Rvir)
-                transfer_gas(centralgal, "Hot", Gal[p].CentralGal, "Hot", fraction, "update_from_feedback",
+                transfer_gas < GAS_HOT, GAS_HOT > (centralgal, Gal[p].CentralGal, fraction, "update_from_feedback",
                              __LINE__);
               else
-                transfer_gas(Gal[p].CentralGal, "Ejected", Gal[p].CentralGal, "Hot", fraction,
+                transfer_gas < GAS_EJECTED, GAS_HOT > (Gal[p].CentralGal, Gal[p].CentralGal, fraction,
                              "update_from_feedback", __LINE__);
             }
         }
       else                      // If galaxy type 0 or type 2 merging into type 0
-        transfer_gas(centralgal, "Ejected", Gal[p].CentralGal, "Hot", fraction, "update_from_feedback",
+        transfer_gas < GAS_EJECTED, GAS_HOT > (centralgal, Gal[p].CentralGal, fraction, "update_from_feedback",
                      __LINE__);
 
     }                           //(Gal[Gal[p].CentralGal].HotGas > 0.)
@@ -556,7 +596,7 @@ void check_disk_instability(int p)
     {
       /* to calculate the bulge size */
       update_bulge_from_disk(p, stars);
-      transfer_stars(p, "Bulge", p, "Disk", fraction);
+      transfer_stars < STARS_BULGE, STARS_DISK > (p, p, fraction);
 
       if(BHGrowthInDiskInstabilityModel == 1)
         if(Gal[p].ColdGas > 0.)
@@ -574,10 +614,10 @@ void check_disk_instability(int p)
         {
           for(j = 0; j < NMAG; j++)
             {
-              Lumdisk = Gal[p].Lum[j][outputbin] - Gal[p].LumBulge[j][outputbin];
-              Gal[p].LumBulge[j][outputbin] += fraction * Lumdisk;
-              Lumdisk = Gal[p].YLum[j][outputbin] - Gal[p].YLumBulge[j][outputbin];
-              Gal[p].YLumBulge[j][outputbin] += fraction * Lumdisk;
+              Lumdisk = GALLUM(Gal[p]).Lum[j][outputbin] - GALLUM(Gal[p]).LumBulge[j][outputbin];
+              GALLUM(Gal[p]).LumBulge[j][outputbin] += fraction * Lumdisk;
+              Lumdisk = GALLUM(Gal[p]).YLum[j][outputbin] - GALLUM(Gal[p]).YLumBulge[j][outputbin];
+              GALLUM(Gal[p]).YLumBulge[j][outputbin] += fraction * Lumdisk;
             }
         }
 #endif
@@ -586,15 +626,15 @@ void check_disk_instability(int p)
         {
           for(j = 0; j < NMAG; j++)
             {
-              Lumdisk = Gal[p].ObsLum[j][outputbin] - Gal[p].ObsLumBulge[j][outputbin];
-              Gal[p].ObsLumBulge[j][outputbin] += fraction * Lumdisk;
-              Lumdisk = Gal[p].ObsYLum[j][outputbin] - Gal[p].ObsYLumBulge[j][outputbin];
-              Gal[p].ObsYLumBulge[j][outputbin] += fraction * Lumdisk;
+              Lumdisk = GALLUM(Gal[p]).ObsLum[j][outputbin] - GALLUM(Gal[p]).ObsLumBulge[j][outputbin];
+              GALLUM(Gal[p]).ObsLumBulge[j][outputbin] += fraction * Lumdisk;
+              Lumdisk = GALLUM(Gal[p]).ObsYLum[j][outputbin] - GALLUM(Gal[p]).ObsYLumBulge[j][outputbin];
+              GALLUM(Gal[p]).ObsYLumBulge[j][outputbin] += fraction * Lumdisk;
 #ifdef OUTPUT_MOMAF_INPUTS
-              Lumdisk = Gal[p].dObsLum[j][outputbin] - Gal[p].dObsLumBulge[j][outputbin];
-              Gal[p].dObsLumBulge[j][outputbin] += fraction * Lumdisk;
-              Lumdisk = Gal[p].dObsYLum[j][outputbin] - Gal[p].dObsYLumBulge[j][outputbin];
-              Gal[p].dObsYLumBulge[j][outputbin] += fraction * Lumdisk;
+              Lumdisk = GALLUM(Gal[p]).dObsLum[j][outputbin] - GALLUM(Gal[p]).dObsLumBulge[j][outputbin];
+              GALLUM(Gal[p]).dObsLumBulge[j][outputbin] += fraction * Lumdisk;
+              Lumdisk = GALLUM(Gal[p]).dObsYLum[j][outputbin] - GALLUM(Gal[p]).dObsYLumBulge[j][outputbin];
+              GALLUM(Gal[p]).dObsYLumBulge[j][outputbin] += fraction * Lumdisk;
 #endif
             }
         }
@@ -94,21 +94,21 @@ void deal_with_satellites(int centralgal, int ngal)
 
               Gal[i].HotRadius = 0.0;
               if(Gal[i].HotGas > 0.0)
-                transfer_gas(Gal[i].CentralGal, "Hot", i, "Hot", gasfraction_intotype1,
+                transfer_gas < GAS_HOT, GAS_HOT > (Gal[i].CentralGal, i, gasfraction_intotype1,
                              "deal_with_satellites", __LINE__);
               if(Gal[i].EjectedMass > 0.0)
-                transfer_gas(Gal[i].CentralGal, "Ejected", i, "Ejected", gasfraction_intotype1,
+                transfer_gas < GAS_EJECTED, GAS_EJECTED > (Gal[i].CentralGal, i, gasfraction_intotype1,
                              "deal_with_satellites", __LINE__);
 
               mass_checks("deal_with_satellites i #0", i);
               mass_checks("deal_with_satellites Gal[i].CentraGal #0", Gal[i].CentralGal);
 #ifdef TRACK_BURST
               /* Transfer burst component first */
-              transfer_stars(Gal[i].CentralGal, "Burst", i, "Burst",
+              transfer_stars < STARS_BURST, STARS_BURST > (Gal[i].CentralGal, i,
                              GasFraction_intotype1 * Gal[i].ICM / (Gal[i].DiskMass + Gal[i].BulgeMass +
                                                                    Gal[i].ICM));
 #endif
-              transfer_stars(Gal[i].CentralGal, "ICM", i, "ICM", gasfraction_intotype1);
+              transfer_stars < STARS_ICM, STARS_ICM > (Gal[i].CentralGal, i, gasfraction_intotype1);
               mass_checks("deal_with_satellites i #1", i);
               mass_checks("deal_with_satellites Gal[i].CentraGal #1", Gal[i].CentralGal);
 #ifndef POST_PROCESS_MAGS
@@ -120,16 +120,16 @@ void deal_with_satellites(int centralgal, int ngal)
               if(gasfraction_intotype1 < 1.)
                 {
                   if(Gal[i].HotGas > 0.0)
-                    transfer_gas(centralgal, "Hot", i, "Hot", 1., "deal_with_satellites", __LINE__);
+                    transfer_gas < GAS_HOT, GAS_HOT > (centralgal, i, 1., "deal_with_satellites", __LINE__);
                   if(Gal[i].EjectedMass > 0.0)
-                    transfer_gas(centralgal, "Ejected", i, "Ejected", 1., "deal_with_satellites", __LINE__);
+                    transfer_gas < GAS_EJECTED, GAS_EJECTED > (centralgal, i, 1., "deal_with_satellites", __LINE__);
 
 #ifdef TRACK_BURST
                   /* Transfer burst component first */
-                  transfer_stars(centralgal, "Burst", i, "Burst",
+                  transfer_stars < STARS_BURST, STARS_BURST > (centralgal, i,
                                  Gal[i].ICM / (Gal[i].DiskMass + Gal[i].BulgeMass + Gal[i].ICM));
 #endif
-                  transfer_stars(centralgal, "ICM", i, "ICM", 1.);
+                  transfer_stars < STARS_ICM, STARS_ICM > (centralgal, i, 1.);
                   mass_checks("deal_with_satellites #2", i);
                   mass_checks("deal_with_satellites #2", centralgal);
 #ifndef POST_PROCESS_MAGS
@@ -152,19 +152,19 @@ void deal_with_satellites(int centralgal, int ngal)
                   exit(1);
                 }
 
-              transfer_gas(merger_centre, "Hot", i, "Hot", stripped_fraction, "deal_with_satellites",
+              transfer_gas < GAS_HOT, GAS_HOT > (merger_centre, i, stripped_fraction, "deal_with_satellites",
                            __LINE__);
-              transfer_gas(merger_centre, "Ejected", i, "Ejected", stripped_fraction, "deal_with_satellites",
+              transfer_gas < GAS_EJECTED, GAS_EJECTED > (merger_centre, i, stripped_fraction, "deal_with_satellites",
                            __LINE__);
               mass_checks("deal_with_satellites #3", i);
               mass_checks("deal_with_satellites #3", merger_centre);
 #ifdef TRACK_BURST
               /* Transfer burst component first */
-              transfer_stars(merger_centre, "Burst", i, "Burst",
+              transfer_stars < STARS_BURST, STARS_BURST > (merger_centre, i,
                              stripped_fraction * Gal[i].ICM / (Gal[i].DiskMass + Gal[i].BulgeMass +
                                                                Gal[i].ICM));
 #endif
-              transfer_stars(merger_centre, "ICM", i, "ICM", stripped_fraction);
+              transfer_stars < STARS_ICM, STARS_ICM > (merger_centre, i, stripped_fraction);
               mass_checks("deal_with_satellites #4", i);
               mass_checks("deal_with_satellites #4", merger_centre);
 #ifndef POST_PROCESS_MAGS
@@ -190,14 +190,14 @@ void deal_with_satellites(int centralgal, int ngal)
            * Only galaxies within Rvir contribute to the central halo.*/
           if(dis < Gal[centralgal].Rvir && i != centralgal)
             {
-              transfer_gas(centralgal, "Hot", i, "Hot", 1., "deal_with_satellites", __LINE__);
-              transfer_gas(centralgal, "Ejected", i, "Ejected", 1., "deal_with_satellites", __LINE__);
+              transfer_gas < GAS_HOT, GAS_HOT > (centralgal, i, 1., "deal_with_satellites", __LINE__);
+              transfer_gas < GAS_EJECTED, GAS_EJECTED > (centralgal, i, 1., "deal_with_satellites", __LINE__);
 #ifdef TRACK_BURST
               /* Transfer burst component first */
-              transfer_stars(centralgal, "Burst", i, "Burst",
+              transfer_stars < STARS_BURST, STARS_BURST > (centralgal, i,
                              Gal[i].ICM / (Gal[i].DiskMass + Gal[i].BulgeMass + Gal[i].ICM));
 #endif
-              transfer_stars(centralgal, "ICM", i, "ICM", 1.);
+              transfer_stars < STARS_ICM, STARS_ICM > (centralgal, i, 1.);
 #ifndef POST_PROCESS_MAGS
 #ifdef ICL
               transfer_ICL(centralgal, i, 1.);
@@ -211,14 +211,14 @@ void deal_with_satellites(int centralgal, int ngal)
            * will be added to the type 1. */
           else if(Gal[i].Type == 2)
             {
-              transfer_gas(Gal[i].CentralGal, "Hot", i, "Hot", 1., "deal_with_satellites", __LINE__);
-              transfer_gas(Gal[i].CentralGal, "Ejected", i, "Ejected", 1., "deal_with_satellites", __LINE__);
+              transfer_gas < GAS_HOT, GAS_HOT > (Gal[i].CentralGal, i, 1., "deal_with_satellites", __LINE__);
+              transfer_gas < GAS_EJECTED, GAS_EJECTED > (Gal[i].CentralGal, i, 1., "deal_with_satellites", __LINE__);
 #ifdef TRACK_BURST
               /* Transfer burst component first */
-              transfer_stars(Gal[i].CentralGal, "Burst", i, "Burst",
+              transfer_stars < STARS_BURST, STARS_BURST > (Gal[i].CentralGal, i,
                              Gal[i].ICM / (Gal[i].DiskMass + Gal[i].BulgeMass + Gal[i].ICM));
 #endif
-              transfer_stars(Gal[i].CentralGal, "ICM", i, "ICM", 1.);
+              transfer_stars < STARS_ICM, STARS_ICM > (Gal[i].CentralGal, i, 1.);
 #ifndef POST_PROCESS_MAGS
 #ifdef ICL
               transfer_ICL(Gal[i].CentralGal, i, 1.);
@@ -21,6 +21,9 @@
 #include <cstring>
 #include <cmath>
 #include <gsl/gsl_math.h>
+#ifdef OPENMP
+#include <omp.h>
+#endif
 
 #include "allvars.h"
 #include "proto.h"
@@ -44,6 +47,16 @@ static char *FunctionName;
 static char *FileName;
 static int *LineNumber;
 
+#ifdef OPENMP
+/* every thread allocates from its own arena; MaxMemSize is split evenly
+ * between the threads, so it remains the memory used by the whole task */
+#pragma omp threadprivate(TotBytes, Base, Nblocks, Table, BlockSize, MovableFlag, BasePointers, \
+                          VarName, FunctionName, FileName, LineNumber)
+
+/* size of each thread's arena, set by the first (serial) call to mymalloc_init() */
+static size_t ArenaBytes = 0;
+#endif
+
 
 void mymalloc_init(void)
 {
@@ -62,11 +75,17 @@ void mymalloc_init(void)
   memset(FunctionName, 0, MAXBLOCKS * MAXCHARS);
   memset(FileName, 0, MAXBLOCKS * MAXCHARS);
 
+#ifdef OPENMP
+  if(ArenaBytes == 0)
+    ArenaBytes = MaxMemSize * ((size_t) 1024 * 1024) / omp_get_max_threads();
+  n = ArenaBytes;
+#else
   n = MaxMemSize * ((size_t) 1024 * 1024);
+#endif
 
   if(!(Base = malloc(n)))
     {
-      printf("Failed to allocate memory for `Base' (%g Mbytes).\n", MaxMemSize);
+      printf("Failed to allocate memory for `Base' (%g Mbytes).\n", n / (1024.0 * 1024.0));
       terminate("failure to allocate memory");
     }
 
@@ -78,6 +97,15 @@ void mymalloc_init(void)
 }
 
 
+/**@brief Sets up the memory arena of the calling thread, unless it
+ *        already has one (the main thread gets it from main()). */
+void mymalloc_init_thread(void)
+{
+  if(Base == NULL)
+    mymalloc_init();
+}
+
+
 void report_detailed_memory_usage_of_largest_task(size_t *OldHighMarkBytes, const char *label,
                                                   const char *func, const char *file, int line)
 {
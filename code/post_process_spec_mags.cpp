@@ -37,151 +37,272 @@
  *
  * */
 
-void post_process_spec_mags(struct GALAXY_OUTPUT *o)
+/* components of a galaxy whose luminosities are post-processed */
+enum
 {
-  int ll, nlum, ibin;
-  double diskmass, bulgemass, icmmass, diskmetals, bulgemetals, icmmetals, previous_lum;
-  double time, age;
-  double Zg;
+  PP_DISK,
+  PP_BULGE,
+  PP_ICL,
+  PP_NCOMP
+};
+
+/* the stars of one component in one SFH bin: mass in the units of the SSP
+ * tables and interpolation in metallicity (zero mass if the bin is empty) */
+struct post_process_pop
+{
+  double mass;
+  double fmet1, fmet2;
+  int metindex;
+};
+
+/* luminosity of each component of a galaxy in one band, summed over its
+ * SFH bins, and the part of it coming from stars younger than the birth
+ * clouds, in each of the PPLUM_ frames */
+struct post_process_lum
+{
+  double Lum[PP_NCOMP][PPLUM_NZ];
+  double YLum[PP_NCOMP][PPLUM_NZ];
+};
 
-  //double Small_Age_bin_yr=1.e11, Small_Age_bin, bin_size;
-  double Small_Age_bin_yr = 1.e6, Small_Age_bin, bin_size;
-  int i_AgeBin, MaxBins = 10000, N_AgeBin;
+/* galaxies post-processed together by post_process_spec_mags_batch() */
+#define POST_PROCESS_BATCH 32
 
-  struct SFH_BIN sfh_bins[SFH_NBIN];
+static struct post_process_pop BatchPop[POST_PROCESS_BATCH][PP_NCOMP][SFH_NBIN];
+static struct post_process_lum BatchLum[POST_PROCESS_BATCH][NMAG];
 
-  for(ll = 0; ll <= o->sfh_ibin; ll++)
-    {
-      sfh_bins[ll].sfh_DiskMass = o->sfh_DiskMass[ll];
-      sfh_bins[ll].sfh_BulgeMass = o->sfh_BulgeMass[ll];
-      sfh_bins[ll].sfh_ICM = o->sfh_ICM[ll];
-      sfh_bins[ll].sfh_MetalsDiskMass = o->sfh_MetalsDiskMass[ll];
-      sfh_bins[ll].sfh_MetalsBulgeMass = o->sfh_MetalsBulgeMass[ll];
-      sfh_bins[ll].sfh_MetalsICM = o->sfh_MetalsICM[ll];
-    }
 
-  //used for dust corrections
-  Zg = metals_total(o->MetalsColdGas) / o->ColdGas / 0.02;
+/**@brief Tabulates, for every output, SFH bin, band and SSP metallicity,
+ *        the luminosity per unit mass of the stars formed in that bin
+ *        (interpolated in age) and their age, so that post_process_spec_mags()
+ *        only interpolates in metallicity. Must be called once the SFH bins,
+ *        the output list and LumTables are set up.
+ *
+ *  The age and the age interpolation are exactly the ones that were done
+ *  for every galaxy, band and component, so the magnitudes are unchanged. */
+void init_post_process_lum_kernels(void)
+{
+  int n, snap, ll, nlum, met, iz, zindex[PPLUM_NZ], tabindex;
+  double age, bin_size, f1, f2;
 
-  o->rbandWeightAge = 0.0;
+  for(snap = 0; snap < MAXSNAPS; snap++)
+    PostProcessOutputNr[snap] = -1;
 
-  for(nlum = 0; nlum < NMAG; nlum++)
+  for(n = 0; n < NOUT; n++)
     {
-      double LumDisk = 0., LumBulge = 0., LumICL = 0.;
-      double ObsLumDisk = 0., ObsLumBulge = 0., ObsLumICL = 0.;
-      double dObsLumDisk = 0., dObsLumBulge = 0., dObsLumICL = 0.;
-      double dObsLumDisk_forward = 0., dObsLumBulge_forward = 0., dObsLumICL_forward = 0.;
-
-      double YLumDisk = 0., YLumBulge = 0., YLumICL = 0.;
-      double ObsYLumDisk = 0., ObsYLumBulge = 0., ObsYLumICL = 0.;
-      double dObsYLumDisk = 0., dObsYLumBulge = 0., dObsYLumICL = 0.;
-      double dObsYLumDisk_forward = 0., dObsYLumBulge_forward = 0., dObsYLumICL_forward = 0.;
-
-      double LumDiskDust = 0., LumBulgeDust = 0., LumICLDust = 0.;
-      double ObsLumDiskDust = 0., ObsLumBulgeDust = 0., ObsLumICLDust = 0.;
-      double dObsLumDiskDust = 0., dObsLumBulgeDust = 0., dObsLumICLDust = 0.;
-      double dObsLumDiskDust_forward = 0., dObsLumBulgeDust_forward = 0., dObsLumICLDust_forward = 0.;
-
-      previous_lum = 0.;
-      ibin = 0;
-
-      //loop on SFH bins
-      for(ll = 0; ll <= o->sfh_ibin; ll++)
-        {
-          //compute the time at beginning and end of SFH bin, divide into 10Myr steps
-          //All the SFH bins are divided into this smaller steps for the LUM calculation
-          bin_size = SFH_dt[o->SnapNum][0][ll];
-          Small_Age_bin = bin_size;     //NO SMALL BINS
-          N_AgeBin = 0;
+      snap = ListOutputSnaps[n];
+      PostProcessOutputNr[snap] = n;
 
-          for(N_AgeBin = 1; N_AgeBin <= MaxBins; N_AgeBin++)
-            {
-              //define N_AgeBin
-              if(bin_size / ((float) N_AgeBin) <= Small_Age_bin)
-                break;
-              if(N_AgeBin == MaxBins)
-                terminate("MaxBins reached in post_process_mags");
-            }
+#ifdef OUTPUT_REST_MAGS
+      zindex[PPLUM_REST] = 0;
+#endif
+#ifdef COMPUTE_OBS_MAGS
+      zindex[PPLUM_OBS] = (LastDarkMatterSnapShot + 1) - 1 - snap;
+#ifdef OUTPUT_MOMAF_INPUTS
+      zindex[PPLUM_DOBS] = (LastDarkMatterSnapShot + 1) - 1 - (snap - 1);
+#ifdef KITZBICHLER
+      zindex[PPLUM_DOBS_FORWARD] = (LastDarkMatterSnapShot + 1) - 1 - (snap + 1);
+      if(zindex[PPLUM_DOBS_FORWARD] < 0)
+        zindex[PPLUM_DOBS_FORWARD] = 0;
+#endif
+#endif
+#endif
 
-          for(i_AgeBin = 0; i_AgeBin < N_AgeBin; i_AgeBin++)
-            {
+      for(ll = 0; ll < SFH_NBIN; ll++)
+        {
+          //time at the centre of the SFH bin (the bins are not divided into smaller age bins)
+          bin_size = SFH_dt[snap][0][ll];
+          age = SFH_t[snap][0][ll] + SFH_dt[snap][0][ll] - NumToTime(snap);
+          age -= bin_size / 2.;
+          PostProcessAge[n][ll] = age;
+
+          find_interpolated_age(age, &tabindex, &f1, &f2);
+
+          for(nlum = 0; nlum < NMAG; nlum++)
+            for(met = 0; met < SSP_NMETALLICITES; met++)
+              for(iz = 0; iz < PPLUM_NZ; iz++)
+                if(zindex[iz] >= 0 && zindex[iz] < MAXSNAPS)
+                  PostProcessLumKernel[n][nlum][ll][met][iz] =
+                    f1 * LUMTABLES(nlum, met, zindex[iz], tabindex) +
+                    f2 * LUMTABLES(nlum, met, zindex[iz], tabindex + 1);
+                else
+                  PostProcessLumKernel[n][nlum][ll][met][iz] = 0.;
+        }
+    }
+}
 
-              age = SFH_t[o->SnapNum][0][ll] + SFH_dt[o->SnapNum][0][ll] - NumToTime(o->SnapNum);
-              //time at the finer age bin
 
-              age -= (bin_size / ((float) N_AgeBin) / 2. + i_AgeBin * bin_size / ((float) N_AgeBin));
+/**@brief Mass and metallicity interpolation of the stars of one
+ *        component in one SFH bin. */
+static void set_post_process_pop(struct post_process_pop *pop, float sfh_mass, float sfh_metals)
+{
+  if(!(sfh_mass > 0.0))
+    {
+      pop->mass = pop->fmet1 = pop->fmet2 = 0.;
+      pop->metindex = 0;
+      return;
+    }
 
-              /* The stellar populations tables have magnitudes for all the mass
-               * formed in stars including what will be shortly lost by SNII   */
+  /* The stellar populations tables have magnitudes for all the mass
+   * formed in stars including what will be shortly lost by SNII   */
 #ifdef DETAILED_METALS_AND_MASS_RETURN
-              diskmass = sfh_bins[ll].sfh_DiskMass * 0.1 / Hubble_h / N_AgeBin;
-              bulgemass = sfh_bins[ll].sfh_BulgeMass * 0.1 / Hubble_h / N_AgeBin;
-              icmmass = sfh_bins[ll].sfh_ICM * 0.1 / Hubble_h / N_AgeBin;
+  pop->mass = sfh_mass * 0.1 / Hubble_h;
 #else
-              diskmass = sfh_bins[ll].sfh_DiskMass * 0.1 / (Hubble_h * (1 - RecycleFraction)) / N_AgeBin;
-              bulgemass = sfh_bins[ll].sfh_BulgeMass * 0.1 / (Hubble_h * (1 - RecycleFraction)) / N_AgeBin;
-              icmmass = sfh_bins[ll].sfh_ICM * 0.1 / (Hubble_h * (1 - RecycleFraction)) / N_AgeBin;
+  pop->mass = sfh_mass * 0.1 / (Hubble_h * (1 - RecycleFraction));
 #endif //DETAILED_METALS_AND_MASS_RETURN
 
-              diskmetals = metals_total(sfh_bins[ll].sfh_MetalsDiskMass) / sfh_bins[ll].sfh_DiskMass;
-              bulgemetals = metals_total(sfh_bins[ll].sfh_MetalsBulgeMass) / sfh_bins[ll].sfh_BulgeMass;
-              icmmetals = metals_total(sfh_bins[ll].sfh_MetalsICM) / sfh_bins[ll].sfh_ICM;
+  find_interpolated_metallicity(sfh_metals / sfh_mass, &pop->metindex, &pop->fmet1, &pop->fmet2);
 
-              //Disk MAGS
-              if(sfh_bins[ll].sfh_DiskMass > 0.0)
-                compute_post_process_lum(diskmass, age, diskmetals, o->SnapNum, nlum,
-                                         &LumDisk, &ObsLumDisk, &dObsLumDisk, &dObsLumDisk_forward,
-                                         &YLumDisk, &ObsYLumDisk, &dObsYLumDisk, &dObsYLumDisk_forward);
+  // reset met index to use only solar metallicity
+  if(MetallicityOption == 0)
+    pop->metindex = 4;
+}
+
+
+static void set_post_process_pops(struct GALAXY_OUTPUT *o, struct post_process_pop pop[PP_NCOMP][SFH_NBIN])
+{
+  int ll;
+
+  if(PostProcessOutputNr[o->SnapNum] < 0)
+    terminate("post_process_spec_mags called for a snapshot that is not an output");
+
+  for(ll = 0; ll <= o->sfh_ibin; ll++)
+    {
+      set_post_process_pop(&pop[PP_DISK][ll], o->sfh_DiskMass[ll], metals_total(o->sfh_MetalsDiskMass[ll]));
+      set_post_process_pop(&pop[PP_BULGE][ll], o->sfh_BulgeMass[ll], metals_total(o->sfh_MetalsBulgeMass[ll]));
+      set_post_process_pop(&pop[PP_ICL][ll], o->sfh_ICM[ll], metals_total(o->sfh_MetalsICM[ll]));
+    }
+}
+
+
+/**@brief Sums the luminosities of a galaxy in band nlum over its SFH bins:
+ *        a product of the masses of its populations with the kernel of
+ *        its output. For the r-band (nlum==17) also accumulates the
+ *        luminosity weighted age. Empty bins add exactly zero. */
+static void sum_post_process_lum(struct GALAXY_OUTPUT *o, struct post_process_pop pop[PP_NCOMP][SFH_NBIN],
+                                 int nlum, struct post_process_lum *l)
+{
+  int ll, comp, iz, outnr = PostProcessOutputNr[o->SnapNum];
+  double age, LumToAdd, previous_lum = 0.;
+
+  /* Time below which the luminosities are corrected for extinction due to
+   * molecular birth clouds.  */
+  double tbc = 10.0 / UnitTime_in_Megayears * Hubble_h;
+
+  memset(l, 0, sizeof(struct post_process_lum));
+
+  for(ll = 0; ll <= o->sfh_ibin; ll++)
+    {
+      double (*kernel)[PPLUM_NZ] = PostProcessLumKernel[outnr][nlum][ll];
+
+      age = PostProcessAge[outnr][ll];
+
+      for(comp = 0; comp < PP_NCOMP; comp++)
+        {
+          struct post_process_pop *p = &pop[comp][ll];
+
+          for(iz = 0; iz < PPLUM_NZ; iz++)
+            {
+              LumToAdd = p->mass * (p->fmet1 * kernel[p->metindex][iz] + p->fmet2 * kernel[p->metindex + 1][iz]);
+              l->Lum[comp][iz] += LumToAdd;
+              if(age <= tbc)
+                l->YLum[comp][iz] += LumToAdd;
+            }
+        }
+
+#ifdef OUTPUT_REST_MAGS
+      //r-band weighted ages and mass weighted
+      if((o->DiskMass + o->BulgeMass) > 0.0 && nlum == 17)
+        {
+          o->rbandWeightAge += (age * (l->Lum[PP_DISK][PPLUM_REST] + l->Lum[PP_BULGE][PPLUM_REST] - previous_lum));
+          previous_lum = l->Lum[PP_DISK][PPLUM_REST] + l->Lum[PP_BULGE][PPLUM_REST];
+        }
+#endif
+    }
+}
 
-              //Bulge MAGS
-              if(sfh_bins[ll].sfh_BulgeMass > 0.0)
-                compute_post_process_lum(bulgemass, age, bulgemetals, o->SnapNum, nlum,
-                                         &LumBulge, &ObsLumBulge, &dObsLumBulge, &dObsLumBulge_forward,
-                                         &YLumBulge, &ObsYLumBulge, &dObsYLumBulge, &dObsYLumBulge_forward);
 
-              //ICL MAGS
-              if(sfh_bins[ll].sfh_ICM > 0.0)
-                compute_post_process_lum(icmmass, age, icmmetals, o->SnapNum, nlum,
-                                         &LumICL, &ObsLumICL, &dObsLumICL, &dObsLumICL_forward,
-                                         &YLumICL, &ObsYLumICL, &dObsYLumICL, &dObsYLumICL_forward);
+/**@brief Converts the luminosities of a galaxy in band nlum into
+ *        magnitudes and applies the dust corrections. */
+static void finish_post_process_mags(struct GALAXY_OUTPUT *o, int nlum, double Zg, struct post_process_lum *l)
+{
+  double LumDisk = 0., LumBulge = 0.;
+  double ObsLumDisk = 0., ObsLumBulge = 0.;
+  double dObsLumDisk = 0., dObsLumBulge = 0.;
+  double dObsLumDisk_forward = 0., dObsLumBulge_forward = 0.;
 
-              //r-band weighted ages and mass weighted
-              if((o->DiskMass + o->BulgeMass) > 0.0 && nlum == 17)
-                {
-                  o->rbandWeightAge += (age * (LumDisk + LumBulge - previous_lum));
-                  previous_lum = LumDisk + LumBulge;
-                }
+  double YLumDisk = 0., YLumBulge = 0.;
+  double ObsYLumDisk = 0., ObsYLumBulge = 0.;
+  double dObsYLumDisk = 0., dObsYLumBulge = 0.;
+  double dObsYLumDisk_forward = 0., dObsYLumBulge_forward = 0.;
 
-            }                   //end loop on smaller age bins
-        }                       //end of loop on sfh bins
+  double LumDiskDust = 0., LumBulgeDust = 0.;
+  double ObsLumDiskDust = 0., ObsLumBulgeDust = 0.;
+  double dObsLumDiskDust = 0., dObsLumBulgeDust = 0.;
+  double dObsLumDiskDust_forward = 0., dObsLumBulgeDust_forward = 0.;
 
+#ifdef OUTPUT_REST_MAGS
+  LumDisk = l->Lum[PP_DISK][PPLUM_REST];
+  LumBulge = l->Lum[PP_BULGE][PPLUM_REST];
+#ifdef ICL
+  double LumICL = l->Lum[PP_ICL][PPLUM_REST];
+#endif
+  YLumDisk = l->YLum[PP_DISK][PPLUM_REST];
+  YLumBulge = l->YLum[PP_BULGE][PPLUM_REST];
+#endif
+#ifdef COMPUTE_OBS_MAGS
+  ObsLumDisk = l->Lum[PP_DISK][PPLUM_OBS];
+  ObsLumBulge = l->Lum[PP_BULGE][PPLUM_OBS];
+#ifdef ICL
+  double ObsLumICL = l->Lum[PP_ICL][PPLUM_OBS];
+#endif
+  ObsYLumDisk = l->YLum[PP_DISK][PPLUM_OBS];
+  ObsYLumBulge = l->YLum[PP_BULGE][PPLUM_OBS];
+#ifdef OUTPUT_MOMAF_INPUTS
+  dObsLumDisk = l->Lum[PP_DISK][PPLUM_DOBS];
+  dObsLumBulge = l->Lum[PP_BULGE][PPLUM_DOBS];
+#ifdef ICL
+  double dObsLumICL = l->Lum[PP_ICL][PPLUM_DOBS];
+#endif
+  dObsYLumDisk = l->YLum[PP_DISK][PPLUM_DOBS];
+  dObsYLumBulge = l->YLum[PP_BULGE][PPLUM_DOBS];
+#ifdef KITZBICHLER
+  dObsLumDisk_forward = l->Lum[PP_DISK][PPLUM_DOBS_FORWARD];
+  dObsLumBulge_forward = l->Lum[PP_BULGE][PPLUM_DOBS_FORWARD];
+#ifdef ICL
+  double dObsLumICL_forward = l->Lum[PP_ICL][PPLUM_DOBS_FORWARD];
+#endif
+  dObsYLumDisk_forward = l->YLum[PP_DISK][PPLUM_DOBS_FORWARD];
+  dObsYLumBulge_forward = l->YLum[PP_BULGE][PPLUM_DOBS_FORWARD];
+#endif
+#endif
+#endif
 
 #ifdef FULL_SPECTRA
 #ifdef OUTPUT_REST_MAGS
-      o->Mag[nlum] = LumDisk + LumBulge;
-      o->MagBulge[nlum] = LumBulge;
+    o->Mag[nlum] = LumDisk + LumBulge;
+    o->MagBulge[nlum] = LumBulge;
 #ifdef ICL
-      o->MagICL[nlum] = LumICL;
+    o->MagICL[nlum] = LumICL;
 #endif
 #endif
 #ifdef COMPUTE_OBS_MAGS
-      o->ObsMag[nlum] = ObsLumDisk + ObsLumBulge;
-      o->ObsMagBulge[nlum] = ObsLumBulge;
+    o->ObsMag[nlum] = ObsLumDisk + ObsLumBulge;
+    o->ObsMagBulge[nlum] = ObsLumBulge;
 #ifdef ICL
-      o->ObsMagICL[nlum] = ObsLumICL;
+    o->ObsMagICL[nlum] = ObsLumICL;
 #endif
 
 #ifdef OUTPUT_MOMAF_INPUTS
-      o->dObsMag[nlum] = dObsLumDisk + dObsLumBulge;
-      o->dObsMagBulge[nlum] = dObsLumBulge;
+    o->dObsMag[nlum] = dObsLumDisk + dObsLumBulge;
+    o->dObsMagBulge[nlum] = dObsLumBulge;
 #ifdef ICL
-      o->dObsMagICL[nlum] = dObsLumICL;
+    o->dObsMagICL[nlum] = dObsLumICL;
 #endif
 #ifdef KITZBICHLER
-      o->dObsMag_forward[nlum] = dObsLumDisk_forward + dObsLumBulge_forward;
-      o->dObsMagBulge_forward[nlum] = dObsLumBulge_forward;
+    o->dObsMag_forward[nlum] = dObsLumDisk_forward + dObsLumBulge_forward;
+    o->dObsMagBulge_forward[nlum] = dObsLumBulge_forward;
 #ifdef ICL
-      o->dObsMagICL_forward[nlum] = dObsLumICL_forward;
+    o->dObsMagICL_forward[nlum] = dObsLumICL_forward;
 #endif
 #endif
 #endif //OUTPUT_MOMAF_INPUTS
@@ -190,30 +311,30 @@ void post_process_spec_mags(struct GALAXY_OUTPUT *o)
 #else //#ifndef FULL_SPECTRA
 
 #ifdef OUTPUT_REST_MAGS
-      o->Mag[nlum] = lum_to_mag(LumDisk + LumBulge);
-      o->MagBulge[nlum] = lum_to_mag(LumBulge);
+    o->Mag[nlum] = lum_to_mag(LumDisk + LumBulge);
+    o->MagBulge[nlum] = lum_to_mag(LumBulge);
 #ifdef ICL
-      o->MagICL[nlum] = lum_to_mag(LumICL);
+    o->MagICL[nlum] = lum_to_mag(LumICL);
 #endif
 #endif
 #ifdef COMPUTE_OBS_MAGS
-      o->ObsMag[nlum] = lum_to_mag(ObsLumDisk + ObsLumBulge);
-      o->ObsMagBulge[nlum] = lum_to_mag(ObsLumBulge);
+    o->ObsMag[nlum] = lum_to_mag(ObsLumDisk + ObsLumBulge);
+    o->ObsMagBulge[nlum] = lum_to_mag(ObsLumBulge);
 #ifdef ICL
-      o->ObsMagICL[nlum] = lum_to_mag(ObsLumICL);
+    o->ObsMagICL[nlum] = lum_to_mag(ObsLumICL);
 #endif
 
 #ifdef OUTPUT_MOMAF_INPUTS
-      o->dObsMag[nlum] = lum_to_mag(dObsLumDisk + dObsLumBulge);
-      o->dObsMagBulge[nlum] = lum_to_mag(dObsLumBulge);
+    o->dObsMag[nlum] = lum_to_mag(dObsLumDisk + dObsLumBulge);
+    o->dObsMagBulge[nlum] = lum_to_mag(dObsLumBulge);
 #ifdef ICL
-      o->dObsMagICL[nlum] = lum_to_mag(dObsLumICL);
+    o->dObsMagICL[nlum] = lum_to_mag(dObsLumICL);
 #endif
 #ifdef KITZBICHLER
-      o->dObsMag_forward[nlum] = lum_to_mag(dObsLumDisk_forward + dObsLumBulge_forward);
-      o->dObsMagBulge_forward[nlum] = lum_to_mag(dObsLumBulge_forward);
+    o->dObsMag_forward[nlum] = lum_to_mag(dObsLumDisk_forward + dObsLumBulge_forward);
+    o->dObsMagBulge_forward[nlum] = lum_to_mag(dObsLumBulge_forward);
 #ifdef ICL
-      o->dObsMagICL_forward[nlum] = lum_to_mag(dObsLumICL_forward);
+    o->dObsMagICL_forward[nlum] = lum_to_mag(dObsLumICL_forward);
 #endif
 #endif
 #endif //OUTPUT_MOMAF_INPUTS
@@ -221,139 +342,120 @@ void post_process_spec_mags(struct GALAXY_OUTPUT *o)
 
 #endif //FULL_SPECTRA
 
-      o->CosInclination = fabs(o->StellarSpin[2]) /
-        sqrt(o->StellarSpin[0] * o->StellarSpin[0] +
-             o->StellarSpin[1] * o->StellarSpin[1] + o->StellarSpin[2] * o->StellarSpin[2]);
+    o->CosInclination = fabs(o->StellarSpin[2]) /
+      sqrt(o->StellarSpin[0] * o->StellarSpin[0] +
+           o->StellarSpin[1] * o->StellarSpin[1] + o->StellarSpin[2] * o->StellarSpin[2]);
 
-      //Dust correction for disks (Inter-stellar Medium  + birth clouds)
-      if(o->ColdGas > 0.0)
-        dust_correction_for_post_processing(nlum, o->SnapNum, Zg, o->ColdGas, o->GasDiskRadius,
-                                            o->CosInclination, LumDisk, ObsLumDisk, dObsLumDisk,
-                                            dObsLumDisk_forward, YLumDisk, ObsYLumDisk, dObsYLumDisk,
-                                            dObsYLumDisk_forward, &LumDiskDust, &ObsLumDiskDust,
-                                            &dObsLumDiskDust, &dObsLumDiskDust_forward);
+    //Dust correction for disks (Inter-stellar Medium  + birth clouds)
+    if(o->ColdGas > 0.0)
+      dust_correction_for_post_processing(nlum, o->SnapNum, Zg, o->ColdGas, o->GasDiskRadius,
+                                          o->CosInclination, LumDisk, ObsLumDisk, dObsLumDisk,
+                                          dObsLumDisk_forward, YLumDisk, ObsYLumDisk, dObsYLumDisk,
+                                          dObsYLumDisk_forward, &LumDiskDust, &ObsLumDiskDust,
+                                          &dObsLumDiskDust, &dObsLumDiskDust_forward);
 
-      //Dust correction for bulges (remove light from young stars absorbed by birth clouds)
-      LumBulgeDust = LumBulge - YLumBulge * (1. - ExpTauBCBulge);
-      ObsLumBulgeDust = ObsLumBulge - ObsYLumBulge * (1. - ExpTauBCBulge);
-      dObsLumBulgeDust = dObsLumBulge - dObsYLumBulge * (1. - ExpTauBCBulge);
-      dObsLumBulgeDust_forward = dObsLumBulge_forward - dObsYLumBulge_forward * (1. - ExpTauBCBulge);
+    //Dust correction for bulges (remove light from young stars absorbed by birth clouds)
+    LumBulgeDust = LumBulge - YLumBulge * (1. - ExpTauBCBulge);
+    ObsLumBulgeDust = ObsLumBulge - ObsYLumBulge * (1. - ExpTauBCBulge);
+    dObsLumBulgeDust = dObsLumBulge - dObsYLumBulge * (1. - ExpTauBCBulge);
+    dObsLumBulgeDust_forward = dObsLumBulge_forward - dObsYLumBulge_forward * (1. - ExpTauBCBulge);
 
 
 #ifdef FULL_SPECTRA
 #ifdef OUTPUT_REST_MAGS
-      o->MagDust[nlum] = LumDiskDust + LumBulgeDust;
+    o->MagDust[nlum] = LumDiskDust + LumBulgeDust;
 #endif
 #ifdef COMPUTE_OBS_MAGS
-      o->ObsMagDust[nlum] = ObsLumDiskDust + ObsLumBulgeDust;
+    o->ObsMagDust[nlum] = ObsLumDiskDust + ObsLumBulgeDust;
 #ifdef OUTPUT_MOMAF_INPUTS
-      o->dObsMagDust[nlum] = dObsLumDiskDust + dObsLumBulgeDust;
+    o->dObsMagDust[nlum] = dObsLumDiskDust + dObsLumBulgeDust;
 #ifdef KITZBICHLER
-      o->dObsMagDust_forward[nlum] = dObsLumDiskDust_forward + dObsLumBulgeDust_forward;
+    o->dObsMagDust_forward[nlum] = dObsLumDiskDust_forward + dObsLumBulgeDust_forward;
 #endif
 #endif
 #endif
 #else //#ifndef FULL_SPECTRA
 #ifdef OUTPUT_REST_MAGS
-      o->MagDust[nlum] = lum_to_mag(LumDiskDust + LumBulgeDust);
+    o->MagDust[nlum] = lum_to_mag(LumDiskDust + LumBulgeDust);
 #endif
 #ifdef COMPUTE_OBS_MAGS
-      o->ObsMagDust[nlum] = lum_to_mag(ObsLumDiskDust + ObsLumBulgeDust);
+    o->ObsMagDust[nlum] = lum_to_mag(ObsLumDiskDust + ObsLumBulgeDust);
 #ifdef OUTPUT_MOMAF_INPUTS
-      o->dObsMagDust[nlum] = lum_to_mag(dObsLumDiskDust + dObsLumBulgeDust);
+    o->dObsMagDust[nlum] = lum_to_mag(dObsLumDiskDust + dObsLumBulgeDust);
 #ifdef KITZBICHLER
-      o->dObsMagDust_forward[nlum] = lum_to_mag(dObsLumDiskDust_forward + dObsLumBulgeDust_forward);
+    o->dObsMagDust_forward[nlum] = lum_to_mag(dObsLumDiskDust_forward + dObsLumBulgeDust_forward);
 #endif
 #endif
 #endif
 #endif //#ifdef FULL_SPECTRA
 
-      if((o->DiskMass + o->BulgeMass) > 0.0 && nlum == 17)
-        {
-          //LumDisk & LumBulge are sdss r-band luminosities (nlum==17)
-          o->rbandWeightAge /= (LumDisk + LumBulge);
-          o->rbandWeightAge = o->rbandWeightAge / 1000. * UnitTime_in_Megayears / Hubble_h;     //conversion in age from code units/h -> Gyr
-        }
-
-    }                           //end of loop on bands
-
+    if((o->DiskMass + o->BulgeMass) > 0.0 && nlum == 17)
+      {
+        //LumDisk & LumBulge are sdss r-band luminosities (nlum==17)
+        o->rbandWeightAge /= (LumDisk + LumBulge);
+        o->rbandWeightAge = o->rbandWeightAge / 1000. * UnitTime_in_Megayears / Hubble_h;     //conversion in age from code units/h -> Gyr
+      }
 
 }
 
-void compute_post_process_lum(double mass, double age, double metals, int snap, int nlum,
-                              double *Lum, double *ObsLum, double *dObsLum, double *dObsLum_forward,
-                              double *YLum, double *ObsYLum, double *dObsYLum, double *dObsYLum_forward)
-{
-  double tbc;
-  int metindex, tabindex, zindex;
-  double f1, f2, fmet1, fmet2;
-  double LumToAdd;
-
-  /* Time below which the luminosities are corrected for extinction due to
-   * molecular birth clouds.  */
-  tbc = 10.0 / UnitTime_in_Megayears * Hubble_h;
 
-  find_interpolated_lum(age, 0., metals, &metindex, &tabindex, &f1, &f2, &fmet1, &fmet2);
-
-  // reset met index to use only solar metallicity
-  if(MetallicityOption == 0)
-    metindex = 4;
-
-#ifdef OUTPUT_REST_MAGS
-  zindex = 0;
-  LumToAdd = mass * (fmet1 * (f1 * LumTables[nlum][metindex][zindex][tabindex] +
-                              f2 * LumTables[nlum][metindex][zindex][tabindex + 1]) +
-                     fmet2 * (f1 * LumTables[nlum][metindex + 1][zindex][tabindex] +
-                              f2 * LumTables[nlum][metindex + 1][zindex][tabindex + 1]));
-
-  *Lum += LumToAdd;
-  if(age <= tbc)
-    *YLum += LumToAdd;
-#endif
+void post_process_spec_mags(struct GALAXY_OUTPUT *o)
+{
+  int nlum;
+  double Zg;
+  struct post_process_pop pop[PP_NCOMP][SFH_NBIN];
+  struct post_process_lum lum;
 
-#ifdef COMPUTE_OBS_MAGS
-  double ObsLumToAdd;
+  /* the metallicity interpolation of each population does not depend on the band */
+  set_post_process_pops(o, pop);
 
-  zindex = (LastDarkMatterSnapShot + 1) - 1 - snap;
-  ObsLumToAdd = mass * (fmet1 * (f1 * LumTables[nlum][metindex][zindex][tabindex] +
-                                 f2 * LumTables[nlum][metindex][zindex][tabindex + 1]) +
-                        fmet2 * (f1 * LumTables[nlum][metindex + 1][zindex][tabindex] +
-                                 f2 * LumTables[nlum][metindex + 1][zindex][tabindex + 1]));
+  //used for dust corrections
+  Zg = metals_total(o->MetalsColdGas) / o->ColdGas / 0.02;
 
-  *ObsLum += ObsLumToAdd;
-  if(age <= tbc)
-    *ObsYLum += ObsLumToAdd;
+  o->rbandWeightAge = 0.0;
 
-#ifdef OUTPUT_MOMAF_INPUTS
-  double dObsLumToAdd;
+  for(nlum = 0; nlum < NMAG; nlum++)
+    {
+      sum_post_process_lum(o, pop, nlum, &lum);
+      finish_post_process_mags(o, nlum, Zg, &lum);
+    }
+}
 
-  zindex = (LastDarkMatterSnapShot + 1) - 1 - (snap - 1);
-  dObsLumToAdd = mass * (fmet1 * (f1 * LumTables[nlum][metindex][zindex][tabindex] +
-                                  f2 * LumTables[nlum][metindex][zindex][tabindex + 1]) +
-                         fmet2 * (f1 * LumTables[nlum][metindex + 1][zindex][tabindex] +
-                                  f2 * LumTables[nlum][metindex + 1][zindex][tabindex + 1]));
 
-  *dObsLum += dObsLumToAdd;
-  if(age <= tbc)
-    *dObsYLum += dObsLumToAdd;
+/**@brief Same as calling post_process_spec_mags() for o[0],...,o[n-1] in
+ *        turn, but the luminosities of up to POST_PROCESS_BATCH galaxies
+ *        are summed band by band, so that the kernel of each band is
+ *        reused for all of them. The dust corrections are then done one
+ *        galaxy at a time, which keeps the random inclinations (and so the
+ *        magnitudes) identical. Uses static buffers: not reentrant. */
+void post_process_spec_mags_batch(struct GALAXY_OUTPUT *o, int n)
+{
+  int first, nbatch, i, nlum;
+  double Zg;
 
-#ifdef KITZBICHLER
-  zindex = (LastDarkMatterSnapShot + 1) - 1 - (snap + 1);
-  if(zindex < 0)
-    zindex = 0;
-  dObsLumToAdd = mass * (fmet1 * (f1 * LumTables[nlum][metindex][zindex][tabindex] +
-                                  f2 * LumTables[nlum][metindex][zindex][tabindex + 1]) +
-                         fmet2 * (f1 * LumTables[nlum][metindex + 1][zindex][tabindex] +
-                                  f2 * LumTables[nlum][metindex + 1][zindex][tabindex + 1]));
+  for(first = 0; first < n; first += POST_PROCESS_BATCH)
+    {
+      nbatch = n - first;
+      if(nbatch > POST_PROCESS_BATCH)
+        nbatch = POST_PROCESS_BATCH;
 
-  *dObsLum_forward += dObsLumToAdd;
-  if(age <= tbc)
-    *dObsYLum_forward += dObsLumToAdd;
-#endif
+      for(i = 0; i < nbatch; i++)
+        {
+          set_post_process_pops(&o[first + i], BatchPop[i]);
+          o[first + i].rbandWeightAge = 0.0;
+        }
 
-#endif
-#endif
+      for(nlum = 0; nlum < NMAG; nlum++)
+        for(i = 0; i < nbatch; i++)
+          sum_post_process_lum(&o[first + i], BatchPop[i], nlum, &BatchLum[i][nlum]);
 
+      for(i = 0; i < nbatch; i++)
+        {
+          Zg = metals_total(o[first + i].MetalsColdGas) / o[first + i].ColdGas / 0.02;
+          for(nlum = 0; nlum < NMAG; nlum++)
+            finish_post_process_mags(&o[first + i], nlum, Zg, &BatchLum[i][nlum]);
+        }
+    }
 }
 
 
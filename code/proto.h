@@ -19,7 +19,7 @@
 #ifndef MCMC
 void SAM(int filenr);
 #endif
-void construct_galaxies(int filenr, int tree, int halonr);
+void construct_galaxies(int filenr, int tree, int fofhalo);
 int join_galaxies_of_progenitors(int halonr, int ngalstart, int *cenngal);
 void evolve_galaxies(int halonr, int ngal, int tree, int cenngal);
 
@@ -45,7 +45,8 @@ void save_galaxy_tree_append(int i);
 void save_galaxy_tree_finalize(int filenr, int tree);
 void prepare_galaxy_tree_info_for_output(int filenr, int tree, struct galaxy_tree_data *g,
                                          struct GALAXY_OUTPUT *o);
-int walk_galaxy_tree(int nr);
+int walk_galaxy_tree(int nr, int *stack);
+int walk_galaxy_tree_next(int nr);
 int save_galaxy_tree_compare(const void *a, const void *b);
 
 void save_galaxy_append(int tree, int i, int n);
@@ -65,8 +66,11 @@ void *mymalloc_fullinfo(const char *varname, size_t n, const char *func, const c
 void report_detailed_memory_usage_of_largest_task(size_t *OldHighMarkBytes, const char *label,
                                                   const char *func, const char *file, int line);
 void mymalloc_init(void);
+void mymalloc_init_thread(void);
 
 void save_galaxy_tree_reorder_on_disk(void);
+void save_galaxy_tree_reorder_in_memory(void);
+void save_galaxy_tree_info_on_disk(int filenr, int tree);
 int save_galaxy_tree_mp_comp(const void *a, const void *b);
 
 void get_coordinates(float *pos, float *vel, long long ID, int tree, int halonr, int snapnum);
@@ -74,7 +78,9 @@ void get_coordinates(float *pos, float *vel, long long ID, int tree, int halonr,
 
 //functions used to scale to a different cosmology
 void read_scaling_parameters();
+void init_scale_cosmology();
 void scale_cosmology(int nhalos);
+void scale_halos(struct halo_data *halo, int nhalos);
 void un_scale_cosmology(int nhalos);
 void read_zlist_original_cosm(void);
 void read_zlist_new(void);
@@ -90,9 +96,23 @@ void prepare_galaxy_tree_info_for_output(int filenr, int tree, struct galaxy_tre
 
 void init(void);
 void set_units(void);
+#ifdef OPENMP
+void init_thread(void);
+void write_galaxy_output_buffer(int tree);
+#endif
 
 void load_tree_table(int filenr);
 void load_tree(int nr);
+#ifdef PREFETCH_TREES
+void init_tree_prefetch(void);
+void free_tree_prefetch(void);
+void load_tree_from_slot(int nr);
+#endif
+#ifdef MMAP_TREES
+char *map_input_file(FILE * fd, size_t * size);
+void advise_mapped_range(void *start, size_t length, int advice);
+#endif
+void build_fof_schedule(int nr);
 void save_galaxies(int filenr, int tree);
 int save_galaxy_tree_compare(const void *a, const void *b);
 void prepare_galaxy_for_output(int n, struct GALAXY *g, struct GALAXY_OUTPUT *o);
@@ -110,8 +130,20 @@ void read_file_nrs(void);
 #endif
 float get_nr_files_to_process(int ThisTask);
 void assign_files_to_tasks(int *FileToProcess, int *TaskToProcess, int ThisTask, int NTask, int nfiles);
+#ifdef DYNAMIC_FILE_ASSIGNMENT
+int get_tree_file_nhalos(int filenr);
+void sort_files_by_cost(int *FileToProcess, int *TaskToProcess, int nfiles);
+void init_file_counter(void);
+int get_next_file_to_process(void);
+void free_file_counter(void);
+#endif
 
 void starformation(int p, int centralgal, double time, double dt, int nstep);
+void starformation_interval(int p, int centralgal, double time, double dt, double snapdt, int nstep);
+#ifdef ADAPTIVE_SUBSTEPS
+int galaxy_is_quiescent(int p);
+void report_adaptive_substeps(int filenr);
+#endif
 void update_stars_due_to_reheat(int p, int centralgal, double *stars);
 void update_from_star_formation(int p, double stars, bool flag_burst, int nstep);
 void SN_feedback(int p, int centralgal, double stars, const char feedback_location[]);
@@ -120,15 +152,37 @@ void update_massweightage(int p, double stars, double time);
 
 void add_galaxies_together(int t, int p);
 void init_galaxy(int p, int halonr);
-double infall_recipe(int centralgal, int ngal, double Zcurr);
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifndef POST_PROCESS_MAGS
+int new_galaxy_lum(void);
+void free_galaxy_lum(int i);
+int copy_galaxy_lum_for_output(int i, int snapnum);
+#endif
+#endif
+#ifdef GALAXY_SOA
+void alloc_galaxy_soa(int ngal);
+void free_galaxy_soa(void);
+void gather_galaxy_soa(int ngal);
+#endif
+double infall_recipe(int centralgal, int ngal);
 void add_infall_to_hot(int centralgal, double infallingGas);
-void compute_cooling(int p, double dt, int ngal);
-void do_AGN_heating(double dt, int ngal);
+double get_cooling_rate(int p);
+void compute_cooling_rates(int ngal, double *lambda);
+void compute_cooling(int p, double dt, int ngal, double lambda);
+#ifdef GALAXY_SOA
+void compute_cooling_soa(int ngal, double dt, double *lambda);
+#endif
+void do_AGN_heating(double dt, int ngal, const char *skip);
+void do_AGN_heating_galaxy(int p, int FoFCentralGal, double dt);
 void cool_gas_onto_galaxy(int p, double dt);
 void reincorporate_gas(int p, double dt);
+#ifdef GALAXY_SOA
+void reincorporate_gas_soa(int ngal, double dt);
+#endif
 void deal_with_galaxy_merger(int p, int merger_centralgal, int centralgal, double time, double deltaT,
                              int nstep);
-double do_reionization(float Mvir, double Zcurr);
+double do_reionization(float Mvir, double Mchar);
+double reionization_mass(double Zcurr);
 double NumToTime(int snapnum);
 
 
@@ -145,6 +199,9 @@ void free_vector(double *v, long nl, long nh);
 //SPECTRO/PHOTOMETRY PROPERTIES
 #ifdef COMPUTE_SPECPHOT_PROPERTIES
 
+unsigned long long phottables_config_hash(void);
+int read_phottables_cache(const char *dir, const char *kind, unsigned long long key);
+int write_phottables_cache(const char *dir, const char *kind, unsigned long long key);
 #ifdef PHOTTABLES_PRECOMPUTED
 void setup_LumTables_precomputed(const char SimName[]);
 #endif
@@ -178,12 +235,17 @@ void interpolate(double *lgrid, int Grid_Length, double *lambda, int nlambda, do
 
 void find_interpolated_lum(double timenow, double timetarget, double metallicity, int *metindex,
                            int *tabindex, double *f1, double *f2, double *fmet1, double *fmet2);
+void find_interpolated_age(double age, int *tabindex, double *f1, double *f2);
+void find_interpolated_metallicity(double metallicity, int *metindex, double *fmet1, double *fmet2);
+#ifndef POST_PROCESS_MAGS
+void init_lum_age_weights(void);
+struct lum_age_weights *get_lum_age_weights(int p, double time, double dt);
+#endif
 
 #ifdef POST_PROCESS_MAGS
 void post_process_spec_mags(struct GALAXY_OUTPUT *o);
-void compute_post_process_lum(double mass, double age, double metals, int snap, int nlum, double *Lum,
-                              double *ObsLum, double *dObsLum, double *dObsLum_forward, double *YLum,
-                              double *ObsYLum, double *dObsYLum, double *dObsYLum_forward);
+void init_post_process_lum_kernels(void);
+void post_process_spec_mags_batch(struct GALAXY_OUTPUT *o, int n);
 void dust_correction_for_post_processing(int nlum, int snap, double Zg, double ColdGas, double GasDiskRadius,
                                          double CosInclination, double LumDisk, double ObsLumDisk,
                                          double dObsLumDisk, double dObsLumDisk_forward, double YLumDisk,
@@ -198,6 +260,7 @@ void dust_model(int p, int snap, int halonr);
 // dust model
 void read_dust_tables(void);
 double get_extinction(int mag, double Zg, double redshift);
+void seed_dust_inclinations(long seed);
 
 #endif //COMPUTE_SPECPHOT_PROPERTIES
 
@@ -211,6 +274,7 @@ double estimate_merging_time(int halonr, int mostmassive, int p);
 double hubble_of_z(int halonr);
 double get_virial_velocity(int halonr);
 double get_virial_radius(int halonr);
+void set_halo_virial_properties(int nhalos);
 double get_virial_mass(int halonr);
 double collisional_starburst_recipe(double mass_ratio, int merger_centralgal, int centralgal, double time,
                                     double deltaT);
@@ -235,11 +299,13 @@ void read_zlist(void);
 
 void read_cooling_functions(void);
 double get_metaldependent_cooling_rate(double logTemp, double logZ);
-double get_rate(int tab, double logTemp);
+void get_metaldependent_cooling_rates(int n, const double *logTemp, const double *logZ, double *rate);
+void init_cooling_tables(void);
 
 double time_to_present(double z);
 double integrand_time_to_present(double a, void *param);
 void find_interpolate_reionization(double zcurr, int *tabindex, double *f1, double *f2);
+void init_snapshot_factors(void);
 
 void init_jump_index(void);
 int get_jump_index(double age);
@@ -280,6 +346,7 @@ void transfer_gas(int p, const char cp[], int q, const char cq[], double fractio
                   int line);
 void deal_with_satellites(int centralgal, int ngal);
 void mass_checks(const char *string, int igal);
+unsigned long long hash_bytes(const void *data, size_t n, unsigned long long h);
 
 #ifdef STAR_FORMATION_HISTORY
 void sfh_initialise(int p);
@@ -362,3 +429,262 @@ void reset_ejection_rates(int i, int sfh_ibin,
 #endif //DETAILED_METALS_AND_MASS_RETURN
 
 void print_galaxy(char string[], int p, int halonr);
+
+
+/* Typed mass transfers. The reservoirs are template parameters, so each call
+ * site compiles to the field updates for its pair of components; the string
+ * versions of transfer_gas() and transfer_stars() only dispatch to these. */
+
+template < int c > struct gas_reservoir;
+
+template <> struct gas_reservoir <GAS_COLD >
+{
+  static constexpr const char *name = "Cold";
+  static float &mass(struct GALAXY &g) { return g.ColdGas; }
+  static auto &metals(struct GALAXY &g) { return g.MetalsColdGas; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static auto &elements(struct GALAXY &g) { return g.ColdGas_elements; }
+#endif
+};
+
+template <> struct gas_reservoir <GAS_HOT >
+{
+  static constexpr const char *name = "Hot";
+  static float &mass(struct GALAXY &g) { return g.HotGas; }
+  static auto &metals(struct GALAXY &g) { return g.MetalsHotGas; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static auto &elements(struct GALAXY &g) { return g.HotGas_elements; }
+#endif
+};
+
+template <> struct gas_reservoir <GAS_EJECTED >
+{
+  static constexpr const char *name = "Ejected";
+  static float &mass(struct GALAXY &g) { return g.EjectedMass; }
+  static auto &metals(struct GALAXY &g) { return g.MetalsEjectedMass; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static auto &elements(struct GALAXY &g) { return g.EjectedMass_elements; }
+#endif
+};
+
+/** @brief Transfers a fraction of component from of galaxy q onto component
+ *         to of galaxy p. */
+template < gas_component to, gas_component from >
+void transfer_gas(int p, int q, double fraction, const char call_function[], int call_line)
+{
+  typedef gas_reservoir < to > dst;
+  typedef gas_reservoir < from > src;
+
+  if(fraction > 1.)
+    {
+      char sbuf[1000];
+
+      sprintf(sbuf,
+              "\nparent call from: %s, line %d \ntransfer_gas: fraction>1\nfraction = %.11f\nFrom '%s' to '%s\n",
+              call_function, call_line, fraction, src::name, dst::name);
+      terminate(sbuf);
+    }
+
+  //Mass and Metals to be transfered
+  float Mass = fraction * src::mass(Gal[q]);
+  auto Metals = metals_add(metals_init(), src::metals(Gal[q]), fraction);
+#ifdef INDIVIDUAL_ELEMENTS
+  struct elements Yield = elements_add(elements_init(), src::elements(Gal[q]), fraction);
+#endif
+
+  //Add to galaxy p
+  dst::mass(Gal[p]) += Mass;
+  dst::metals(Gal[p]) = metals_add(dst::metals(Gal[p]), Metals, 1.);
+#ifdef INDIVIDUAL_ELEMENTS
+  dst::elements(Gal[p]) = elements_add(dst::elements(Gal[p]), Yield, 1.);
+#endif
+#ifdef METALS_SELF
+  if(to == GAS_HOT && p == q)
+    Gal[p].MetalsHotGasSelf = metals_add(Gal[p].MetalsHotGasSelf, Metals, 1.);
+#endif
+
+  //Subtract from galaxy q
+  src::mass(Gal[q]) -= Mass;
+  src::metals(Gal[q]) = metals_add(src::metals(Gal[q]), Metals, -1.);
+#ifdef INDIVIDUAL_ELEMENTS
+  src::elements(Gal[q]) = elements_add(src::elements(Gal[q]), Yield, -1.);
+#endif
+#ifdef METALS_SELF
+  if(from == GAS_HOT)
+    Gal[q].MetalsHotGasSelf = metals_add(Gal[q].MetalsHotGasSelf, Metals, -1.);
+#endif
+}
+
+
+template < int c > struct star_reservoir;
+
+template <> struct star_reservoir <STARS_DISK >
+{
+  static constexpr const char *name = "Disk";
+  static float &mass(struct GALAXY &g) { return g.DiskMass; }
+  static auto &metals(struct GALAXY &g) { return g.MetalsDiskMass; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static auto &elements(struct GALAXY &g) { return g.DiskMass_elements; }
+#endif
+#ifdef STAR_FORMATION_HISTORY
+  static float *sfh_mass(struct GALAXY &g) { return g.sfh_DiskMass; }
+  static auto *sfh_metals(struct GALAXY &g) { return g.sfh_MetalsDiskMass; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static struct elements *sfh_elements(struct GALAXY &g) { return g.sfh_ElementsDiskMass; }
+#endif
+#endif
+};
+
+template <> struct star_reservoir <STARS_BULGE >
+{
+  static constexpr const char *name = "Bulge";
+  static float &mass(struct GALAXY &g) { return g.BulgeMass; }
+  static auto &metals(struct GALAXY &g) { return g.MetalsBulgeMass; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static auto &elements(struct GALAXY &g) { return g.BulgeMass_elements; }
+#endif
+#ifdef STAR_FORMATION_HISTORY
+  static float *sfh_mass(struct GALAXY &g) { return g.sfh_BulgeMass; }
+  static auto *sfh_metals(struct GALAXY &g) { return g.sfh_MetalsBulgeMass; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static struct elements *sfh_elements(struct GALAXY &g) { return g.sfh_ElementsBulgeMass; }
+#endif
+#endif
+};
+
+template <> struct star_reservoir <STARS_ICM >
+{
+  static constexpr const char *name = "ICM";
+  static float &mass(struct GALAXY &g) { return g.ICM; }
+  static auto &metals(struct GALAXY &g) { return g.MetalsICM; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static auto &elements(struct GALAXY &g) { return g.ICM_elements; }
+#endif
+#ifdef STAR_FORMATION_HISTORY
+  static float *sfh_mass(struct GALAXY &g) { return g.sfh_ICM; }
+  static auto *sfh_metals(struct GALAXY &g) { return g.sfh_MetalsICM; }
+#ifdef INDIVIDUAL_ELEMENTS
+  static struct elements *sfh_elements(struct GALAXY &g) { return g.sfh_ElementsICM; }
+#endif
+#endif
+};
+
+void transfer_stars_check(int p, int q, double fraction);
+
+/** @brief Transfers a fraction of component from of galaxy q onto component
+ *         to of galaxy p. The burst mass is not a separate component and is
+ *         only moved by transfer_stars<STARS_BURST, STARS_BURST>(). */
+template < star_component to, star_component from >
+void transfer_stars(int p, int q, double fraction)
+{
+  typedef star_reservoir < to > dst;
+  typedef star_reservoir < from > src;
+#ifdef STAR_FORMATION_HISTORY
+  int i;
+#endif
+
+#ifdef TRACK_BURST
+  static_assert(to != STARS_BURST && from != STARS_BURST, "transfer_stars: used incorrectly with BurstMass");
+#endif
+
+#ifdef STAR_FORMATION_HISTORY
+  if(fraction > 1. || Gal[p].sfh_ibin != Gal[q].sfh_ibin)
+#else
+  if(fraction > 1.)
+#endif
+    transfer_stars_check(p, q, fraction);
+
+  //Mass and metals to be transfered
+  float Mass = fraction * src::mass(Gal[q]);
+  auto Metals = metals_add(metals_init(), src::metals(Gal[q]), fraction);
+#ifdef INDIVIDUAL_ELEMENTS
+  struct elements Yield = elements_add(elements_init(), src::elements(Gal[q]), fraction);
+#endif
+#ifdef STAR_FORMATION_HISTORY
+  float sfh_Mass[SFH_NBIN];
+  decltype(Metals) sfh_Metals[SFH_NBIN];
+#ifdef INDIVIDUAL_ELEMENTS
+  struct elements sfh_Elements[SFH_NBIN];
+#endif
+
+  for(i = 0; i <= Gal[q].sfh_ibin; i++)
+    {
+      sfh_Mass[i] = fraction * src::sfh_mass(Gal[q])[i];
+      sfh_Metals[i] = metals_add(metals_init(), src::sfh_metals(Gal[q])[i], fraction);
+#ifdef INDIVIDUAL_ELEMENTS
+      sfh_Elements[i] = elements_add(elements_init(), src::sfh_elements(Gal[q])[i], fraction);
+#endif
+    }
+#endif
+
+  //Add to galaxy p
+  dst::mass(Gal[p]) += Mass;
+  dst::metals(Gal[p]) = metals_add(dst::metals(Gal[p]), Metals, 1.);
+#ifdef INDIVIDUAL_ELEMENTS
+  dst::elements(Gal[p]) = elements_add(dst::elements(Gal[p]), Yield, 1.);
+#endif
+#ifdef STAR_FORMATION_HISTORY
+  for(i = 0; i <= Gal[p].sfh_ibin; i++)
+    {
+      dst::sfh_mass(Gal[p])[i] += sfh_Mass[i];
+      dst::sfh_metals(Gal[p])[i] = metals_add(dst::sfh_metals(Gal[p])[i], sfh_Metals[i], 1.);
+#ifdef INDIVIDUAL_ELEMENTS
+      dst::sfh_elements(Gal[p])[i] = elements_add(dst::sfh_elements(Gal[p])[i], sfh_Elements[i], 1.);
+#endif
+    }
+#endif
+
+  //Subtract from galaxy q
+  src::mass(Gal[q]) -= Mass;
+  src::metals(Gal[q]) = metals_add(src::metals(Gal[q]), Metals, -1.);
+#ifdef INDIVIDUAL_ELEMENTS
+  src::elements(Gal[q]) = elements_add(src::elements(Gal[q]), Yield, -1.);
+#endif
+#ifdef STAR_FORMATION_HISTORY
+  for(i = 0; i <= Gal[q].sfh_ibin; i++)
+    {
+      src::sfh_mass(Gal[q])[i] -= sfh_Mass[i];
+      src::sfh_metals(Gal[q])[i] = metals_add(src::sfh_metals(Gal[q])[i], sfh_Metals[i], -1.);
+#ifdef INDIVIDUAL_ELEMENTS
+      src::sfh_elements(Gal[q])[i] = elements_add(src::sfh_elements(Gal[q])[i], sfh_Elements[i], -1.);
+#endif
+    }
+#endif
+}
+
+#ifdef TRACK_BURST
+/** @brief Moves the burst mass along with the stars: it carries no metals and,
+ *         as in the original string version, the source BurstMass itself is
+ *         left unchanged. */
+template <> inline void transfer_stars < STARS_BURST, STARS_BURST > (int p, int q, double fraction)
+{
+#ifdef STAR_FORMATION_HISTORY
+  int i;
+
+  if(fraction > 1. || Gal[p].sfh_ibin != Gal[q].sfh_ibin)
+#else
+  if(fraction > 1.)
+#endif
+    transfer_stars_check(p, q, fraction);
+
+  float Mass = fraction * Gal[q].BurstMass;
+#ifdef STAR_FORMATION_HISTORY
+  float sfh_Mass[SFH_NBIN];
+
+  for(i = 0; i <= Gal[q].sfh_ibin; i++)
+    sfh_Mass[i] = fraction * Gal[q].sfh_BurstMass[i];
+#endif
+
+  Gal[p].BurstMass += Mass;
+#ifdef STAR_FORMATION_HISTORY
+  for(i = 0; i <= Gal[p].sfh_ibin; i++)
+    Gal[p].sfh_BurstMass[i] += sfh_Mass[i];
+#endif
+
+  Gal[q].BurstMass -= 0.;
+#ifdef STAR_FORMATION_HISTORY
+  for(i = 0; i <= Gal[q].sfh_ibin; i++)
+    Gal[q].sfh_BurstMass[i] -= sfh_Mass[i];
+#endif
+}
+#endif
@@ -79,6 +79,12 @@ void read_parameter_file(char *fname)
   id[nt++] = STRING;
 #endif
 
+#ifdef SCALED_TREE_CACHE
+  strcpy(tag[nt], "ScaledTreeCacheDir");
+  addr[nt] = ScaledTreeCacheDir;
+  id[nt++] = STRING;
+#endif
+
   strcpy(tag[nt], "SpecPhotDir");
   addr[nt] = SpecPhotDir;
   id[nt++] = STRING;
@@ -463,6 +469,14 @@ void read_parameter_file(char *fname)
   addr[nt] = &SfrColdCrit;
   id[nt++] = DOUBLE;
 
+  strcpy(tag[nt], "QuiescentHotGas");
+  addr[nt] = &QuiescentHotGas;
+  id[nt++] = DOUBLE;
+
+  strcpy(tag[nt], "QuiescentColdGas");
+  addr[nt] = &QuiescentColdGas;
+  id[nt++] = DOUBLE;
+
   strcpy(tag[nt], "SfrBurstEfficiency");
   addr[nt] = &SfrBurstEfficiency;
   id[nt++] = DOUBLE;
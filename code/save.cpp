@@ -20,6 +20,9 @@
 #include <ctime>
 #include "allvars.h"
 #include "proto.h"
+#ifdef ASYNC_OUTPUT
+#include <pthread.h>
+#endif
 
 
 /**@file save.c
@@ -59,6 +62,129 @@
  *        */
 
 
+#ifdef ASYNC_OUTPUT
+/* Galaxies are handed by save_galaxy_append() to an output thread through
+ * a ring of OUTPUT_QUEUE_LENGTH records. The thread does the magnitude
+ * post-processing and collects the records of each output file into
+ * buffers before writing them. The buffers of all the output files take
+ * OUTPUT_BUFFER_FRACTION of MaxMemSize and come from the mymalloc() arena.
+ * A single thread takes the records in the order they are queued, so
+ * the files (and the random dust inclinations) are the same as when
+ * galaxies are written directly. The thread never calls mymalloc(). */
+#define OUTPUT_QUEUE_LENGTH 1024
+
+static struct GALAXY_OUTPUT *OutputQueue;
+static int *OutputQueueSnap;
+static int OutputQueueHead, OutputQueueCount, OutputQueueDone;
+static pthread_t OutputThread;
+static pthread_mutex_t OutputQueueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t OutputQueueNotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t OutputQueueNotFull = PTHREAD_COND_INITIALIZER;
+
+static struct GALAXY_OUTPUT *OutputFileBuf[NOUT];
+static int NOutputFileBuf[NOUT], MaxOutputFileBuf;
+
+static void flush_output_file_buffer(int n)
+{
+  myfwrite(OutputFileBuf[n], sizeof(struct GALAXY_OUTPUT), NOutputFileBuf[n], FdGalDumps[n]);
+  NOutputFileBuf[n] = 0;
+}
+
+static void *output_thread(void *arg)
+{
+  int slot, nslots, i, n;
+
+  while(1)
+    {
+      pthread_mutex_lock(&OutputQueueMutex);
+      while(OutputQueueCount == 0 && !OutputQueueDone)
+        pthread_cond_wait(&OutputQueueNotEmpty, &OutputQueueMutex);
+      if(OutputQueueCount == 0)
+        {
+          pthread_mutex_unlock(&OutputQueueMutex);
+          break;
+        }
+      /* take all the queued records up to the end of the ring */
+      slot = OutputQueueHead;
+      nslots = OutputQueueCount;
+      if(nslots > OUTPUT_QUEUE_LENGTH - slot)
+        nslots = OUTPUT_QUEUE_LENGTH - slot;
+      pthread_mutex_unlock(&OutputQueueMutex);
+
+      /* the slots stay ours until OutputQueueHead is advanced */
+#ifdef COMPUTE_SPECPHOT_PROPERTIES
+#ifdef POST_PROCESS_MAGS
+      post_process_spec_mags_batch(&OutputQueue[slot], nslots);
+#endif
+#endif
+      for(i = slot; i < slot + nslots; i++)
+        {
+          n = OutputQueueSnap[i];
+          if(NOutputFileBuf[n] == MaxOutputFileBuf)
+            flush_output_file_buffer(n);
+          memcpy(&OutputFileBuf[n][NOutputFileBuf[n]++], &OutputQueue[i], sizeof(struct GALAXY_OUTPUT));
+        }
+
+      pthread_mutex_lock(&OutputQueueMutex);
+      OutputQueueHead = (OutputQueueHead + nslots) % OUTPUT_QUEUE_LENGTH;
+      OutputQueueCount -= nslots;
+      pthread_cond_signal(&OutputQueueNotFull);
+      pthread_mutex_unlock(&OutputQueueMutex);
+    }
+
+  for(n = 0; n < NOUT; n++)
+    flush_output_file_buffer(n);
+
+  return NULL;
+}
+
+/**@brief Allocates the output queue and file buffers for the current
+ *        file and starts the output thread. */
+static void start_output_thread(void)
+{
+  int n;
+
+  MaxOutputFileBuf = OUTPUT_BUFFER_FRACTION * MaxMemSize * 1024. * 1024. / NOUT / sizeof(struct GALAXY_OUTPUT);
+  if(MaxOutputFileBuf < 1)
+    MaxOutputFileBuf = 1;
+
+  OutputQueue =
+    static_cast < GALAXY_OUTPUT * >(mymalloc("OutputQueue", sizeof(struct GALAXY_OUTPUT) * OUTPUT_QUEUE_LENGTH));
+  OutputQueueSnap = static_cast < int *>(mymalloc("OutputQueueSnap", sizeof(int) * OUTPUT_QUEUE_LENGTH));
+  for(n = 0; n < NOUT; n++)
+    {
+      OutputFileBuf[n] =
+        static_cast < GALAXY_OUTPUT * >(mymalloc("OutputFileBuf", sizeof(struct GALAXY_OUTPUT) * MaxOutputFileBuf));
+      NOutputFileBuf[n] = 0;
+    }
+
+  OutputQueueHead = OutputQueueCount = OutputQueueDone = 0;
+
+  if(pthread_create(&OutputThread, NULL, output_thread, NULL) != 0)
+    terminate("could not start the output thread");
+}
+
+/**@brief Lets the output thread write what is left in the queue and
+ *        its buffers, then frees them. */
+static void stop_output_thread(void)
+{
+  int n;
+
+  pthread_mutex_lock(&OutputQueueMutex);
+  OutputQueueDone = 1;
+  pthread_cond_signal(&OutputQueueNotEmpty);
+  pthread_mutex_unlock(&OutputQueueMutex);
+
+  pthread_join(OutputThread, NULL);
+
+  for(n = NOUT - 1; n >= 0; n--)
+    myfree(OutputFileBuf[n]);
+  myfree(OutputQueueSnap);
+  myfree(OutputQueue);
+}
+#endif //ASYNC_OUTPUT
+
+
 void create_galaxy_files(int filenr)
 {
   // create output files - snapshot option
@@ -84,12 +210,20 @@ void create_galaxy_files(int filenr)
 
       TotGalaxies[n] = 0;
     }
+
+#ifdef ASYNC_OUTPUT
+  start_output_thread();
+#endif
 }
 
 void close_galaxy_files(void)
 {
   int n;
 
+#ifdef ASYNC_OUTPUT
+  stop_output_thread();
+#endif
+
   for(n = 0; n < NOUT; n++)
     {
       fseek(FdGalDumps[n], 0, SEEK_SET);
@@ -119,16 +253,72 @@ void close_galaxy_files(void)
  */
 void save_galaxy_append(int tree, int i, int n)
 {
+#ifdef OPENMP
+  /* trees are done by several threads: keep the galaxy until
+   * write_galaxy_output_buffer() is called in tree order */
+  if(NGalOutputBuf >= MaxGalOutputBuf)
+    {
+      MaxGalOutputBuf = ALLOC_INCREASE_FACTOR * MaxGalOutputBuf + 1;
+      GalOutputBuf = static_cast < GALAXY_OUTPUT * >(myrealloc_movable(GalOutputBuf,
+                                                                         sizeof(struct GALAXY_OUTPUT) *
+                                                                         MaxGalOutputBuf));
+      GalOutputBufSnap =
+        static_cast < int *>(myrealloc_movable(GalOutputBufSnap, sizeof(int) * MaxGalOutputBuf));
+    }
+
+  prepare_galaxy_for_output(n, &HaloGal[i], &GalOutputBuf[NGalOutputBuf]);
+  GalOutputBufSnap[NGalOutputBuf++] = n;
+#else
+#ifdef ASYNC_OUTPUT
+  int slot;
+
+  pthread_mutex_lock(&OutputQueueMutex);
+  while(OutputQueueCount == OUTPUT_QUEUE_LENGTH)
+    pthread_cond_wait(&OutputQueueNotFull, &OutputQueueMutex);
+  slot = (OutputQueueHead + OutputQueueCount) % OUTPUT_QUEUE_LENGTH;
+  pthread_mutex_unlock(&OutputQueueMutex);
+
+  /* the slot is not seen by the output thread until OutputQueueCount is increased */
+  prepare_galaxy_for_output(n, &HaloGal[i], &OutputQueue[slot]);
+  OutputQueueSnap[slot] = n;
+
+  pthread_mutex_lock(&OutputQueueMutex);
+  OutputQueueCount++;
+  pthread_cond_signal(&OutputQueueNotEmpty);
+  pthread_mutex_unlock(&OutputQueueMutex);
+#else
   struct GALAXY_OUTPUT galaxy_output;
 
   prepare_galaxy_for_output(n, &HaloGal[i], &galaxy_output);
   myfwrite(&galaxy_output, sizeof(struct GALAXY_OUTPUT), 1, FdGalDumps[n]);
+#endif
 
   TotGalaxies[n]++;             //this will be written later
+#endif
   TreeNgals[n][tree]++;         //this will be written later (Number of galaxies in each tree)
 }
 
 
+#ifdef OPENMP
+/**@brief Writes the galaxies buffered by save_galaxy_append() for the
+ *        current tree into the output files. Called by SAM() for one
+ *        tree at a time in tree order, so the files are the same as
+ *        when galaxies are written as soon as they are done. */
+void write_galaxy_output_buffer(int tree)
+{
+  int i;
+
+  for(i = 0; i < NGalOutputBuf; i++)
+    {
+      myfwrite(&GalOutputBuf[i], sizeof(struct GALAXY_OUTPUT), 1, FdGalDumps[GalOutputBufSnap[i]]);
+      TotGalaxies[GalOutputBufSnap[i]]++;
+    }
+
+  NGalOutputBuf = 0;
+}
+#endif
+
+
  /*@brief Copies all the relevant properties from the Galaxy structure
     into the Galaxy output structure, some units are corrected. */
 void prepare_galaxy_for_output(int n, struct GALAXY *g, struct GALAXY_OUTPUT *o)
@@ -163,7 +353,7 @@ void prepare_galaxy_for_output(int n, struct GALAXY *g, struct GALAXY_OUTPUT *o)
 #ifdef OUTPUT_REST_MAGS
   /* Luminosities are converted into Mags in various bands */
   for(j = 0; j < NMAG; j++)
-    o->Mag[j] = lum_to_mag(g->Lum[j][n]);
+    o->Mag[j] = lum_to_mag(GALLUM(*g).Lum[j][n]);
 #endif
 #endif //ndef POST_PROCESS_MAGS
 #endif //COMPUTE_SPECPHOT_PROPERTIES
@@ -182,19 +372,7 @@ void prepare_galaxy_for_output(int n, struct GALAXY *g, struct GALAXY_OUTPUT *o)
 
   o->SubID = calc_big_db_subid_index(g->SnapNum, Halo[g->HaloNr].FileNr, Halo[g->HaloNr].SubhaloIndex);
 
-  int tmpfirst = Halo[g->HaloNr].FirstHaloInFOFgroup;
-  int lenmax = 0;
-  int next = tmpfirst;
-
-  while(next != -1)
-    {
-      if(Halo[next].Len > lenmax)
-        {
-          lenmax = Halo[next].Len;
-          tmpfirst = next;
-        }
-      next = Halo[next].NextHaloInFOFgroup;
-    }
+  int tmpfirst = HaloAux[Halo[g->HaloNr].FirstHaloInFOFgroup].MostMassiveSubhalo;
 
   o->MMSubID = calc_big_db_subid_index(g->SnapNum, Halo[tmpfirst].FileNr, Halo[tmpfirst].SubhaloIndex);
 #endif
@@ -365,18 +543,20 @@ void prepare_galaxy_for_output(int n, struct GALAXY *g, struct GALAXY_OUTPUT *o)
 #ifdef COMPUTE_SPECPHOT_PROPERTIES
 #ifdef POST_PROCESS_MAGS
   //Convert recorded star formation histories into mags
-  post_process_spec_mags(o);
+#ifndef ASYNC_OUTPUT
+  post_process_spec_mags(o);    //with ASYNC_OUTPUT this is done by the output thread
+#endif
 #else //ndef POST_PROCESS_MAGS
 
 #ifdef OUTPUT_REST_MAGS
   // Luminosities are converted into Mags in various bands
   for(j = 0; j < NMAG; j++)
     {
-      //o->Mag[j] = lum_to_mag(g->Lum[j][n]); -> DONE ON TOP FOR LIGHT_OUTPUT AS WELL
-      o->MagBulge[j] = lum_to_mag(g->LumBulge[j][n]);
-      o->MagDust[j] = lum_to_mag(g->LumDust[j][n]);
+      //o->Mag[j] = lum_to_mag(GALLUM(*g).Lum[j][n]); -> DONE ON TOP FOR LIGHT_OUTPUT AS WELL
+      o->MagBulge[j] = lum_to_mag(GALLUM(*g).LumBulge[j][n]);
+      o->MagDust[j] = lum_to_mag(GALLUM(*g).LumDust[j][n]);
 #ifdef ICL
-      o->MagICL[j] = lum_to_mag(g->ICLLum[j][n]);
+      o->MagICL[j] = lum_to_mag(GALLUM(*g).ICLLum[j][n]);
 #endif
     }
 
@@ -387,19 +567,19 @@ void prepare_galaxy_for_output(int n, struct GALAXY *g, struct GALAXY_OUTPUT *o)
   // Luminosities in various bands
   for(j = 0; j < NMAG; j++)
     {
-      o->ObsMag[j] = lum_to_mag(g->ObsLum[j][n]);
-      o->ObsMagBulge[j] = lum_to_mag(g->ObsLumBulge[j][n]);
-      o->ObsMagDust[j] = lum_to_mag(g->ObsLumDust[j][n]);
+      o->ObsMag[j] = lum_to_mag(GALLUM(*g).ObsLum[j][n]);
+      o->ObsMagBulge[j] = lum_to_mag(GALLUM(*g).ObsLumBulge[j][n]);
+      o->ObsMagDust[j] = lum_to_mag(GALLUM(*g).ObsLumDust[j][n]);
 #ifdef ICL
-      o->ObsMagICL[j] = lum_to_mag(g->ObsICL[j][n]);
+      o->ObsMagICL[j] = lum_to_mag(GALLUM(*g).ObsICL[j][n]);
 #endif
 
 #ifdef OUTPUT_MOMAF_INPUTS
-      o->dObsMag[j] = lum_to_mag(g->dObsLum[j][n]);
-      o->dObsMagBulge[j] = lum_to_mag(g->dObsLumBulge[j][n]);
-      o->dObsMagDust[j] = lum_to_mag(g->dObsLumDust[j][n]);
+      o->dObsMag[j] = lum_to_mag(GALLUM(*g).dObsLum[j][n]);
+      o->dObsMagBulge[j] = lum_to_mag(GALLUM(*g).dObsLumBulge[j][n]);
+      o->dObsMagDust[j] = lum_to_mag(GALLUM(*g).dObsLumDust[j][n]);
 #ifdef ICL
-      o->dObsMagICL[j] = lum_to_mag(g->dObsICL[j][n]);
+      o->dObsMagICL[j] = lum_to_mag(GALLUM(*g).dObsICL[j][n]);
 #endif
 #endif
     }
@@ -62,23 +62,67 @@ void close_galaxy_tree_file(void)
 }
 
 
+/**@brief Size of the buffer in which the galaxies of one tree are kept
+ *        until save_galaxy_tree_finalize(), in bytes. */
+static double galaxy_tree_buffer_bytes(void)
+{
+  return GALTREE_BUFFER_FRACTION * MaxMemSize * 1024. * 1024.;
+}
+
+
+/**@brief Makes room for more galaxies in GalTreeOutput or, if that
+ *        would take more than galaxy_tree_buffer_bytes(), writes the
+ *        galaxies of the current tree to the file and keeps doing so
+ *        for the rest of this tree. */
+static void grow_galaxy_tree_output(void)
+{
+  int newmax = ALLOC_INCREASE_FACTOR * MaxGalTreeOutput + 1;
+
+  if(sizeof(struct GALAXY_OUTPUT) * (double) newmax > galaxy_tree_buffer_bytes())
+    {
+      myfseek(FdGalTree, (1 + TotGalCount) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+      myfwrite(GalTreeOutput, sizeof(struct GALAXY_OUTPUT), NGalTreeOutput, FdGalTree);
+      GalTreeOutputOnDisk = 1;
+    }
+  else
+    {
+      MaxGalTreeOutput = newmax;
+      GalTreeOutput =
+        static_cast < GALAXY_OUTPUT * >(myrealloc_movable(GalTreeOutput,
+                                                          sizeof(struct GALAXY_OUTPUT) * MaxGalTreeOutput));
+    }
+}
+
+
 /*
  * for now store SFH bins boht in GALAXY_OUTPUT and SFH_OUTPUT to check things are ok.
  * Later choose only latter mode.
+ *
+ * The galaxies of a tree are kept in GalTreeOutput (in the order of
+ * IndexStored) until save_galaxy_tree_finalize() writes them in one go.
  */
 void save_galaxy_tree_append(int i)
 {
-  int ibin, numbins;
-  struct GALAXY_OUTPUT galaxy_output;
+  struct GALAXY_OUTPUT galaxy_output_disk, *galaxy_output;
+
+  if(!GalTreeOutputOnDisk && NGalTreeOutput >= MaxGalTreeOutput)
+    grow_galaxy_tree_output();
 
-  prepare_galaxy_for_output(HaloGal[i].SnapNum, &HaloGal[i], &galaxy_output);
+  if(GalTreeOutputOnDisk)
+    galaxy_output = &galaxy_output_disk;
+  else
+    galaxy_output = &GalTreeOutput[NGalTreeOutput];
+
+  prepare_galaxy_for_output(HaloGal[i].SnapNum, &HaloGal[i], galaxy_output);
 
 #ifdef STAR_FORMATION_HISTORY
-  galaxy_output.sfh_numbins = galaxy_output.sfh_ibin;
+  galaxy_output->sfh_numbins = galaxy_output->sfh_ibin;
 #endif
 
-  myfwrite(&galaxy_output, sizeof(struct GALAXY_OUTPUT), 1, FdGalTree);
-
+  if(GalTreeOutputOnDisk)
+    myfwrite(galaxy_output, sizeof(struct GALAXY_OUTPUT), 1, FdGalTree);
+  else
+    NGalTreeOutput++;
 }
 
 
@@ -86,7 +130,6 @@ void save_galaxy_tree_append(int i)
 void save_galaxy_tree_finalize(int filenr, int tree)
 {
   int i, p, num;
-  struct GALAXY_OUTPUT galaxy_output;
 
   for(i = 0; i < NGalTree; i++)
     {
@@ -98,15 +141,32 @@ void save_galaxy_tree_finalize(int filenr, int tree)
 
   GalCount = 0;
 
+  /* start the walks from the latest snapshot down, and within a snapshot
+   * in index order: bucket the galaxies by snapshot first */
+  int *order, *stack, snapstart[MAXSNAPS + 1];
+
+  stack = (int *) mymalloc("stack", sizeof(int) * NGalTree);
+  order = (int *) mymalloc("order", sizeof(int) * NGalTree);
+
+  for(num = 0; num <= MAXSNAPS; num++)
+    snapstart[num] = 0;
+  for(i = 0; i < NGalTree; i++)
+    if(GalTree[i].SnapNum >= 0 && GalTree[i].SnapNum <= LastDarkMatterSnapShot)
+      snapstart[GalTree[i].SnapNum + 1]++;
+  for(num = 0; num < MAXSNAPS; num++)
+    snapstart[num + 1] += snapstart[num];
+  for(i = 0; i < NGalTree; i++)
+    if(GalTree[i].SnapNum >= 0 && GalTree[i].SnapNum <= LastDarkMatterSnapShot)
+      order[snapstart[GalTree[i].SnapNum]++] = i;
+  /* snapstart[num] is now the end of bucket num */
+
   for(num = LastDarkMatterSnapShot; num >= 0; num--)
-    {
-      for(i = 0; i < NGalTree; i++)
-        {
-          if(GalTree[i].SnapNum == num)
-            if(GalTree[i].Done == 0)
-              walk_galaxy_tree(i);
-        }
-    }
+    for(i = (num > 0 ? snapstart[num - 1] : 0); i < snapstart[num]; i++)
+      if(GalTree[order[i]].Done == 0)
+        walk_galaxy_tree(order[i], stack);
+
+  myfree(order);
+  myfree(stack);
 
   for(i = 0; i < NGalTree; i++)
     {
@@ -151,24 +211,29 @@ void save_galaxy_tree_finalize(int filenr, int tree)
      and over all the galaxies written so far */
   // for DB compatible output, pad the first line with the size of one struct.
 
-  for(i = 0; i < NGalTree; i++)
-    {
-      myfseek(FdGalTree, (1 + TotGalCount + i) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
-      myfread(&galaxy_output, sizeof(struct GALAXY_OUTPUT), 1, FdGalTree);
-
-      prepare_galaxy_tree_info_for_output(filenr, tree, &GalTree[i], &galaxy_output);
-
-      myfseek(FdGalTree, (1 + TotGalCount + i) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
-      myfwrite(&galaxy_output, sizeof(struct GALAXY_OUTPUT), 1, FdGalTree);
-
-    }
-
   // GL: propose to only reorder file on disk based on input (or Makefile) parameter
   // if DB is fast in ordering, eg using SSDs, we could leave it out here.
   // BTW it is BETTER not to reorder galaxies if SFHBins are not also reordered,
   // if at least both are to be used in light cone post processing.
   // for easier to read
-  save_galaxy_tree_reorder_on_disk();
+  if(GalTreeOutputOnDisk)
+    {
+      save_galaxy_tree_info_on_disk(filenr, tree);
+      save_galaxy_tree_reorder_on_disk();
+    }
+  else
+    {
+      if(NGalTreeOutput != NGalTree)
+        terminate("NGalTreeOutput != NGalTree");
+
+      for(i = 0; i < NGalTree; i++)
+        prepare_galaxy_tree_info_for_output(filenr, tree, &GalTree[i], &GalTreeOutput[i]);
+
+      save_galaxy_tree_reorder_in_memory();
+
+      myfseek(FdGalTree, (1 + TotGalCount) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+      myfwrite(GalTreeOutput, sizeof(struct GALAXY_OUTPUT), NGalTree, FdGalTree);
+    }
 
   TotGalCount += NGalTree;
 
@@ -229,46 +294,85 @@ void prepare_galaxy_tree_info_for_output(int filenr, int tree, struct galaxy_tre
 
 
 
-int walk_galaxy_tree(int nr)
+/**@brief Numbers the galaxies reached from nr depth first (first
+ *        progenitor, then its siblings) and sets their TreeRoot,
+ *        MainLeaf and LastProgGal. Returns the last galaxy numbered.
+ *
+ *  This is the recursion
+ *    walk(nr): number nr; last = walk(FirstProgGal) or nr;
+ *              LastProgGal = last; return walk(NextProgGal) or last
+ *  with the calls on FirstProgGal kept on an explicit stack (of at
+ *  most NGalTree entries) and the ones on NextProgGal turned into a
+ *  loop, so deep trees cannot overflow the call stack. */
+int walk_galaxy_tree(int nr, int *stack)
 {
-  int last;
+  int nstack = 0, last, p, resume;
 
-  last = nr;
-
-  if(GalTree[nr].Done == 0)
+  while(1)
     {
-      GalTree[nr].Done = 1;
-      GalTree[nr].GalID = GalCount++;
-
-      if(GalTree[nr].TreeRoot == -1)
-        GalTree[nr].TreeRoot = nr;
+      last = nr;
 
-      if(GalTree[nr].FirstProgGal >= 0)
+      if(GalTree[nr].Done == 0)
         {
-          GalTree[GalTree[nr].FirstProgGal].TreeRoot = GalTree[nr].TreeRoot;
-          last = walk_galaxy_tree(GalTree[nr].FirstProgGal);
-          GalTree[nr].MainLeaf = GalTree[GalTree[nr].FirstProgGal].MainLeaf;
-        }
-      else
-        GalTree[nr].MainLeaf = nr;
+          GalTree[nr].Done = 1;
+          GalTree[nr].GalID = GalCount++;
 
-      GalTree[nr].LastProgGal = last;
+          if(GalTree[nr].TreeRoot == -1)
+            GalTree[nr].TreeRoot = nr;
 
-      if(GalTree[nr].NextProgGal >= 0)
-        {
-          if(GalTree[nr].NextProgGal >= NGalTree)
+          if(GalTree[nr].FirstProgGal >= 0)
             {
-              printf("\n nr=%d NGalTree=%d GalTree[nr].NextProgGal=%d\n",
-                     nr, NGalTree, GalTree[nr].NextProgGal);
-              terminate("GalTree[nr].NextProgGal >= NGalTree");
+              GalTree[GalTree[nr].FirstProgGal].TreeRoot = GalTree[nr].TreeRoot;
+              stack[nstack++] = nr;
+              nr = GalTree[nr].FirstProgGal;
+              continue;
             }
 
-          GalTree[GalTree[nr].NextProgGal].TreeRoot = GalTree[nr].TreeRoot;
-          last = walk_galaxy_tree(GalTree[nr].NextProgGal);
+          GalTree[nr].MainLeaf = nr;
+          GalTree[nr].LastProgGal = nr;
+
+          if(GalTree[nr].NextProgGal >= 0)
+            {
+              nr = walk_galaxy_tree_next(nr);
+              continue;
+            }
+        }
+
+      /* hand last back to the galaxies waiting for their first progenitor */
+      resume = 0;
+      while(nstack > 0)
+        {
+          p = stack[--nstack];
+          GalTree[p].MainLeaf = GalTree[GalTree[p].FirstProgGal].MainLeaf;
+          GalTree[p].LastProgGal = last;
+
+          if(GalTree[p].NextProgGal >= 0)
+            {
+              nr = walk_galaxy_tree_next(p);
+              resume = 1;
+              break;
+            }
         }
+
+      if(!resume)
+        return last;
+    }
+}
+
+
+/**@brief Passes the TreeRoot of nr on to its next sibling and
+ *        returns that sibling. */
+int walk_galaxy_tree_next(int nr)
+{
+  if(GalTree[nr].NextProgGal >= NGalTree)
+    {
+      printf("\n nr=%d NGalTree=%d GalTree[nr].NextProgGal=%d\n", nr, NGalTree, GalTree[nr].NextProgGal);
+      terminate("GalTree[nr].NextProgGal >= NGalTree");
     }
 
-  return last;
+  GalTree[GalTree[nr].NextProgGal].TreeRoot = GalTree[nr].TreeRoot;
+
+  return GalTree[nr].NextProgGal;
 }
 
 
@@ -280,14 +384,14 @@ struct mp_tree_data
 };
 
 
-void save_galaxy_tree_reorder_on_disk(void)
+/**@brief Sets id[i] to the position of galaxy i (in the order of
+ *        IndexStored) once the galaxies of the tree are ordered by GalID. */
+static void get_galaxy_tree_order(int *id)
 {
-  int i, idsource, idsave, dest, *id;
-  struct GALAXY_OUTPUT galaxy_save, galaxy_source;
+  int i;
   struct mp_tree_data *mp;
 
   mp = (struct mp_tree_data *) mymalloc("mp", sizeof(struct mp_tree_data) * NGalTree);
-  id = (int *) mymalloc("id", sizeof(int) * NGalTree);
 
   for(i = 0; i < NGalTree; i++)
     {
@@ -300,39 +404,166 @@ void save_galaxy_tree_reorder_on_disk(void)
   for(i = 0; i < NGalTree; i++)
     id[mp[i].index] = i;
 
+  myfree(mp);
+}
+
+
+/**@brief Orders the galaxies of the current tree in GalTreeOutput by GalID. */
+void save_galaxy_tree_reorder_in_memory(void)
+{
+  int i, dest, *id;
+  struct GALAXY_OUTPUT galaxy_save;
+
+  id = (int *) mymalloc("id", sizeof(int) * NGalTree);
+  get_galaxy_tree_order(id);
+
   for(i = 0; i < NGalTree; i++)
+    while(id[i] != i)
+      {
+        dest = id[i];
+        galaxy_save = GalTreeOutput[dest];
+        GalTreeOutput[dest] = GalTreeOutput[i];
+        GalTreeOutput[i] = galaxy_save;
+        id[i] = id[dest];
+        id[dest] = dest;
+      }
+
+  myfree(id);
+}
+
+
+/**@brief Number of galaxies read at a time when the galaxies of a tree
+ *        did not fit in GalTreeOutput and have to be finished in the
+ *        file, with two such chunks in memory. */
+static int galaxy_tree_chunk_size(void)
+{
+  int nchunk = galaxy_tree_buffer_bytes() / (2 * sizeof(struct GALAXY_OUTPUT));
+
+  if(nchunk < 1)
+    nchunk = 1;
+  if(nchunk > NGalTree)
+    nchunk = NGalTree;
+
+  return nchunk;
+}
+
+
+/**@brief Adds the galaxy tree pointers to the galaxies of the current tree
+ *        that were written to the file, reading and writing them back in
+ *        chunks. */
+void save_galaxy_tree_info_on_disk(int filenr, int tree)
+{
+  int i, j, n, nchunk;
+  struct GALAXY_OUTPUT *buf;
+
+  nchunk = galaxy_tree_chunk_size();
+  buf = (struct GALAXY_OUTPUT *) mymalloc("buf", sizeof(struct GALAXY_OUTPUT) * nchunk);
+
+  for(i = 0; i < NGalTree; i += n)
     {
-      if(id[i] != i)
-        {
-          myfseek(FdGalTree, (1 + TotGalCount + i) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
-          myfread(&galaxy_source, sizeof(struct GALAXY_OUTPUT), 1, FdGalTree);
-          idsource = id[i];
-          dest = id[i];
+      n = (NGalTree - i < nchunk) ? NGalTree - i : nchunk;
 
-          do
-            {
-              myfseek(FdGalTree, (1 + TotGalCount + dest) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
-              myfread(&galaxy_save, sizeof(struct GALAXY_OUTPUT), 1, FdGalTree);
-              idsave = id[dest];
+      myfseek(FdGalTree, (1 + TotGalCount + i) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+      myfread(buf, sizeof(struct GALAXY_OUTPUT), n, FdGalTree);
+
+      for(j = 0; j < n; j++)
+        prepare_galaxy_tree_info_for_output(filenr, tree, &GalTree[i + j], &buf[j]);
+
+      myfseek(FdGalTree, (1 + TotGalCount + i) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+      myfwrite(buf, sizeof(struct GALAXY_OUTPUT), n, FdGalTree);
+    }
+
+  myfree(buf);
+}
+
+
+/**@brief Orders the galaxies of the current tree in the file by GalID
+ *        when they did not fit in memory. The ordered output is cut into
+ *        buckets of one chunk each. A single sequential pass over the tree
+ *        distributes every galaxy to its bucket in a scratch file, after
+ *        which each bucket is read back, ordered in memory and written in
+ *        place, so every galaxy is read and written twice. */
+void save_galaxy_tree_reorder_on_disk(void)
+{
+  int i, j, k, b, n, m, nchunk, nbucket, *id, *pos, *fill, *count;
+  struct GALAXY_OUTPUT *in, *out;
+  FILE *fd;
+
+  id = (int *) mymalloc("id", sizeof(int) * NGalTree);
+  get_galaxy_tree_order(id);
+
+  nchunk = galaxy_tree_chunk_size();
+  nbucket = (NGalTree + nchunk - 1) / nchunk;
 
-              myfseek(FdGalTree, (1 + TotGalCount + dest) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
-              myfwrite(&galaxy_source, sizeof(struct GALAXY_OUTPUT), 1, FdGalTree);
-              id[dest] = idsource;
+  /* pos[s] is the position in the ordered output of the galaxy at s in the
+   * scratch file, fill[b] where the next galaxy of bucket b goes there */
+  pos = (int *) mymalloc("pos", sizeof(int) * NGalTree);
+  fill = (int *) mymalloc("fill", sizeof(int) * nbucket);
+  count = (int *) mymalloc("count", sizeof(int) * (nbucket + 1));
+  in = (struct GALAXY_OUTPUT *) mymalloc("in", sizeof(struct GALAXY_OUTPUT) * nchunk);
+  out = (struct GALAXY_OUTPUT *) mymalloc("out", sizeof(struct GALAXY_OUTPUT) * nchunk);
 
-              if(dest == i)
-                break;
+  if(!(fd = tmpfile()))
+    terminate("can't open scratch file to reorder galaxy tree");
 
-              galaxy_source = galaxy_save;
-              idsource = idsave;
+  for(b = 0; b < nbucket; b++)
+    fill[b] = b * nchunk;
 
-              dest = idsource;
+  myfseek(FdGalTree, (1 + TotGalCount) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+  for(j = 0; j < NGalTree; j += m)
+    {
+      m = (NGalTree - j < nchunk) ? NGalTree - j : nchunk;
+      myfread(in, sizeof(struct GALAXY_OUTPUT), m, FdGalTree);
+
+      /* group the chunk by bucket, keeping the order within each */
+      memset(count, 0, sizeof(int) * (nbucket + 1));
+      for(k = 0; k < m; k++)
+        count[id[j + k] / nchunk + 1]++;
+      for(b = 0; b < nbucket; b++)
+        count[b + 1] += count[b];
+      for(k = 0; k < m; k++)
+        {
+          b = id[j + k] / nchunk;
+          pos[fill[b]++] = id[j + k];
+          out[count[b]++] = in[k];
+        }
+      /* count[b] is now the end of bucket b in out */
+
+      for(b = 0; b < nbucket; b++)
+        {
+          i = (b > 0) ? count[b - 1] : 0;
+          if(count[b] > i)
+            {
+              myfseek(fd, (fill[b] - (count[b] - i)) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+              myfwrite(out + i, sizeof(struct GALAXY_OUTPUT), count[b] - i, fd);
             }
-          while(1);
         }
     }
 
+  /* the bucket starting at i in the scratch file holds exactly the
+   * galaxies of the chunk of the ordered output starting at i */
+  for(i = 0; i < NGalTree; i += n)
+    {
+      n = (NGalTree - i < nchunk) ? NGalTree - i : nchunk;
+
+      myfseek(fd, i * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+      myfread(in, sizeof(struct GALAXY_OUTPUT), n, fd);
+
+      for(k = 0; k < n; k++)
+        out[pos[i + k] - i] = in[k];
+
+      myfseek(FdGalTree, (1 + TotGalCount + i) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
+      myfwrite(out, sizeof(struct GALAXY_OUTPUT), n, FdGalTree);
+    }
+
+  fclose(fd);
+
+  myfree(out);
+  myfree(in);
+  myfree(count);
+  myfree(fill);
+  myfree(pos);
   myfree(id);
-  myfree(mp);
 
   myfseek(FdGalTree, (1 + TotGalCount + NGalTree) * sizeof(struct GALAXY_OUTPUT), SEEK_SET);
 }
@@ -20,6 +20,7 @@
 
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 
 #include "allvars.h"
 #include "proto.h"
@@ -97,11 +98,96 @@ void read_scaling_parameters()
   *  Add by Qi Guo adapted by Bruno Henriques */
 
 
+/* Concentration correction tabulated per snapshot in log10(M) on
+ * [CCORR_LOGM_MIN, CCORR_LOGM_MAX], in code units of 1e10 Msun/h. Haloes
+ * outside the table, or in bins where find_c() has no root in its bracket,
+ * go through the exact calculation. */
+#define CCORR_LOGM_MIN -4.0
+#define CCORR_LOGM_MAX 6.0
+#define CCORR_NBIN 2001
+#define CCORR_INV_DLOGM ((CCORR_NBIN - 1) / (CCORR_LOGM_MAX - CCORR_LOGM_MIN))
+
+static double CCorrTable[MAXSNAPS][CCORR_NBIN];
+static double CCorrOmegaRatio[MAXSNAPS];
+
+/* redshift-only factors of scale_cosmology() */
+static double ScaleVCen[MAXSNAPS];
+static double ScaleSqrtAA[MAXSNAPS];    /* sqrt(AA_OriginalCosm / AA) */
+static double ScaleVelFac[MAXSNAPS];    /* sqrt(ScaleMass / ScalePos) * ScaleSqrtAA */
+static double ScaleSpinFac[MAXSNAPS];
+static double ScaleSqrtMassPos;
+
+/* cosmology and snapshot list the tables above were built for */
+static double ScaleCosmologyKey[8];
+static double ScaleCosmologyAA[MAXSNAPS], ScaleCosmologyAAOriginal[MAXSNAPS];
+static int ScaleCosmologyLastSnap;
+static int ScaleCosmologyTablesDone = 0;
+
+static double compute_c_correction(double mass, double ratio);
+static int find_c_bracketed(double c_ori, double ratio);
+
+/** @brief Builds the per-snapshot factors and concentration correction
+ *         tables used by scale_cosmology(). Only does work the first time
+ *         and when the cosmology or the snapshot list (AA, AA_OriginalCosm,
+ *         LastSnapShotNr) has changed since; must be called outside of any
+ *         parallel region, before the trees are scaled, and again whenever
+ *         the redshift lists are re-read. */
+void init_scale_cosmology()
+{
+  int snap, i;
+  double key[8] = { Omega, OmegaLambda, Hubble_h, ScalePos, ScaleMass,
+    Omega_OriginalCosm, OmegaLambda_OriginalCosm, Hubble_h_OriginalCosm
+  };
+
+  if(ScaleCosmologyTablesDone && memcmp(key, ScaleCosmologyKey, sizeof(key)) == 0
+     && ScaleCosmologyLastSnap == LastSnapShotNr
+     && memcmp(AA, ScaleCosmologyAA, sizeof(double) * (LastSnapShotNr + 1)) == 0
+     && memcmp(AA_OriginalCosm, ScaleCosmologyAAOriginal, sizeof(double) * (LastSnapShotNr + 1)) == 0)
+    return;
+
+  ScaleSqrtMassPos = sqrt(ScaleMass / ScalePos);
+
+  for(snap = 0; snap <= LastSnapShotNr; snap++)
+    {
+      double Omega_new = Omega * 1. / pow3(AA[snap]) / (Omega * 1. / pow3(AA[snap]) + OmegaLambda);
+      double Omega_original = Omega_OriginalCosm * 1. / pow3(AA_OriginalCosm[snap]) /
+        (Omega_OriginalCosm * 1. / pow3(AA_OriginalCosm[snap]) + OmegaLambda_OriginalCosm);
+
+      CCorrOmegaRatio[snap] = Omega_original / Omega_new;
+
+      ScaleVCen[snap] = ScalePos * dgrowth_factor_dt(AA[snap], Omega, OmegaLambda) /
+        dgrowth_factor_dt(AA_OriginalCosm[snap], Omega_OriginalCosm, OmegaLambda_OriginalCosm) *
+        AA[snap] / AA_OriginalCosm[snap] * Hubble_h / Hubble_h_OriginalCosm;
+      ScaleSqrtAA[snap] = sqrt(AA_OriginalCosm[snap] / AA[snap]);
+      ScaleVelFac[snap] = ScaleSqrtMassPos * ScaleSqrtAA[snap];
+      ScaleSpinFac[snap] = ScalePos * ScaleSqrtMassPos * sqrt(AA[snap] / AA_OriginalCosm[snap]);
+    }
+
+#ifdef OPENMP
+#pragma omp parallel for private(i) schedule(dynamic)
+#endif
+  for(snap = 0; snap <= LastSnapShotNr; snap++)
+    for(i = 0; i < CCORR_NBIN; i++)
+      {
+        double mass = pow(10., CCORR_LOGM_MIN + i / CCORR_INV_DLOGM);
+
+        if(find_c_bracketed(5 * pow(mass / 10000., -0.1), CCorrOmegaRatio[snap]))
+          CCorrTable[snap][i] = compute_c_correction(mass, CCorrOmegaRatio[snap]);
+        else
+          CCorrTable[snap][i] = -1.;
+      }
+
+  memcpy(ScaleCosmologyKey, key, sizeof(key));
+  memcpy(ScaleCosmologyAA, AA, sizeof(double) * (LastSnapShotNr + 1));
+  memcpy(ScaleCosmologyAAOriginal, AA_OriginalCosm, sizeof(double) * (LastSnapShotNr + 1));
+  ScaleCosmologyLastSnap = LastSnapShotNr;
+  ScaleCosmologyTablesDone = 1;
+}
+
+
 void scale_cosmology(int nhalos)
 {
   int i, j;
-  double Scale_V, CenVel[3], dv;
-
 
   //Save unscaled properties
   for(i = 0; i < nhalos; i++)
@@ -121,40 +207,45 @@ void scale_cosmology(int nhalos)
         }
     }
 
+  scale_halos(Halo, nhalos);
+}
+
+/** @brief Scales the nhalos haloes of one tree, starting at halo, to the
+ *         new cosmology. */
+void scale_halos(struct halo_data *halo, int nhalos)
+{
+  int i, j;
+  double Scale_V, CenVel[3], dv;
+
   for(i = 0; i < nhalos; i++)
     {
-      Scale_V = scale_v_cen(Halo[Halo[i].FirstHaloInFOFgroup].SnapNum);
+      Scale_V = scale_v_cen(halo[halo[i].FirstHaloInFOFgroup].SnapNum);
 
       //will make sure haloes in the future are not scaled/un_scaled
-      if(Halo[i].SnapNum <= LastSnapShotNr)
+      if(halo[i].SnapNum <= LastSnapShotNr)
         {
-          if(Halo[i].M_Crit200 > 1.e-8)
-            Halo[i].M_Crit200 =
-              Halo[i].M_Crit200 * ScaleMass * c_correction(Halo[i].M_Crit200, Halo[i].SnapNum);
-          if(Halo[i].M_Mean200 > 1.e-8)
-            Halo[i].M_Mean200 =
-              Halo[i].M_Mean200 * ScaleMass * c_correction(Halo[i].M_Mean200, Halo[i].SnapNum);
-          Halo[i].Vmax =
-            Halo[i].Vmax * sqrt(ScaleMass / ScalePos) * sqrt(AA_OriginalCosm[Halo[i].SnapNum] /
-                                                             AA[Halo[i].SnapNum]);
+          int snap = halo[i].SnapNum;
+
+          if(halo[i].M_Crit200 > 1.e-8)
+            halo[i].M_Crit200 = halo[i].M_Crit200 * ScaleMass * c_correction(halo[i].M_Crit200, snap);
+          if(halo[i].M_Mean200 > 1.e-8)
+            halo[i].M_Mean200 = halo[i].M_Mean200 * ScaleMass * c_correction(halo[i].M_Mean200, snap);
+          halo[i].Vmax = halo[i].Vmax * ScaleSqrtMassPos * ScaleSqrtAA[snap];
 
           for(j = 0; j < 3; j++)
             {
-              Halo[i].Pos[j] = Halo[i].Pos[j] * ScalePos;
-              Halo[i].Spin[j] *=
-                ScalePos * sqrt(ScaleMass / ScalePos) * sqrt(AA[Halo[i].SnapNum] /
-                                                             AA_OriginalCosm[Halo[i].SnapNum]);
+              halo[i].Pos[j] = halo[i].Pos[j] * ScalePos;
+              halo[i].Spin[j] *= ScaleSpinFac[snap];
 
-              CenVel[j] = Halo[Halo[i].FirstHaloInFOFgroup].Vel[j] * Scale_V;
-              if(i != Halo[i].FirstHaloInFOFgroup)      // subhalos
+              CenVel[j] = halo[halo[i].FirstHaloInFOFgroup].Vel[j] * Scale_V;
+              if(i != halo[i].FirstHaloInFOFgroup)      // subhalos
                 {
-                  dv = Halo[i].Vel[j] - Halo[Halo[i].FirstHaloInFOFgroup].Vel[j];
-                  dv *=
-                    sqrt(ScaleMass / ScalePos) * sqrt(AA_OriginalCosm[Halo[i].SnapNum] / AA[Halo[i].SnapNum]);
-                  Halo[i].Vel[j] = CenVel[j] + dv;
+                  dv = halo[i].Vel[j] - halo[halo[i].FirstHaloInFOFgroup].Vel[j];
+                  dv *= ScaleVelFac[snap];
+                  halo[i].Vel[j] = CenVel[j] + dv;
                 }
               else              //central halos
-                Halo[i].Vel[j] = Halo[i].Vel[j] * Scale_V;
+                halo[i].Vel[j] = halo[i].Vel[j] * Scale_V;
             }
         }
     }
@@ -184,15 +275,26 @@ void un_scale_cosmology(int nhalos)
 }
 
 
+/** @brief Ratio of the halo mass after and before rescaling the NFW
+ *         concentration to the new cosmology, interpolated in log10(mass)
+ *         from the table built by init_scale_cosmology(). */
 double c_correction(float mass, int snapnum)
 {
-  double c_original, c_new, Omega_new, Omega_original, ratio;
+  double x = (log10(mass) - CCORR_LOGM_MIN) * CCORR_INV_DLOGM;
+  int i = (int) x;
+
+  if(x < 0. || i >= CCORR_NBIN - 1 || CCorrTable[snapnum][i] < 0. || CCorrTable[snapnum][i + 1] < 0.)
+    return compute_c_correction(mass, CCorrOmegaRatio[snapnum]);
+
+  x -= i;
+  return (1. - x) * CCorrTable[snapnum][i] + x * CCorrTable[snapnum][i + 1];
+}
+
+static double compute_c_correction(double mass, double ratio)
+{
+  double c_original, c_new;
 
   c_original = 5 * pow(mass / 10000., -0.1);
-  Omega_new = Omega * 1. / pow3(AA[snapnum]) / (Omega * 1. / pow3(AA[snapnum]) + OmegaLambda);
-  Omega_original = Omega_OriginalCosm * 1. / pow3(AA_OriginalCosm[snapnum]) /
-    (Omega_OriginalCosm * 1. / pow3(AA_OriginalCosm[snapnum]) + OmegaLambda_OriginalCosm);
-  ratio = Omega_original / Omega_new;
   c_new = find_c(c_original, ratio);
 
   return func_c(c_new) / func_c(c_original);
@@ -220,6 +322,15 @@ double find_c(double c_ori, double ratio)
   return xx;
 }
 
+/** @brief Whether the root find_c() looks for lies within its bracket
+ *         [1, 50]; it does not terminate otherwise. */
+static int find_c_bracketed(double c_ori, double ratio)
+{
+  double constant = ratio * func_c(c_ori) / c_ori / c_ori / c_ori;
+
+  return (func_c(1.) - constant) * (func_c(50.) / 50. / 50. / 50. - constant) < 0;
+}
+
 double func_c(double c)
 {
   return log(1 + c) - c / (1 + c);
@@ -262,11 +373,5 @@ double dgrowth_factor_dt(double a, double omega_m, double omega_l)
 
 double scale_v_cen(int snapnum)
 {
-  double Scale_V;
-
-  Scale_V = ScalePos * dgrowth_factor_dt(AA[snapnum], Omega, OmegaLambda) /
-    dgrowth_factor_dt(AA_OriginalCosm[snapnum], Omega_OriginalCosm, OmegaLambda_OriginalCosm) *
-    AA[snapnum] / AA_OriginalCosm[snapnum] * Hubble_h / Hubble_h_OriginalCosm;
-  return Scale_V;
-
+  return ScaleVCen[snapnum];
 }